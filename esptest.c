@@ -137,5 +137,31 @@ void hashtest() {
 	}
 	printf ("Of %d samples, %d of them were unique\n", count, inserts);
 	vHtPrintStats(h2);
+
+// -----------------------------------------------------------------------
+	printf ("\nStatic Table Tests\n");
+// -----------------------------------------------------------------------
+
+	// no heap use once created, as for tables used from time-critical tasks
+	static hashtab_t h3;
+	static Link_t h3buckets[31];
+	static char h3entries[htSTATIC_ENTRYBYTES(NUMINTKEYS_H1, 0)];
+
+	errors = pxHtNewStaticTable (&h3, "static", h3buckets, 31, h3entries, sizeof h3entries, NULL) != &h3;
+	srand (1);
+	for (int i = 0; !errors && i < NUMINTKEYS_H1; i++) {
+		int n = rand();
+
+		errors += !iHtIAddVal(&h3, n, (void *)(long)n);
+	}
+	errors += !errors && iHtIAddVal(&h3, -1, NULL) != (h3.ulMaxEntries > NUMINTKEYS_H1);
+	srand (1);
+	for (int i = 0; !errors && i < NUMINTKEYS_H1; i++) {
+		int n = rand();
+
+		errors += pvHtIGetVal(&h3, n) != (void *)(long)n;
+	}
+	printresult(errors, "Filling and checking a static table");
+	vHtPrintStats(&h3);
 }
 
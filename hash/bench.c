@@ -0,0 +1,807 @@
+//
+//  bench.c
+//  hash
+//
+//  Timing comparisons between hash table variants.  Each benchmark prints
+//  one line per variant with the nanoseconds per operation.
+//
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "hashtab.h"
+#include "hashtab_typed.h"
+#include "htlog.h"
+#include "htcombine.h"
+#include "htshm.h"
+#include "rsrc.h"
+
+#define BENCHKEYS	1000000		// keys inserted in each table
+#define BENCHBUCKETS	(BENCHKEYS / 2 + 1)
+
+htDEFINE(Bench, unsigned, long, ulHtHashUnsigned, xHtEqUnsigned)
+
+static double now (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1e9 + ts.tv_nsec);
+}
+
+static void report (const char *what, const char *variant, double start, unsigned ops)
+{
+	printf ("%-28s %-10s %8.1f ns/op\n", what, variant, (now() - start) / ops);
+}
+
+// generic hashtab_t versus a table generated by htDEFINE, same keys and sizes
+static void benchTyped (unsigned *keys)
+{
+	hashtab_t *g = pxHtNewHashTable ("bench-generic", BENCHKEYS, 0, 1024, BENCHBUCKETS);
+	htBench_t *t = pxHtBenchNew (BENCHBUCKETS, 0, 1024);
+	double start;
+	long sum = 0;
+
+	start = now();
+	for (int i = 0; i < BENCHKEYS; i++)
+		iHtIAddVal(g, keys[i], (void *)(long)i);
+	report("insert int keys", "generic", start, BENCHKEYS);
+	start = now();
+	for (int i = 0; i < BENCHKEYS; i++)
+		iHtBenchAdd(t, keys[i], i);
+	report("insert int keys", "typed", start, BENCHKEYS);
+
+	start = now();
+	for (int i = 0; i < BENCHKEYS; i++)
+		sum += (long)pvHtIGetVal(g, keys[i]);
+	report("lookup int keys", "generic", start, BENCHKEYS);
+	start = now();
+	for (int i = 0; i < BENCHKEYS; i++)
+		sum -= *pxHtBenchGet(t, keys[i]);
+	report("lookup int keys", "typed", start, BENCHKEYS);
+
+	if (sum != 0)
+		printf ("lookup results differ between generic and typed tables\n");
+	vHtBenchFree(t);
+	vHtFreeHashTable(g);
+}
+
+// counting occurrences: lookup then add on a miss, versus one GetOrAdd probe
+static void benchGetOrAdd (unsigned *keys)
+{
+	hashtab_t *a = pxHtNewHashTable ("bench-findadd", BENCHKEYS, 0, 1024, BENCHBUCKETS);
+	hashtab_t *b = pxHtNewHashTable ("bench-getoradd", BENCHKEYS, 0, 1024, BENCHBUCKETS);
+	double start;
+
+	start = now();
+	for (int pass = 0; pass < 2; pass++) {
+		for (int i = 0; i < BENCHKEYS; i++) {
+			hashent_t *e = pxHtIFindEntry(a, keys[i]);
+
+			if (e)
+				e->lValue++;
+			else
+				iHtIAddVal(a, keys[i], (void *)1);
+		}
+	}
+	report("count int keys", "find+add", start, 2 * BENCHKEYS);
+	start = now();
+	for (int pass = 0; pass < 2; pass++) {
+		for (int i = 0; i < BENCHKEYS; i++)
+			pxHtIGetOrAdd(b, keys[i], NULL)->lValue++;
+	}
+	report("count int keys", "getoradd", start, 2 * BENCHKEYS);
+	vHtFreeHashTable(a);
+	vHtFreeHashTable(b);
+}
+
+// Random lookups over a table much bigger than the TLB covers, with its
+// memory from malloc or from a huge page arena
+static void benchHugePages (unsigned *keys)
+{
+	htArena_t *arena = pxHtNewArenaEx (64 * htHUGEPAGE, htARENA_HUGEPAGES, 0);
+	htConfig_t cfg = { .pxAlloc = pvHtArenaAlloc, .pxFree = vHtArenaFree, .pvAllocCtx = arena };
+	hashtab_t *tabs[2];
+	const char *variant[2] = { "malloc", "hugepages" };
+	unsigned *order = malloc(sizeof (unsigned) * BENCHKEYS);
+	long sum = 0;
+
+	tabs[0] = pxHtNewHashTable ("bench-malloc", 0, 0, 1024, BENCHBUCKETS);
+	tabs[1] = pxHtNewHashTableEx ("bench-huge", 0, 0, 1024, BENCHBUCKETS, &cfg);
+	for (int i = 0; i < BENCHKEYS; i++)
+		order[i] = keys[((unsigned)rand() << 8 ^ rand()) % BENCHKEYS];
+	for (int t = 0; t < 2; t++) {
+		double start;
+
+		for (int i = 0; i < BENCHKEYS; i++)
+			iHtIAddVal(tabs[t], keys[i], (void *)(long)i);
+		start = now();
+		for (int i = 0; i < BENCHKEYS; i++)
+			sum += (long)pvHtIGetVal(tabs[t], order[i]);
+		report("random lookup, big table", variant[t], start, BENCHKEYS);
+	}
+	printf ("(%lu of %lu arena bytes mapped with huge page option)\n",
+			(unsigned long)ulHtArenaMappedBytes(arena), (unsigned long)ulHtArenaBytes(arena));
+	vHtFreeHashTable(tabs[0]);
+	vHtFreeHashTable(tabs[1]);
+	vHtDeleteArena(arena);
+	free(order);
+}
+
+// chained versus cuckoo tables of the same capacity, lookups of present keys
+static void benchCuckoo (unsigned *keys)
+{
+	hashtab_t *tabs[2];
+	const char *variant[2] = { "chained", "cuckoo" };
+	long sum = 0;
+
+	tabs[0] = pxHtNewHashTable ("bench-chained", BENCHKEYS, 0, 1024, BENCHBUCKETS);
+	tabs[1] = pxHtNewHashTableEx ("bench-cuckoo", BENCHKEYS, 0, 0, 0, &(htConfig_t){ .xCuckoo = 1 });
+	for (int t = 0; t < 2; t++) {
+		double start = now();
+
+		for (int i = 0; i < BENCHKEYS; i++)
+			iHtIAddVal(tabs[t], keys[i], (void *)(long)i);
+		report("insert int keys", variant[t], start, BENCHKEYS);
+		start = now();
+		for (int i = 0; i < BENCHKEYS; i++)
+			sum += (long)pvHtIGetVal(tabs[t], keys[i]);
+		report("lookup int keys", variant[t], start, BENCHKEYS);
+	}
+	vHtPrintStats(tabs[1]);
+	vHtFreeHashTable(tabs[0]);
+	vHtFreeHashTable(tabs[1]);
+}
+
+// lookups that mostly miss, with and without a Bloom filter in front of the chains
+static void benchBloom (unsigned *keys)
+{
+	hashtab_t *tabs[2];
+	const char *variant[2] = { "chained", "bloom" };
+	long sum = 0;
+
+	tabs[0] = pxHtNewHashTable ("bench-nobloom", BENCHKEYS, 0, 1024, BENCHBUCKETS);
+	tabs[1] = pxHtNewHashTableEx ("bench-bloom", BENCHKEYS, 0, 1024, BENCHBUCKETS, &(htConfig_t){ .xBloom = 1 });
+	for (int t = 0; t < 2; t++) {
+		double start;
+
+		for (int i = 0; i < BENCHKEYS / 2; i++)
+			iHtIAddVal(tabs[t], keys[i], (void *)(long)i);
+		start = now();
+		for (int i = 0; i < BENCHKEYS; i++)
+			sum += (long)pvHtIGetVal(tabs[t], keys[i]);	// half of these miss
+		report("lookup, 50% misses", variant[t], start, BENCHKEYS);
+		start = now();
+		for (int i = BENCHKEYS / 2; i < BENCHKEYS; i++)
+			sum += (long)pvHtIGetVal(tabs[t], keys[i]);
+		report("lookup, all misses", variant[t], start, BENCHKEYS / 2);
+	}
+	vHtPrintStats(tabs[1]);
+	vHtFreeHashTable(tabs[0]);
+	vHtFreeHashTable(tabs[1]);
+}
+
+// short string keys, compared through pcName with strcmp or held in the entry
+static void benchInlineKeys (unsigned *keys)
+{
+	hashtab_t *tabs[2];
+	const char *variant[2] = { "strcmp", "inline" };
+	char (*names)[16] = malloc(16 * BENCHKEYS);
+	long sum = 0;
+
+	for (int i = 0; i < BENCHKEYS; i++)
+		snprintf(names[i], 16, "k%x", keys[i]);
+	tabs[0] = pxHtNewHashTable ("bench-strkeys", BENCHKEYS, 0, 1024, BENCHBUCKETS);
+	tabs[1] = pxHtNewHashTableEx ("bench-inlinekeys", BENCHKEYS, 0, 1024, BENCHBUCKETS,
+								  &(htConfig_t){ .ulInlineKeys = 16 });
+	for (int t = 0; t < 2; t++) {
+		double start = now();
+
+		for (int i = 0; i < BENCHKEYS; i++)
+			iHtSAddVal(tabs[t], names[i], (void *)(long)i);
+		report("insert short string keys", variant[t], start, BENCHKEYS);
+		start = now();
+		for (int i = 0; i < BENCHKEYS; i++)
+			sum += (long)pvHtSGetVal(tabs[t], names[i]);
+		report("lookup short string keys", variant[t], start, BENCHKEYS);
+	}
+	vHtFreeHashTable(tabs[0]);
+	vHtFreeHashTable(tabs[1]);
+	free(names);
+}
+
+// intersection by hand (htFOREACH and a lookup per entry) versus
+// pxHtIntersection's batched probes, with and without threads
+static void benchSetOps (unsigned *keys)
+{
+	hashtab_t *a = pxHtNewHashTable ("bench-seta", BENCHKEYS, 0, 1024, BENCHBUCKETS);
+	hashtab_t *b = pxHtNewHashTable ("bench-setb", BENCHKEYS, 0, 1024, BENCHBUCKETS);
+	hashtab_t *r;
+	double start;
+
+	for (int i = 0; i < BENCHKEYS; i++) {
+		iHtIAddVal(a, keys[i], NULL);
+		if (i & 1)
+			iHtIAddVal(b, keys[i], NULL);
+	}
+	start = now();
+	r = pxHtNewHashTable ("bench-byhand", 0, 0, 1024, BENCHBUCKETS);
+	htFOREACH(it, e, b) {
+		if (pxHtIFindEntry(a, e->ulKey))
+			iHtIAddVal(r, e->ulKey, e->pxValue);
+	}
+	report("intersect 1M and 500K keys", "by hand", start, b->ulCurEntries);
+	vHtFreeHashTable(r);
+	for (unsigned threads = 1; threads <= 4; threads *= 2) {
+		char variant[16];
+
+		start = now();
+		r = pxHtIntersection ("bench-intersect", a, b, threads);
+		snprintf(variant, sizeof variant, "%u thread%s", threads, threads > 1 ? "s" : "");
+		report("intersect 1M and 500K keys", variant, start, b->ulCurEntries);
+		vHtFreeHashTable(r);
+	}
+	vHtFreeHashTable(a);
+	vHtFreeHashTable(b);
+}
+
+// setting values with no log, and with each sync policy; syncing every
+// change is slow enough that it gets fewer
+static void benchLog (unsigned *keys)
+{
+	const char *variant[4] = { "no log", "no sync", "batched", "each" };
+	unsigned sync[4] = { 0, htLOG_SYNC_NONE, htLOG_SYNC_BATCH, htLOG_SYNC_EACH };
+
+	for (int v = 0; v < 4; v++) {
+		hashtab_t *t = pxHtNewHashTable ("bench-log", BENCHKEYS, 0, 1024, BENCHBUCKETS);
+		htLog_t *log = NULL;
+		unsigned ops = v == 3 ? BENCHKEYS / 100 : BENCHKEYS;
+		double start;
+
+		remove("htbench.log");
+		if (v && !(log = pxHtLogOpen (t, "htbench", &(htLogConfig_t){ .ulSync = sync[v] })))
+			printf ("can't open log\n");
+		start = now();
+		for (unsigned i = 0; i < ops; i++)
+			iHtISetVal(t, keys[i], (void *)(long)i);
+		if (log)
+			iHtLogCommit(log);
+		report("set int values, logged", variant[v], start, ops);
+		if (v == 2)
+			printf ("(%lu batches for %lu changes)\n", pxHtLogStats(log)->ulBatches, pxHtLogStats(log)->ulRecords);
+		if (log)
+			vHtLogClose(log);
+		vHtFreeHashTable(t);
+	}
+	remove("htbench.log");
+}
+
+// a snapshot of a big table by copying every entry versus pxHtClone, then
+// what the original's first changes cost while it shares pages with the clone
+static void benchClone (unsigned *keys)
+{
+	hashtab_t *t = pxHtNewHashTable ("bench-original", BENCHKEYS, 0, 1024, BENCHBUCKETS);
+	hashtab_t *copy, *clone;
+	size_t shared, own;
+	double start;
+
+	for (int i = 0; i < BENCHKEYS; i++)
+		iHtIAddVal(t, keys[i], (void *)(long)i);
+	start = now();
+	copy = pxHtNewHashTable ("bench-copy", BENCHKEYS, 0, 1024, BENCHBUCKETS);
+	htFOREACH(it, e, t) {
+		iHtIAddVal(copy, e->ulKey, e->pxValue);
+	}
+	report("snapshot of 1M entries", "copy", start, 1);
+	vHtFreeHashTable(copy);
+	start = now();
+	clone = pxHtClone ("bench-clone", t);
+	report("snapshot of 1M entries", "clone", start, 1);
+	for (int pass = 0; pass < 2; pass++) {
+		start = now();
+		for (int i = 0; i < BENCHKEYS / 10; i++)
+			iHtISetVal(t, keys[i * 7 % BENCHKEYS], (void *)(long)i);
+		report("set 100K values after clone", pass ? "again" : "first", start, BENCHKEYS / 10);
+	}
+	vHtCloneBytes(t, &shared, &own);
+	printf ("(original now shares %lu bytes with the clone, and has %lu of its own)\n",
+			(unsigned long)shared, (unsigned long)own);
+	vHtFreeHashTable(clone);
+	vHtFreeHashTable(t);
+}
+
+// counter updates from several threads, 90% of them to 8 hot keys: a table
+// behind a mutex versus a combiner
+typedef struct {
+	hashtab_t *pxTable;
+	pthread_mutex_t *pxLock;	// mutex variant
+	htCombiner_t *pxComb;		// combiner variant
+	unsigned *pulKeys;
+	unsigned ulOps;
+} benchWorker_t;
+
+static void *benchCountThread (void *arg)
+{
+	benchWorker_t *w = arg;
+	htCSlot_t *slot = w->pxComb ? pxHtCombinerSlot(w->pxComb) : NULL;
+
+	for (unsigned i = 0; i < w->ulOps; i++) {
+		unsigned key = i % 10 ? i % 8 : w->pulKeys[i % BENCHKEYS];
+
+		if (slot) {
+			lHtCAddToVal(slot, key, 1);
+		} else {
+			pthread_mutex_lock(w->pxLock);
+			lHtIAddToVal(w->pxTable, key, 1);
+			pthread_mutex_unlock(w->pxLock);
+		}
+	}
+	if (slot)
+		vHtCombinerLeave(slot);
+	return (NULL);
+}
+
+static void benchCombine (unsigned *keys)
+{
+	pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+	for (unsigned threads = 1; threads <= 8; threads *= 2) {
+		for (int v = 0; v < 2; v++) {
+			hashtab_t *t = pxHtNewHashTable ("bench-counters", BENCHKEYS / 10, 0, 1024, BENCHBUCKETS / 10);
+			htCombiner_t *comb = v ? pxHtNewCombiner (t, threads) : NULL;
+			benchWorker_t w = { t, &lock, comb, keys, BENCHKEYS / threads };
+			pthread_t tids[8];
+			char variant[24];
+			double start = now();
+
+			for (unsigned i = 0; i < threads; i++)
+				pthread_create(&tids[i], NULL, benchCountThread, &w);
+			for (unsigned i = 0; i < threads; i++)
+				pthread_join(tids[i], NULL);
+			snprintf(variant, sizeof variant, "%s %ut", v ? "combine" : "mutex", threads);
+			report("hot key counters", variant, start, w.ulOps * threads);
+			if (comb) {
+				printf ("(%lu operations in %lu passes, %lu lookups)\n", pxHtCombinerStats(comb)->ulOps,
+						pxHtCombinerStats(comb)->ulPasses, pxHtCombinerStats(comb)->ulProbes);
+				vHtFreeCombiner(comb);
+			}
+			vHtFreeHashTable(t);
+		}
+	}
+}
+
+// dense integer ids, 0 to 1M-1, looked up in random order: hashed chains
+// versus a direct-address table
+static void benchDirect (unsigned *keys)
+{
+	hashtab_t *tabs[2];
+	const char *variant[2] = { "chained", "direct" };
+	long sum = 0;
+
+	tabs[0] = pxHtNewHashTable ("bench-ids", BENCHKEYS, 0, 1024, BENCHBUCKETS);
+	tabs[1] = pxHtNewHashTableEx ("bench-direct", 0, 0, 1024, 0,
+								  &(htConfig_t){ .ulDirectKeys = BENCHKEYS });
+	for (int t = 0; t < 2; t++) {
+		double start = now();
+
+		for (int i = 0; i < BENCHKEYS; i++)
+			iHtIAddVal(tabs[t], i, (void *)(long)i);
+		report("insert dense ids", variant[t], start, BENCHKEYS);
+		start = now();
+		for (int i = 0; i < BENCHKEYS; i++)
+			sum += (long)pvHtIGetVal(tabs[t], keys[i] % BENCHKEYS);
+		report("lookup dense ids", variant[t], start, BENCHKEYS);
+	}
+	printf ("(%u of %lu entries held directly)\n", tabs[1]->pxExt->ulDirectUsed, (unsigned long)tabs[1]->ulCurEntries);
+	vHtFreeHashTable(tabs[0]);
+	vHtFreeHashTable(tabs[1]);
+}
+
+// many tables of 16 keys each, like per-connection state: the usual table
+// with a bucket per key versus a small table, counting the memory each takes
+#define BENCHTABLES	10000
+#define BENCHTINY	16
+
+typedef struct {
+	size_t ulBytes;				// held now
+	unsigned long ulAllocs;		// calls, ever
+} benchMem_t;
+
+static void *benchCountAlloc (size_t size, void *ctx)
+{
+	((benchMem_t *)ctx)->ulBytes += size;
+	((benchMem_t *)ctx)->ulAllocs++;
+	return (malloc(size));
+}
+static void benchCountFree (void *ptr, size_t size, void *ctx)
+{
+	((benchMem_t *)ctx)->ulBytes -= size;
+	free(ptr);
+}
+
+static void benchSmall (unsigned *keys)
+{
+	const char *variant[2] = { "chained", "small" };
+	hashtab_t **tabs = malloc(sizeof (hashtab_t *) * BENCHTABLES);
+	long sum = 0;
+
+	for (int v = 0; v < 2; v++) {
+		benchMem_t mem = { 0, 0 };
+		htConfig_t cfg = { .pxAlloc = benchCountAlloc, .pxFree = benchCountFree, .pvAllocCtx = &mem,
+						   .ulSmallKeys = v ? 2 * BENCHTINY : 0 };
+		double start = now();
+
+		for (int t = 0; t < BENCHTABLES; t++) {
+			tabs[t] = pxHtNewHashTableEx ("bench-tiny", BENCHTINY, 0, BENCHTINY, BENCHTINY + 1, &cfg);
+			for (int i = 0; i < BENCHTINY; i++)
+				iHtIAddVal(tabs[t], keys[t * BENCHTINY + i], (void *)(long)i);
+		}
+		report("build 10K tables of 16", variant[v], start, BENCHTABLES * BENCHTINY);
+		start = now();
+		for (int r = 0; r < 100; r++) {
+			for (int t = 0; t < BENCHTABLES; t++)
+				sum += (long)pvHtIGetVal(tabs[t], keys[t * BENCHTINY + (r * 7 + t) % BENCHTINY]);
+		}
+		report("lookup in tiny tables", variant[v], start, 100 * BENCHTABLES);
+		start = now();
+		for (int r = 0; r < 100; r++) {
+			for (int t = 0; t < BENCHTABLES; t++)
+				sum += (long)pvHtIGetVal(tabs[t], keys[t * BENCHTINY + r] + 1);
+		}
+		report("missing from tiny tables", variant[v], start, 100 * BENCHTABLES);
+		printf ("(%lu bytes per table, with its %lu byte hashtab_t)\n",
+				(unsigned long)(mem.ulBytes / BENCHTABLES + sizeof (hashtab_t)), (unsigned long)sizeof (hashtab_t));
+		for (int t = 0; t < BENCHTABLES; t++)
+			vHtFreeHashTable(tabs[t]);
+	}
+	free(tabs);
+}
+
+// building one very large table, with blocks of entries all the same size
+// versus doubling.  Run with --huge on a machine with 64GB or more for a
+// billion entries; the regular run builds a table of 8M.
+static void benchBuild (size_t entries)
+{
+	const char *variant[2] = { "fixed", "doubling" };
+	char what[40];
+
+	snprintf(what, sizeof what, "build %lu entries", (unsigned long)entries);
+	for (int v = 0; v < 2; v++) {
+		benchMem_t mem = { 0, 0 };
+		htConfig_t cfg = { .pxAlloc = benchCountAlloc, .pxFree = benchCountFree, .pvAllocCtx = &mem,
+						   .ulAllocMax = v ? 1 << 24 : 0 };
+		hashtab_t *t = pxHtNewHashTableEx ("bench-build", 0, 0, 1024, entries / 2 + 1, &cfg);
+		double start = now();
+
+		for (size_t i = 0; t && i < entries; i++) {
+			if (!iHtIAddVal(t, (unsigned)i * 2654435761u, (void *)i))	// distinct below 2^32
+				break;
+		}
+		if (!t || t->ulCurEntries != entries) {
+			printf ("(out of memory building %lu entries)\n", (unsigned long)entries);
+		} else {
+			report(what, variant[v], start, entries);
+			printf ("(%lu allocations, %lu MB)\n", mem.ulAllocs, (unsigned long)(mem.ulBytes >> 20));
+		}
+		if (t)
+			vHtFreeHashTable(t);
+	}
+}
+
+// a table every process would otherwise build for itself: lookups in an
+// ordinary table versus one in shared memory, which is built once and costs
+// a copy of the value and a check of the sequence count per lookup
+static void benchShm (unsigned *keys)
+{
+	hashtab_t *t = pxHtNewHashTable ("bench-private", BENCHKEYS, 0, 1024, BENCHBUCKETS);
+	htShm_t *shm;
+	htShmStats_t stats;
+	long sum = 0, v;
+	double start;
+
+	iHtShmUnlink("/htshm-bench");
+	if (!(shm = pxHtShmCreate ("/htshm-bench", BENCHKEYS, BENCHBUCKETS, 0, sizeof (long)))) {
+		vHtFreeHashTable(t);
+		return;
+	}
+	for (int i = 0; i < BENCHKEYS; i++) {
+		iHtISetVal(t, keys[i], (void *)(long)i);
+		iHtShmISetVal(shm, keys[i], &(long){ i });
+	}
+	start = now();
+	for (int i = 0; i < BENCHKEYS; i++)
+		sum += (long)pvHtIGetVal(t, keys[(i * 7) % BENCHKEYS]);
+	report("lookup", "private", start, BENCHKEYS);
+	start = now();
+	for (int i = 0; i < BENCHKEYS; i++) {
+		if (iHtShmIGetVal(shm, keys[(i * 7) % BENCHKEYS], &v))
+			sum += v;
+	}
+	report("lookup", "shared", start, BENCHKEYS);
+	vHtShmStats(shm, &stats);
+	printf ("(shared segment %lu KB for %lu entries, %lu retries)\n", (unsigned long)(stats.ulBytes >> 10),
+			(unsigned long)stats.ulEntries, stats.ulRetries);
+	vHtShmDetach(shm);
+	iHtShmUnlink("/htshm-bench");
+	vHtFreeHashTable(t);
+}
+
+// adds to a table that takes blocks of entries from the heap as it grows,
+// versus one with its buckets and entries handed to it up front: the
+// average, and how many adds took over 10us, which is what a deadline cares
+// about.  The static memory is touched first, as it would be on a device.
+static void benchStatic (unsigned *keys)
+{
+	const char *variant[2] = { "heap", "static" };
+	hashtab_t st;
+	Link_t *buckets = malloc(sizeof (Link_t) * BENCHBUCKETS);
+	size_t bytes = htSTATIC_ENTRYBYTES(BENCHKEYS, 0);
+	char *entries = malloc(bytes);
+
+	memset(buckets, 0, sizeof (Link_t) * BENCHBUCKETS);
+	memset(entries, 0, bytes);
+	for (int v = 0; v < 2; v++) {
+		hashtab_t *t = v ? pxHtNewStaticTable (&st, "bench-static", buckets, BENCHBUCKETS, entries, bytes, NULL)
+						 : pxHtNewHashTable ("bench-heap", 0, 0, 1024, BENCHBUCKETS);
+		double start = now(), worst = 0;
+		unsigned slow = 0;
+
+		for (int i = 0; t && i < BENCHKEYS; i++) {
+			double before = now(), took;
+
+			iHtIAddVal(t, keys[i], NULL);
+			if ((took = now() - before) > worst)
+				worst = took;
+			slow += took > 10000;
+		}
+		report("add, timed one by one", variant[v], start, BENCHKEYS);
+		printf ("(%u adds over 10us, slowest %.0f us)\n", slow, worst / 1000);
+		if (t)
+			vHtFreeHashTable(t);
+	}
+	free(entries);
+	free(buckets);
+}
+
+// lookups in a table after heavy churn, which leaves its entries scattered
+// over its blocks in freelist order, then after compacting it
+static void benchCompact (unsigned *keys)
+{
+	hashtab_t *t = pxHtNewHashTable ("bench-churn", 0, 0, 1024, BENCHBUCKETS);
+	const char *variant[2] = { "churned", "compacted" };
+	long sum = 0;
+	double start;
+	size_t before = 0;
+
+	for (int i = 0; i < BENCHKEYS; i++)
+		iHtIAddVal(t, keys[i], (void *)(long)i);
+	for (int round = 0; round < 4; round++) {	// replace a random half, four times
+		for (int i = 0; i < BENCHKEYS; i++) {
+			if (keys[i] % 8 / 2 == round % 4 || keys[i] % 8 / 2 == (round + 1) % 4)
+				iHtIDelete(t, keys[i]);
+		}
+		for (int i = 0; i < BENCHKEYS; i++)
+			iHtIAddVal(t, keys[i], (void *)(long)i);
+	}
+	for (int i = 0; i < BENCHKEYS; i++) {		// and leave a quarter gone
+		if (keys[i] % 4 == 0)
+			iHtIDelete(t, keys[i]);
+	}
+	for (int v = 0; v < 2; v++) {
+		if (v) {
+			before = t->ulSlabBytes;
+			start = now();
+			while (iHtCompact(t, 10000, NULL, NULL))
+				;
+			report("compact, per entry", "", start, t->ulCurEntries);
+		}
+		start = now();
+		for (int i = 0; i < BENCHKEYS; i++)
+			sum += (long)pvHtIGetVal(t, keys[(i * 7) % BENCHKEYS]);
+		report("lookup", variant[v], start, BENCHKEYS);
+	}
+	printf ("(entry blocks %lu KB before, %lu KB after)\n", (unsigned long)(before >> 10),
+			(unsigned long)(t->ulSlabBytes >> 10));
+	vHtFreeHashTable(t);
+}
+
+// the cost of keyed hashing when nobody is attacking: the same keys in an
+// ordinary table and a keyed one.  Then keys chosen to collide in the
+// ordinary hash (a multiple of the bucket count apart), which a keyed
+// table spreads out.
+#define BENCHFLOOD	20000
+
+static void benchKeyed (unsigned *keys)
+{
+	const char *variant[2] = { "ordinary", "keyed" };
+	char (*names)[16] = malloc(16 * BENCHKEYS);
+	long sum = 0;
+
+	for (int i = 0; i < BENCHKEYS; i++)
+		snprintf(names[i], 16, "k%x", keys[i]);
+	for (int v = 0; v < 2; v++) {
+		htConfig_t cfg = { .xKeyedHash = v };
+		hashtab_t *ti = pxHtNewHashTableEx ("bench-ints", BENCHKEYS, 0, 1024, BENCHBUCKETS, &cfg);
+		hashtab_t *ts = pxHtNewHashTableEx ("bench-names", BENCHKEYS, 0, 1024, BENCHBUCKETS, &cfg);
+		hashtab_t *tf = pxHtNewHashTableEx ("bench-flood", BENCHFLOOD, 0, 1024, 1001, &cfg);
+		double start;
+
+		for (int i = 0; i < BENCHKEYS; i++) {
+			iHtIAddVal(ti, keys[i], (void *)(long)i);
+			iHtSAddVal(ts, names[i], (void *)(long)i);
+		}
+		start = now();
+		for (int i = 0; i < BENCHKEYS; i++)
+			sum += (long)pvHtIGetVal(ti, keys[(i * 7) % BENCHKEYS]);
+		report("lookup integer keys", variant[v], start, BENCHKEYS);
+		start = now();
+		for (int i = 0; i < BENCHKEYS; i++)
+			sum += (long)pvHtSGetVal(ts, names[(i * 7) % BENCHKEYS]);
+		report("lookup string keys", variant[v], start, BENCHKEYS);
+		start = now();
+		for (int i = 0; i < BENCHFLOOD; i++)
+			iHtIAddVal(tf, i * 1001, NULL);
+		report("insert colliding keys", variant[v], start, BENCHFLOOD);
+		vHtFreeHashTable(ti);
+		vHtFreeHashTable(ts);
+		vHtFreeHashTable(tf);
+	}
+	free(names);
+}
+
+// a few hundred hot keys getting nine lookups in ten, the rest spread
+// over all the keys, with and without a hot key cache; then lookups spread
+// evenly, where the cache only costs
+#define BENCHHOT	300
+
+static void benchHot (unsigned *keys)
+{
+	const char *variant[2] = { "plain", "hot key cache" };
+	unsigned *order = malloc(sizeof (unsigned) * BENCHKEYS);
+	long sum = 0;
+
+	for (int i = 0; i < BENCHKEYS; i++)
+		order[i] = i % 10 ? keys[(i * 7919u) % BENCHHOT] : keys[(i * 7u) % BENCHKEYS];
+	for (int v = 0; v < 2; v++) {
+		htConfig_t cfg = { .ulHotKeys = v ? 1024 : 0 };
+		hashtab_t *t = pxHtNewHashTableEx ("bench-hot", BENCHKEYS, 0, 1024, BENCHBUCKETS, &cfg);
+		unsigned long lookups, hits;
+		double start;
+
+		for (int i = 0; i < BENCHKEYS; i++)
+			iHtIAddVal(t, keys[i], (void *)(long)i);
+		lookups = t->pxExt->xStats.ulHotLookups;
+		hits = t->pxExt->xStats.ulHotHits;
+		start = now();
+		for (int i = 0; i < BENCHKEYS; i++)
+			sum += (long)pvHtIGetVal(t, order[i]);
+		report("lookup, 90% to hot keys", variant[v], start, BENCHKEYS);
+		if (v)
+			printf ("(hit ratio %.1f%%)\n", 100.0 * (t->pxExt->xStats.ulHotHits - hits) / (t->pxExt->xStats.ulHotLookups - lookups));
+		start = now();
+		for (int i = 0; i < BENCHKEYS; i++)
+			sum += (long)pvHtIGetVal(t, keys[(i * 7) % BENCHKEYS]);
+		report("lookup, spread evenly", variant[v], start, BENCHKEYS);
+		vHtFreeHashTable(t);
+	}
+	free(order);
+}
+
+// removing a quarter of the entries: the old way, finding each victim with
+// the iterator and deleting it by key, against one remove-if pass, on one
+// thread and on four
+static int benchVictim (hashtab_t *table, hashent_t *entry, void *ctx)
+{
+	return (entry->ulKey % 4 == 0);
+}
+
+static void benchRemoveIf (unsigned *keys)
+{
+	const char *variant[3] = { "foreach+delete", "remove-if", "remove-if 4t" };
+
+	for (int v = 0; v < 3; v++) {
+		hashtab_t *t = pxHtNewHashTable ("bench-remove", BENCHKEYS, 0, 1024, BENCHBUCKETS);
+		size_t before;
+		double start;
+
+		for (int i = 0; i < BENCHKEYS; i++)
+			iHtIAddVal(t, keys[i], (void *)(long)i);
+		before = t->ulCurEntries;
+		start = now();
+		if (v == 0) {
+			htFOREACH(it, e, t) {
+				if (benchVictim(t, e, NULL))
+					iHtIDelete(t, e->ulKey);
+			}
+		} else {
+			ulHtRemoveIf(t, benchVictim, NULL, v == 2 ? 4 : 0);
+		}
+		report("remove a quarter, per entry", variant[v], start, before);
+		vHtFreeHashTable(t);
+	}
+}
+
+// what keeping an ordered index costs adds and deletes, and what it saves
+// when asking for a range of keys: 1000 ranges of about 100 keys each, by
+// the index or by walking the whole table and picking them out
+#define BENCHRANGES	1000
+
+static void benchOrdered (unsigned *keys)
+{
+	const char *variant[2] = { "plain", "ordered" };
+	long sum = 0;
+
+	for (int v = 0; v < 2; v++) {
+		htConfig_t cfg = { .xOrdered = v };
+		hashtab_t *t = pxHtNewHashTableEx ("bench-ordered", BENCHKEYS, 0, 1024, BENCHBUCKETS, &cfg);
+		unsigned span = ~0u / BENCHKEYS * 100;
+		double start = now();
+
+		for (int i = 0; i < BENCHKEYS; i++)
+			iHtIAddVal(t, keys[i], (void *)(long)i);
+		report("add", variant[v], start, BENCHKEYS);
+		start = now();
+		if (v) {
+			for (int r = 0; r < BENCHRANGES; r++) {
+				htRangeIterator_t it;
+				unsigned lo = keys[r];
+
+				for (hashent_t *e = pxHtIRangeFirst(&it, t, lo, lo + span); e; e = pxHtRangeNext(&it))
+					sum += e->lValue;
+			}
+			report("range of ~100 keys", variant[v], start, BENCHRANGES);
+		} else {
+			for (int r = 0; r < BENCHRANGES / 100; r++) {	// far too slow for all of them
+				unsigned lo = keys[r];
+
+				htFOREACH(it, e, t) {
+					if (e->ulKey - lo <= span)
+						sum += e->lValue;
+				}
+			}
+			report("range of ~100 keys", variant[v], start, BENCHRANGES / 100);
+		}
+		start = now();
+		for (int i = 0; i < BENCHKEYS; i += 2)
+			iHtIDelete(t, keys[i]);
+		report("delete", variant[v], start, BENCHKEYS / 2);
+		vHtFreeHashTable(t);
+	}
+}
+
+int main(int argc, const char * argv[])
+{
+	unsigned *keys = malloc(sizeof (unsigned) * BENCHKEYS);
+
+	if (argc > 1 && strcmp(argv[1], "--huge") == 0) {
+		benchBuild(1000000000);
+		return 0;
+	}
+	srand (1);
+	for (int i = 0; i < BENCHKEYS; i++)
+		keys[i] = ((unsigned)rand() << 16) ^ rand() ^ i;	// unique enough
+	benchTyped(keys);
+	benchGetOrAdd(keys);
+	benchHugePages(keys);
+	benchCuckoo(keys);
+	benchBloom(keys);
+	benchInlineKeys(keys);
+	benchSetOps(keys);
+	benchLog(keys);
+	benchClone(keys);
+	benchCombine(keys);
+	benchDirect(keys);
+	benchSmall(keys);
+	benchShm(keys);
+	benchStatic(keys);
+	benchCompact(keys);
+	benchKeyed(keys);
+	benchHot(keys);
+	benchRemoveIf(keys);
+	benchOrdered(keys);
+	benchBuild(8 * BENCHKEYS);
+	return 0;
+}
@@ -8,18 +8,119 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <string.h>
+#include <pthread.h>
 #include "hashtab.h"
+#include "hashtab_typed.h"
+#include "htlog.h"
+#include "htcombine.h"
+#include "htshm.h"
 #include "rsrc.h"
 
 #define NUMINTKEYS_H1  200
 
+htDEFINE(Int, unsigned, long, ulHtHashUnsigned, xHtEqUnsigned)
+htDEFINE(Str, const char *, int, ulHtHashString, xHtEqString)
+
 int fillsamples(FILE *in, unsigned int numsamp, char *samples[], size_t buflen, char *buffer);
 
+static int evictions;
+static void countevict (hashtab_t *table, hashent_t *entry, void *ctx)
+{
+	evictions += (entry->ulValue == entry->ulKey);
+}
+
 void printresult (int errors, const char *message)
 {
 	printf ("Test '%s': %s\n", message, (errors ? "FAIL" : "PASS"));
 }
 
+// combiner test threads: count 16 keys, and set one key of their own
+#define COMBTHREADS	4
+#define COMBOPS		20000
+htCombiner_t *comb;
+int comberrors;
+
+void *combthread (void *arg)
+{
+	htCSlot_t *slot = pxHtCombinerSlot(comb);
+	unsigned mykey = 100 + (unsigned)(long)arg;
+
+	if (!slot) {
+		comberrors++;
+		return (NULL);
+	}
+	for (unsigned i = 0; i < COMBOPS; i++) {
+		lHtCAddToVal(slot, i % 16, 1);
+		if (iHtCSetVal(slot, mykey, (void *)(long)i) != 1)	// added once, then replaced
+			comberrors++;
+		if (pvHtCGetVal(slot, mykey) != (void *)(long)i)
+			comberrors++;
+	}
+	vHtCombinerLeave(slot);
+	return (NULL);
+}
+
+int fileexists (const char *name)
+{
+	FILE *f = fopen(name, "r");
+
+	if (f)
+		fclose(f);
+	return (f != NULL);
+}
+
+// shared-memory test: one thread reads pairs through its own mapping while
+// another changes them, and neither half may be seen without the other
+#define SHMKEYS		64
+#define SHMROUNDS	20000
+htShm_t *shmreader;
+volatile int shmdone;
+int shmerrors;
+
+void *shmthread (void *arg)
+{
+	unsigned long pair[2];
+
+	while (!shmdone) {
+		for (unsigned k = 0; k < SHMKEYS; k++) {
+			if (!iHtShmIGetVal(shmreader, k, pair) || pair[0] != pair[1])
+				shmerrors++;
+		}
+	}
+	return (NULL);
+}
+
+// compaction test: where the caller thinks each entry is, kept up to date
+// by the move callback
+#define COMPACTKEYS	20000
+hashent_t *compactwhere[COMPACTKEYS];
+
+static void compactmoved (hashtab_t *table, hashent_t *from, hashent_t *to, void *ctx)
+{
+	if (compactwhere[to->ulKey] == from)
+		compactwhere[to->ulKey] = to;
+	else
+		(*(int *)ctx)++;
+}
+
+static unsigned long allocations;
+static void *countalloc (size_t size, void *ctx)
+{
+	allocations++;
+	return (malloc(size));
+}
+static void countfree (void *ptr, size_t size, void *ctx)
+{
+	free(ptr);
+}
+
+// remove-if predicate: keys that are a multiple of *ctx
+static int keymultiple (hashtab_t *table, hashent_t *entry, void *ctx)
+{
+	return (entry->ulKey % *(unsigned *)ctx == 0);
+}
+
 int main(int argc, const char * argv[]) {
 	int somevalue = -1; // any of the values we put into h1
 	int errors;	// used inside loops to accumulate error count, if any
@@ -145,6 +246,1325 @@ int main(int argc, const char * argv[]) {
 	}
 	printf ("Of %d samples, %d of them were unique\n", count, inserts);
 	vHtPrintStats(h2);
+
+// -----------------------------------------------------------------------
+	printf ("\nType-specialized Table Tests\n");
+// -----------------------------------------------------------------------
+
+	htInt_t *t1 = pxHtIntNew (49, 0, 25);
+	srand (1);
+	for (int i = 0; i < NUMINTKEYS_H1; i++) {
+		int n = rand();
+
+		iHtIntAdd(t1, n, n);
+	}
+	srand (1);
+	errors = 0;
+	for (int i = 0; i < NUMINTKEYS_H1; i++) {
+		int n = rand();
+		long *v = pxHtIntGet(t1, n);
+
+		if (!v || *v != n)
+			errors++;
+	}
+	printresult(errors || t1->ulCurEntries != h1->ulCurEntries - 1,
+				"Filling then checking typed integer table");
+
+	total = 0;
+	htTFOREACH(Int, t1it, w3, t1) {
+		total += (w3->xKey == w3->xValue);
+	}
+	printresult(total != t1->ulCurEntries, "Iterating typed integer table");
+	printresult(iHtIntAdd(t1, somevalue, 0) != 1 || iHtIntAdd(t1, somevalue, 0) != 0
+				|| iHtIntSet(t1, somevalue, 1) != 1 || *pxHtIntGet(t1, somevalue) != 1,
+				"Typed AddVal/SetVal of present and non-present values");
+	entries = t1->ulCurEntries;
+	printresult(iHtIntDelete(t1, somevalue) != 1 || iHtIntDelete(t1, somevalue) != 0
+				|| t1->ulCurEntries != entries - 1, "Deletion from typed table");
+	vHtIntFree(t1);
+
+	htStr_t *t2 = pxHtStrNew (47, 0, 25);
+	inserts = 0;
+	for (int i = 0; i < count; i++) {
+		inserts -= iHtStrAdd(t2, samples[i], i);
+	}
+	for (int i = 0; i < count; i++) {
+		int *v = pxHtStrGet(t2, samples[i]);
+
+		inserts += (v && strcmp(samples[*v], samples[i]) == 0);
+	}
+	printresult(inserts != count - t2->ulCurEntries || t2->ulCurEntries != h2->ulCurEntries,
+				"Filling then checking typed string table");
+	vHtStrFree(t2);
+
+// -----------------------------------------------------------------------
+	printf ("\nInline Value Tests\n");
+// -----------------------------------------------------------------------
+
+	struct session { long long llBytes; int lPackets; char cState[20]; } sess;
+	htConfig_t cfg = { .ulValSize = sizeof (struct session), .ulValAlign = 16 };
+	hashtab_t *h3 = pxHtNewHashTableEx ("inlineval", 10, 0, 10, 49, &cfg);
+
+	errors = 0;
+	for (int i = 0; i < NUMINTKEYS_H1; i++) {
+		struct session *s = pvHtIAddValPtr(h3, i);
+
+		if (!s || s->llBytes || ((long)s & 15))
+			errors++;
+		else
+			s->llBytes = s->lPackets = i;
+	}
+	for (int i = 0; i < NUMINTKEYS_H1; i++) {
+		struct session *s = pvHtIGetVal(h3, i);
+
+		if (!s || s->llBytes != i || s->lPackets != i || s != pvHtIFindValPtr(h3, i))
+			errors++;
+	}
+	printresult(errors, "Filling then checking aligned inline values in place");
+	sess.llBytes = 1234;
+	printresult(iHtISetVal(h3, 5, &sess) != 1 || ((struct session *)pvHtIGetVal(h3, 5))->llBytes != 1234
+				|| pvHtIAddValPtr(h3, 5) != NULL, "SetVal copies value into table");
+
+// -----------------------------------------------------------------------
+	printf ("\nMultimap Tests\n");
+// -----------------------------------------------------------------------
+
+	htConfig_t mcfg = { .xMultimap = 1 };
+	hashtab_t *h4 = pxHtNewHashTableEx ("multimap", 10, 0, 10, 7, &mcfg);
+
+	for (long i = 0; i < 100; i++) {
+		iHtIAddVal(h4, i % 10, (void *)i);	// ten values for each of ten keys
+	}
+	errors = 0;
+	for (unsigned k = 0; k < 10; k++) {
+		htDupIterator_t dit;
+		long expect = k;
+
+		for (hashent_t *e = pxHtIFindFirst(&dit, h4, k); e; e = pxHtFindNext(&dit)) {
+			if (e->ulKey != k || (long)e->pxValue != expect)
+				errors++;
+			expect += 10;	// values come back in insertion order
+		}
+		if (expect != k + 100 || ulHtICount(h4, k) != 10)
+			errors++;
+	}
+	printresult(errors || h4->ulCurEntries != 100, "Iterating over the values of each key");
+	printresult(iHtIDeleteVal(h4, 3, (void *)53) != 1 || iHtIDeleteVal(h4, 3, (void *)53) != 0
+				|| ulHtICount(h4, 3) != 9, "Deleting one value of a key");
+	printresult(iHtIDeleteAll(h4, 4) != 10 || ulHtICount(h4, 4) != 0 || ulHtICount(h4, 5) != 10
+				|| h4->ulCurEntries != 89, "Deleting all values of a key");
+
+// -----------------------------------------------------------------------
+	printf ("\nCache Tests\n");
+// -----------------------------------------------------------------------
+
+	htConfig_t ccfg = { .xCache = 1, .pxEvictCallback = countevict };
+	hashtab_t *h5 = pxHtNewHashTableEx ("cache", 4, 10, 4, 7, &ccfg);
+
+	errors = 0;
+	for (unsigned i = 0; i < 30; i++) {
+		errors += iHtIAddVal(h5, i, (void *)(long)i) != 1;
+		errors += pxHtIFindEntry(h5, 0) == NULL;	// keep key 0 hot
+	}
+	printresult(errors || h5->ulCurEntries != 10 || evictions != 20, "Adding past maxentries evicts");
+	printresult(pxHtIFindEntry(h5, 0) == NULL || pxHtIFindEntry(h5, 29) == NULL
+				|| pxHtIFindEntry(h5, 1) != NULL, "Recently used entries are kept");
+	vHtPrintStats(h5);
+
+// -----------------------------------------------------------------------
+	printf ("\nSingle-probe Update Tests\n");
+// -----------------------------------------------------------------------
+
+	hashtab_t *h6 = pxHtNewHashTableEx ("counters", 10, 0, 10, 47, NULL);
+	int inserted;
+
+	errors = 0;
+	for (int i = 0; i < count; i++) {
+		hashent_t *e = pxHtSGetOrAdd(h6, samples[i], &inserted);
+
+		errors += (inserted != (e->lValue == 0));
+		e->lValue++;
+	}
+	for (int i = 0; i < count; i++) {
+		lHtSAddToVal(h6, samples[i], -1);
+	}
+	htFOREACH(h6it, w6, h6) {
+		errors += w6->lValue != 0;
+	}
+	printresult(errors || h6->ulCurEntries != h2->ulCurEntries, "Counting with GetOrAdd and AddToVal");
+	printresult(pvHtIExchangeVal(h1, somevalue, (void *)7) != NULL || pvHtIExchangeVal(h1, somevalue, (void *)8) != (void *)7
+				|| pvHtIGetVal(h1, somevalue) != (void *)8, "Exchanging values");
+
+// -----------------------------------------------------------------------
+	printf ("\nAllocator Tests\n");
+// -----------------------------------------------------------------------
+
+	htArena_t *arena = pxHtNewArena (4096);
+	htConfig_t acfg = { .pxAlloc = pvHtArenaAlloc, .pxFree = vHtArenaFree,
+						.pvAllocCtx = arena, .xCopyKeys = 1 };
+	hashtab_t *h7 = pxHtNewHashTableEx ("arena", 10, 0, 10, 47, &acfg);
+	char keybuf[STRINGLEN + 1];
+
+	errors = 0;
+	for (int i = 0; i < count; i++) {
+		strcpy(keybuf, samples[i]);		// table must not keep our pointer
+		iHtSAddVal(h7, keybuf, samples[i]);
+	}
+	memset(keybuf, 0, sizeof keybuf);
+	for (int i = 0; i < count; i++) {
+		errors += strcmp(pvHtSGetVal(h7, samples[i]), samples[i]) != 0;
+	}
+	printresult(errors || h7->ulCurEntries != h2->ulCurEntries || h7->pxExt->ulKeyBytes == 0
+				|| ulHtArenaBytes(arena) < h7->ulSlabBytes + h7->ulBucketBytes + h7->pxExt->ulKeyBytes,
+				"Copied keys and entries in an arena");
+	vHtPrintStats(h7);
+	vHtFreeHashTable(h7);
+	vHtDeleteArena(arena);
+
+	// without reserved huge pages (or NUMA) the arena falls back to advice
+	// and ordinary pages, and the table must work just the same
+	arena = pxHtNewArenaEx (htHUGEPAGE, htARENA_HUGEPAGES | htARENA_NUMA_INTERLEAVE, 1);
+	acfg = (htConfig_t){ .pxAlloc = pvHtArenaAlloc, .pxFree = vHtArenaFree, .pvAllocCtx = arena };
+	hashtab_t *h7h = arena ? pxHtNewHashTableEx ("hugearena", 0, 0, 1024, 1021, &acfg) : NULL;
+
+	errors = !h7h;
+	for (unsigned i = 0; h7h && i < 20000; i++)
+		errors += iHtIAddVal(h7h, i * 7, (void *)(long)i) != 1;
+	for (unsigned i = 0; h7h && i < 20000; i++)
+		errors += pvHtIGetVal(h7h, i * 7) != (void *)(long)i || pvHtIGetVal(h7h, i * 7 + 1) != NULL;
+	printresult(errors || h7h->ulCurEntries != 20000 || ulHtArenaMappedBytes(arena) % htHUGEPAGE != 0,
+				"Table in a huge page, interleaved arena");
+	if (h7h)
+		vHtFreeHashTable(h7h);
+	if (arena)
+		vHtDeleteArena(arena);
+
+	hashtab_t *h8 = pxHtNewHashTableEx ("copykeys", 10, 0, 10, 47, &(htConfig_t){ .xCopyKeys = 1 });
+	for (int i = 0; i < count; i++) {
+		iHtSAddVal(h8, samples[i], NULL);
+	}
+	size_t keybytes = h8->pxExt->ulKeyBytes;
+	iHtSDelete(h8, samples[0]);
+	printresult(h8->pxExt->ulKeyBytes != keybytes - strlen(samples[0]) - 1, "Deleting frees copied key");
+	vHtFreeHashTable(h8);
+
+// -----------------------------------------------------------------------
+	printf ("\nCuckoo Table Tests\n");
+// -----------------------------------------------------------------------
+
+	hashtab_t *h9 = pxHtNewHashTableEx ("cuckoo", 0, 0, 0, 251, &(htConfig_t){ .xCuckoo = 1 });
+	unsigned slots = h9->ulBucketCount * 4;
+
+	srand (2);
+	for (unsigned i = 0; i < slots * 95 / 100; i++) {
+		int n = rand();
+
+		iHtIAddVal(h9, n, (void *)(long)n);
+	}
+	vHtPrintStats(h9);
+	printresult(h9->ulBucketCount * 4 != slots, "Filling cuckoo table to 95% without growing");
+	for (unsigned i = 0; i < 5000; i++) {
+		int n = rand();
+
+		iHtIAddVal(h9, n, (void *)(long)n);
+	}
+	srand (2);
+	errors = 0;
+	for (unsigned i = 0; i < slots * 95 / 100 + 5000; i++) {
+		int n = rand();
+
+		errors += pvHtIGetVal(h9, n) != (void *)(long)n;
+		if (i & 1)
+			errors += iHtIDelete(h9, n) != 1;
+	}
+	total = 0;
+	htFOREACH(h9it, w9, h9) {
+		total++;
+		errors += w9->ulKey != w9->ulValue;
+		errors += pxHtIFindEntry(h9, w9->ulKey) != w9;
+	}
+	vHtPrintStats(h9);
+	printresult(errors || total != h9->ulCurEntries || h9->ulBucketCount * 4 == slots,
+				"Growing, looking up, deleting from and iterating cuckoo table");
+	vHtFreeHashTable(h9);
+
+	// 27 keys with the same string hash: flipping the low bits of one
+	// character and the matching bits of the next, shifted 5 left, leaves
+	// the hash as it was
+	hashtab_t *h9c = pxHtNewHashTableEx ("cuckoo-colliding", 0, 0, 0, 3, &(htConfig_t){ .xCuckoo = 1 });
+	char ckkeys[27][5];
+
+	errors = 0;
+	for (unsigned i = 0; i < 27; i++) {
+		unsigned a1 = i / 9, a2 = i / 3 % 3, a3 = i % 3;
+
+		ckkeys[i][0] = 0x30 ^ a1;
+		ckkeys[i][1] = 0x60 ^ (a1 << 5) ^ a2;
+		ckkeys[i][2] = 0x60 ^ (a2 << 5) ^ a3;
+		ckkeys[i][3] = 0x60 ^ (a3 << 5);
+		ckkeys[i][4] = '\0';
+		errors += iHtSAddVal(h9c, ckkeys[i], (void *)(long)i) != 1;
+	}
+	for (unsigned i = 0; i < 27; i++)
+		errors += pvHtSGetVal(h9c, ckkeys[i]) != (void *)(long)i;
+	total = 0;
+	htFOREACH(h9cit, w9c, h9c) {
+		total++;
+	}
+	for (unsigned i = 0; i < 27; i += 2)
+		errors += iHtSDelete(h9c, ckkeys[i]) != 1;
+	for (unsigned i = 1; i < 27; i += 2)
+		errors += pvHtSGetVal(h9c, ckkeys[i]) != (void *)(long)i;
+	printresult(errors || total != 27 || h9c->ulCurEntries != 13,
+				"Cuckoo table of keys whose hashes all collide");
+	vHtFreeHashTable(h9c);
+
+// -----------------------------------------------------------------------
+	printf ("\nBloom Filter Tests\n");
+// -----------------------------------------------------------------------
+
+	hashtab_t *h10 = pxHtNewHashTableEx ("bloom", 0, 0, 64, 31, &(htConfig_t){ .xBloom = 1, .ulBloomKeys = 1000 });
+
+	errors = 0;
+	for (unsigned i = 0; i < 1000; i++)
+		iHtIAddVal(h10, 2 * i, (void *)(long)i);
+	for (unsigned i = 0; i < 1000; i++) {
+		errors += pvHtIGetVal(h10, 2 * i) != (void *)(long)i;
+		errors += pxHtIFindEntry(h10, 2 * i + 1) != NULL;
+	}
+	vHtPrintStats(h10);
+	printresult(errors || h10->pxExt->xStats.ulBloomSkips < 900,
+				"Bloom filter keeps all keys, skips most absent ones");
+	for (unsigned i = 0; i < 3000; i++)
+		iHtIAddVal(h10, 2 * i + 1, (void *)(long)i);	// odd keys, to three times the size
+	for (unsigned i = 0; i < 3000; i++)
+		errors += iHtIDelete(h10, 2 * i + 1) != 1;
+	for (unsigned i = 0; i < 1000; i++) {
+		errors += pvHtIGetVal(h10, 2 * i) != (void *)(long)i;
+		errors += pxHtIFindEntry(h10, 2 * i + 1) != NULL;
+	}
+	vHtPrintStats(h10);
+	printresult(errors || h10->pxExt->xStats.ulBloomRebuilds < 2 || h10->pxExt->ulBloomKeys < 3000,
+				"Bloom filter grows and is rebuilt after deletes");
+	vHtFreeHashTable(h10);
+
+// -----------------------------------------------------------------------
+	printf ("\nInline Key Tests\n");
+// -----------------------------------------------------------------------
+
+	hashtab_t *h11 = pxHtNewHashTableEx ("inlinekeys", 0, 0, 32, 31, &(htConfig_t){ .ulInlineKeys = 16 });
+	hashtab_t *h12 = pxHtNewHashTableEx ("inlinekeys24", 0, 0, 32, 31,
+										 &(htConfig_t){ .ulInlineKeys = 24, .ulValSize = sizeof (double) });
+	char longkey[64];
+
+	errors = 0;
+	for (unsigned i = 0; i < 200; i++) {
+		// lengths from 1 to 40, so some keys are inline and some aren't
+		snprintf(longkey, sizeof longkey, "%0*u", (int)(i % 40) + 1, i);
+		errors += iHtSAddVal(h11, longkey, (void *)(long)i) != 1;
+		*(double *)pvHtSAddValPtr(h12, longkey) = i;
+	}
+	memset(longkey, 0, sizeof longkey);	// the tables have their own copies
+	for (unsigned i = 0; i < 200; i++) {
+		hashent_t *e;
+
+		snprintf(longkey, sizeof longkey, "%0*u", (int)(i % 40) + 1, i);
+		e = pxHtSFindEntry(h11, longkey);
+		errors += !e || e->ulValue != i || strcmp(e->pcName, longkey) != 0;
+		errors += (e && strlen(longkey) < 16) != (e && e->pcName == (char *)(e + 1));
+		errors += *(double *)pvHtSFindValPtr(h12, longkey) != i;
+		longkey[strlen(longkey) - 1] ^= 0x40;	// same length, last char not a digit
+		errors += pxHtSFindEntry(h11, longkey) != NULL;
+	}
+	printresult(errors, "Finding short and long inline keys");
+	for (unsigned i = 0; i < 200; i += 2) {
+		snprintf(longkey, sizeof longkey, "%0*u", (int)(i % 40) + 1, i);
+		errors += iHtSDelete(h11, longkey) != 1;
+	}
+	total = 0;
+	htFOREACH(h11it, w11, h11) {
+		total++;
+		errors += (w11->ulValue & 1) == 0 || pxHtSFindEntry(h11, w11->pcName) != w11;
+	}
+	vHtPrintStats(h12);
+	printresult(errors || total != 100 || iHtIAddVal(h11, 5, NULL) != 0,
+				"Deleting and iterating inline keys, integer keys refused");
+	vHtFreeHashTable(h11);
+	vHtFreeHashTable(h12);
+
+	// an inline value after inline keys isn't where lValue is
+	hashtab_t *h13 = pxHtNewHashTableEx ("inlinecounts", 0, 0, 32, 31,
+										 &(htConfig_t){ .ulValSize = sizeof (int), .ulInlineKeys = 16 });
+	hashtab_t *h14 = pxHtNewHashTableEx ("shortcounts", 0, 0, 32, 31, &(htConfig_t){ .ulValSize = 2 });
+
+	errors = lHtSAddToVal(h13, "abc", 5) != 5 || lHtSAddToVal(h13, "abc", 5) != 10;
+	errors += lHtSAddToVal(h13, "a much longer key", -3) != -3;
+	errors += *(int *)pvHtSGetVal(h13, "abc") != 10 || *(int *)pvHtSGetVal(h13, "a much longer key") != -3;
+	errors += lHtIAddToVal(h14, 1, 1) != 0 || h14->ulCurEntries != 0;
+	printresult(errors, "Adding to inline values, values too small refused");
+	vHtFreeHashTable(h13);
+	vHtFreeHashTable(h14);
+
+// -----------------------------------------------------------------------
+	printf ("\nSet Operation Tests\n");
+// -----------------------------------------------------------------------
+
+	hashtab_t *sa = pxHtNewHashTable ("set-a", 0, 0, 256, 1001);	// multiples of 2 below 200000
+	hashtab_t *sb = pxHtNewHashTable ("set-b", 0, 0, 256, 1001);	// multiples of 3 below 30000
+	hashtab_t *ss = pxHtNewHashTable ("set-s", 0, 0, 16, 31);
+	hashtab_t *su, *si, *sd, *sd2;
+
+	for (unsigned i = 0; i < 200000; i += 2)
+		iHtIAddVal(sa, i, (void *)(long)1);
+	for (unsigned i = 0; i < 30000; i += 3)
+		iHtIAddVal(sb, i, (void *)(long)2);
+	iHtSAddVal(ss, "string", NULL);
+	errors = 0;
+	su = pxHtUnion ("union", sa, sb, 0);
+	si = pxHtIntersection ("intersection", sa, sb, 0);
+	sd = pxHtDifference ("a-b", sa, sb, 0);
+	sd2 = pxHtDifference ("b-a", sb, sa, 0);
+	errors += !su || su->ulCurEntries != 100000 + 10000 - 5000;
+	errors += !si || si->ulCurEntries != 5000;
+	errors += !sd || sd->ulCurEntries != 100000 - 5000;
+	errors += !sd2 || sd2->ulCurEntries != 10000 - 5000;
+	for (unsigned i = 0; !errors && i < 200000; i++) {
+		int ina = i % 2 == 0, inb = i < 30000 && i % 3 == 0;
+
+		errors += pvHtIGetVal(su, i) != (ina ? (void *)1 : inb ? (void *)2 : NULL);
+		errors += pvHtIGetVal(si, i) != (ina && inb ? (void *)1 : NULL);
+		errors += (pxHtIFindEntry(sd, i) != NULL) != (ina && !inb);
+		errors += (pxHtIFindEntry(sd2, i) != NULL) != (inb && !ina);
+	}
+	printresult(errors || pxHtUnion("bad", sa, ss, 0) != NULL,
+				"Union, intersection and difference, mismatched keys refused");
+	vHtFreeHashTable(si);
+	vHtFreeHashTable(sd);
+	si = pxHtIntersection ("intersection-mt", su, sa, 4);	// big enough to share out
+	sd = pxHtDifference ("union-a-mt", su, sa, 4);
+	errors += !si || si->ulCurEntries != 100000 || pvHtIGetVal(si, 6) != (void *)1;
+	errors += !sd || sd->ulCurEntries != 5000 || pvHtIGetVal(sd, 3) != (void *)2 || pxHtIFindEntry(sd, 6) != NULL;
+	printresult(errors, "Set operations with threads");
+	vHtFreeHashTable(sa);
+	vHtFreeHashTable(sb);
+	vHtFreeHashTable(ss);
+	vHtFreeHashTable(su);
+	vHtFreeHashTable(si);
+	vHtFreeHashTable(sd);
+	vHtFreeHashTable(sd2);
+
+// -----------------------------------------------------------------------
+	printf ("\nChange Log Tests\n");
+// -----------------------------------------------------------------------
+
+	htConfig_t logcfg = { .xCopyKeys = 1 };
+	hashtab_t *l1 = pxHtNewHashTableEx ("logged", 0, 0, 64, 101, &logcfg);
+	hashtab_t *l2 = pxHtNewHashTableEx ("recovered", 0, 0, 64, 101, &logcfg);
+	hashtab_t *l3 = pxHtNewHashTableEx ("recovered-again", 0, 0, 64, 101, &logcfg);
+	htLog_t *log1, *log2;
+	char logkey[16];
+	FILE *torn;
+
+	remove("htlogtest.log");
+	remove("htlogtest.old");
+	remove("htlogtest.snap");
+	errors = 0;
+	log1 = pxHtLogOpen (l1, "htlogtest", NULL);
+	for (unsigned i = 0; log1 && i < 1000; i++) {
+		snprintf(logkey, sizeof logkey, "k%u", i);
+		iHtSSetVal(l1, logkey, (void *)(long)i);
+		if (i % 4 == 0)
+			iHtSDelete(l1, logkey);
+	}
+	lHtSAddToVal(l1, "k999", 1);
+	if (log1)
+		vHtLogClose(log1);
+	log2 = pxHtLogOpen (l2, "htlogtest", NULL);
+	errors += !log1 || !log2 || l2->ulCurEntries != 750 || pvHtSGetVal(l2, "k999") != (void *)1000;
+	htFOREACH(l1it, w1, l1) {
+		errors += pvHtSGetVal(l2, w1->pcName) != w1->pxValue;
+	}
+	printresult(errors, "Recovering a table from its change log");
+	if (log2) {
+		errors += iHtLogCompact(log2) != 0;
+		iHtSSetVal(l2, "k1", (void *)77);		// after the snapshot was taken
+		iHtSDelete(l2, "k2");
+		vHtLogClose(log2);
+	}
+	if ((torn = fopen("htlogtest.log", "ab"))) {	// as if a crash came mid-write
+		fwrite("\x12\x34\x56", 3, 1, torn);
+		fclose(torn);
+	}
+	log2 = pxHtLogOpen (l3, "htlogtest", NULL);
+	errors += !log2 || l3->ulCurEntries != 749 || pvHtSGetVal(l3, "k1") != (void *)77
+		|| !fileexists("htlogtest.snap") || fileexists("htlogtest.old");
+	if (log2) {
+		errors += pxHtLogStats(log2)->ulReplayed != 752;	// snapshot, then two changes
+		vHtLogClose(log2);
+	}
+	printresult(errors, "Compacting, and recovering past a torn record");
+	remove("htlogtest.log");
+	remove("htlogtest.snap");
+
+	htLogConfig_t eachcfg = { .ulSync = htLOG_SYNC_EACH, .ulCompactBytes = 120 };
+	hashtab_t *l4 = pxHtNewHashTable ("compact-on-delete", 0, 0, 16, 13);
+	hashtab_t *l5 = pxHtNewHashTable ("compact-on-delete-recovered", 0, 0, 16, 13);
+
+	errors = 0;
+	log1 = pxHtLogOpen (l4, "htlogtest", &eachcfg);
+	for (unsigned i = 1; log1 && i <= 5; i++)
+		iHtISetVal(l4, i, (void *)(long)i);
+	iHtIDelete(l4, 3);				// its record takes the log past ulCompactBytes
+	errors += fileexists("htlogtest.old") || fileexists("htlogtest.snap");
+	if (log1) {
+		errors += iHtLogCommit(log1) != 0;		// so the compaction starts here
+		vHtLogClose(log1);
+	}
+	log2 = pxHtLogOpen (l5, "htlogtest", NULL);
+	errors += !log1 || !log2 || l5->ulCurEntries != 4 || pxHtIFindEntry(l5, 3) != NULL
+		|| pvHtIGetVal(l5, 5) != (void *)5 || !fileexists("htlogtest.snap") || fileexists("htlogtest.old");
+	if (log2)
+		vHtLogClose(log2);
+	printresult(errors, "Deleting, compacting, and recovering without the key");
+	remove("htlogtest.log");
+	remove("htlogtest.snap");
+	vHtFreeHashTable(l4);
+	vHtFreeHashTable(l5);
+	vHtFreeHashTable(l1);
+	vHtFreeHashTable(l2);
+	vHtFreeHashTable(l3);
+
+// -----------------------------------------------------------------------
+	printf ("\nClone Tests\n");
+// -----------------------------------------------------------------------
+
+	hashtab_t *c0 = pxHtNewHashTable ("original", 0, 0, 64, 1001);
+	hashtab_t *c1, *c2, *c3;
+	size_t shared, own;
+
+	errors = 0;
+	for (unsigned i = 0; i < 5000; i++)
+		iHtIAddVal(c0, i, (void *)(long)i);
+	c1 = pxHtClone ("clone", c0);
+	vHtCloneBytes(c0, &shared, &own);
+	errors += !c1 || own > 64 || shared < 5000 * sizeof (hashent_t);
+	if (c1) {
+		iHtISetVal(c0, 7, (void *)70000);
+		iHtIDelete(c0, 8);
+		iHtIAddVal(c0, 99999, (void *)1);
+		lHtIAddToVal(c1, 9, 1);
+		for (unsigned i = 0; i < 5000; i++) {
+			errors += pvHtIGetVal(c1, i) != (void *)(long)(i == 9 ? 10 : i);
+			if (i != 7 && i != 8)
+				errors += pvHtIGetVal(c0, i) != (void *)(long)i;
+		}
+		errors += c1->ulCurEntries != 5000 || pvHtIGetVal(c1, 99999) || pvHtIGetVal(c0, 7) != (void *)70000
+			|| pxHtIFindEntry(c0, 8) || c0->ulCurEntries != 5000;
+		vHtCloneBytes(c0, &shared, &own);
+		errors += own == 0 || shared == 0;
+		vHtFreeHashTable(c1);
+	}
+	vHtFreeHashTable(c0);
+	printresult(errors, "Cloning a table, then changing both");
+
+	errors = 0;
+	c0 = pxHtNewHashTableEx ("original-keys", 0, 0, 64, 301, &(htConfig_t){ .xCopyKeys = 1 });
+	for (unsigned i = 0; i < 1000; i++) {
+		snprintf(logkey, sizeof logkey, "key%u", i);
+		iHtSAddVal(c0, logkey, (void *)(long)i);
+	}
+	c2 = pxHtClone ("clone-keys", c0);
+	c3 = c2 ? pxHtClone ("clone-of-clone", c2) : NULL;
+	for (unsigned i = 0; i < 1000; i += 2) {
+		snprintf(logkey, sizeof logkey, "key%u", i);
+		iHtSDelete(c0, logkey);
+	}
+	vHtFreeHashTable(c0);		// the clones still have every key
+	if (c2 && c3) {
+		htFOREACH(cit, w, c2) {
+			errors += strncmp(w->pcName, "key", 3) != 0 || atoi(w->pcName + 3) != w->lValue;
+		}
+		iHtSDelete(c2, "key1");
+		errors += c2->ulCurEntries != 999 || c3->ulCurEntries != 1000 || !pxHtSFindEntry(c3, "key1");
+		vHtFreeHashTable(c2);
+		errors += pvHtSGetVal(c3, "key999") != (void *)999;
+	} else {
+		errors++;
+	}
+	if (c3)
+		vHtFreeHashTable(c3);
+	printresult(errors, "Clones sharing copied keys, freed in any order");
+
+// -----------------------------------------------------------------------
+	printf ("\nCombiner Tests\n");
+// -----------------------------------------------------------------------
+
+	hashtab_t *ct = pxHtNewHashTable ("combined", 0, 0, 64, 101);
+	pthread_t combthreads[COMBTHREADS];
+
+	errors = 0;
+	comb = pxHtNewCombiner (ct, COMBTHREADS);
+	for (long t = 0; comb && t < COMBTHREADS; t++)
+		errors += pthread_create(&combthreads[t], NULL, combthread, (void *)t) != 0;
+	for (int t = 0; comb && t < COMBTHREADS; t++)
+		pthread_join(combthreads[t], NULL);
+	for (unsigned k = 0; k < 16; k++)
+		errors += pvHtIGetVal(ct, k) != (void *)(long)(COMBTHREADS * COMBOPS / 16);
+	for (unsigned t = 0; t < COMBTHREADS; t++)
+		errors += pvHtIGetVal(ct, 100 + t) != (void *)(long)(COMBOPS - 1);
+	errors += !comb || comberrors || ct->ulCurEntries != 16 + COMBTHREADS
+		|| pxHtCombinerStats(comb)->ulOps != 3 * COMBTHREADS * COMBOPS;
+	printresult(errors, "Counting from several threads through a combiner");
+	if (comb)
+		vHtFreeCombiner(comb);
+	vHtFreeHashTable(ct);
+
+	ct = pxHtNewHashTable ("combined-set", 0, 0, 64, 101);
+	comb = pxHtNewCombiner (ct, 1);
+	htCSlot_t *cslot = comb ? pxHtCombinerSlot(comb) : NULL;
+
+	errors = !cslot;
+	if (cslot) {
+		// overwriting counts as a set, as it does for iHtISetVal
+		errors += iHtCSetVal(cslot, 7, (void *)1L) != 1 || iHtCSetVal(cslot, 7, (void *)2L) != 1;
+		errors += pvHtCGetVal(cslot, 7) != (void *)2L || iHtISetVal(ct, 7, (void *)3L) != 1;
+		vHtCombinerLeave(cslot);
+	}
+	errors += ct->ulCurEntries != 1 || pvHtIGetVal(ct, 7) != (void *)3L;
+	printresult(errors, "Setting a key through a combiner, then overwriting it");
+	if (comb)
+		vHtFreeCombiner(comb);
+	vHtFreeHashTable(ct);
+
+// -----------------------------------------------------------------------
+	printf ("\nDirect-address Tests\n");
+// -----------------------------------------------------------------------
+
+	hashtab_t *d1 = pxHtNewHashTableEx ("direct", 0, 0, 64, 101,
+										&(htConfig_t){ .ulDirectBase = 1000, .ulDirectKeys = 2000 });
+	hashtab_t *d2 = pxHtNewHashTable ("made-direct", 0, 0, 64, 101);
+	hashtab_t *d3 = pxHtNewHashTable ("sparse", 0, 0, 64, 101);
+	long dsum = 0;
+	unsigned dcount = 0;
+
+	errors = !d1;
+	for (unsigned i = 0; d1 && i < 5000; i++)
+		errors += iHtIAddVal(d1, i, (void *)(long)i) != 1;
+	if (d1) {
+		errors += iHtIAddVal(d1, 1500, NULL) != 0 || iHtIDelete(d1, 1500) != 1 || iHtIDelete(d1, 500) != 1;
+		errors += d1->pxExt->ulDirectUsed != 1999 || d1->ulCurEntries != 4998 || pvHtIGetVal(d1, 1500) != NULL;
+		for (unsigned i = 0; i < 5000; i++) {
+			if (i != 500 && i != 1500)
+				errors += pvHtIGetVal(d1, i) != (void *)(long)i;
+		}
+		htFOREACH(dit, w, d1) {
+			dsum += w->lValue;
+			dcount++;
+			if (w->ulKey == 2999)
+				iHtIDelete(d1, 2999);		// deleting the entry just returned
+		}
+		errors += dcount != 4998 || dsum != 4999L * 5000 / 2 - 2000 || pxHtIFindEntry(d1, 2999);
+	}
+	printresult(errors, "Keys in and out of a direct-address range");
+
+	errors = 0;
+	for (unsigned i = 10000; i < 11000; i++) {
+		if (i % 3)
+			iHtIAddVal(d2, i, (void *)(long)i);
+		iHtIAddVal(d3, i * 5, NULL);
+	}
+	errors += iHtISetDirect(d2, 0, 0) != 1 || iHtISetDirect(d3, 0, 0) != 0;
+	errors += d2->pxExt->ulDirectBase != 10000 || d2->pxExt->ulDirectCount != 1000 || d2->pxExt->ulDirectUsed != d2->ulCurEntries;
+	for (unsigned i = 10000; i < 11000; i++)
+		errors += pvHtIGetVal(d2, i) != (i % 3 ? (void *)(long)i : NULL);
+	printresult(errors, "Finding a direct-address range from the keys");
+	if (d1)
+		vHtFreeHashTable(d1);
+	vHtFreeHashTable(d2);
+	vHtFreeHashTable(d3);
+
+// -----------------------------------------------------------------------
+	printf ("\nSmall Table Tests\n");
+// -----------------------------------------------------------------------
+
+	hashtab_t *s1 = pxHtNewHashTableEx ("small", 0, 0, 16, 31, &(htConfig_t){ .ulSmallKeys = 32 });
+	hashtab_t *s2 = pxHtNewHashTableEx ("small-strings", 0, 0, 16, 31,
+										&(htConfig_t){ .ulSmallKeys = 20, .xCopyKeys = 1 });
+	char sname[16];
+	int wassmall, waschained;
+
+	errors = !s1 || !s2;
+	for (unsigned i = 0; s1 && i < 20; i++)
+		errors += iHtIAddVal(s1, i * 7, (void *)(long)i) != 1;
+	if (s1) {
+		errors += iHtIAddVal(s1, 7, NULL) != 0 || !s1->pxSmall || s1->pxBuckets || s1->ulSlabBytes;
+		for (unsigned i = 0; i < 20; i++)
+			errors += pvHtIGetVal(s1, i * 7) != (void *)(long)i || pxHtIFindEntry(s1, i * 7 + 1);
+		wassmall = s1->pxSmall && !s1->pxBuckets;
+		for (unsigned i = 20; i < 100; i++)
+			errors += iHtIAddVal(s1, i * 7, (void *)(long)i) != 1;
+		waschained = !s1->pxSmall && s1->pxBuckets;
+		for (unsigned i = 0; i < 100; i++)
+			errors += pvHtIGetVal(s1, i * 7) != (void *)(long)i;
+		for (unsigned i = 10; i < 100; i++)
+			errors += iHtIDelete(s1, i * 7) != 1;
+		errors += !wassmall || !waschained || s1->pxSmall || s1->ulCurEntries != 10;
+		errors += lHtIAddToVal(s1, 1000, 5) != 5 || !s1->pxSmall || s1->pxBuckets || s1->ulSlabBytes;
+		for (unsigned i = 0; i < 10; i++)
+			errors += pvHtIGetVal(s1, i * 7) != (void *)(long)i || pxHtIFindEntry(s1, i * 7 + 1);
+		dcount = 0;
+		htFOREACH(sit, w, s1) {
+			dcount++;
+			if (w->ulKey % 2)
+				iHtIDelete(s1, w->ulKey);	// deleting the entry just returned
+		}
+		errors += dcount != 11 || s1->ulCurEntries != 6 || pvHtIGetVal(s1, 1000) != (void *)5L;
+		for (unsigned i = 0; i < 10; i++)
+			errors += pvHtIGetVal(s1, i * 7) != (i * 7 % 2 ? NULL : (void *)(long)i);
+	}
+	printresult(errors, "Small table growing into buckets and back");
+
+	errors = !s2;
+	for (unsigned i = 0; s2 && i < 40; i++) {
+		snprintf(sname, sizeof sname, "key%u", i);
+		errors += iHtSAddVal(s2, sname, (void *)(long)i) != 1;
+		if (i == 19)
+			wassmall = s2->pxSmall && s2->ulSmallMax == 24;
+	}
+	if (s2) {
+		errors += !wassmall || s2->pxSmall != NULL;
+		for (unsigned i = 0; i < 40; i++) {
+			snprintf(sname, sizeof sname, "key%u", i);
+			errors += pvHtSGetVal(s2, sname) != (void *)(long)i;
+			if (i >= 8)
+				errors += iHtSDelete(s2, sname) != 1;
+		}
+		errors += iHtSSetVal(s2, "another", (void *)99L) != 1 || !s2->pxSmall || s2->ulCurEntries != 9;
+		for (unsigned i = 0; i < 8; i++) {
+			snprintf(sname, sizeof sname, "key%u", i);
+			errors += pvHtSGetVal(s2, sname) != (void *)(long)i;
+		}
+		errors += pvHtSGetVal(s2, "another") != (void *)99L || pvHtSGetVal(s2, "key8") != NULL;
+	}
+	printresult(errors, "Small table of string keys");
+	if (s1)
+		vHtFreeHashTable(s1);
+	if (s2)
+		vHtFreeHashTable(s2);
+
+// -----------------------------------------------------------------------
+	printf ("\nGrowth Tests\n");
+// -----------------------------------------------------------------------
+
+	hashtab_t *g1 = pxHtNewHashTableEx ("doubling", 0, 0, 16, 50001,
+										&(htConfig_t){ .pxAlloc = countalloc, .pxFree = countfree,
+													   .ulAllocMax = 1024 });
+	hashtab_t *g2 = pxHtNewHashTableEx ("doubling-capped", 0, 1000, 16, 501,
+										&(htConfig_t){ .ulAllocMax = 1 << 20 });
+
+	errors = !g1 || !g2;
+	allocations = 0;
+	for (unsigned i = 0; g1 && i < 100000; i++)
+		errors += iHtIAddVal(g1, i * 2654435761u, (void *)(long)i) != 1;
+	// blocks of 16, 32 ... 1024 hold 2032, then 96 more of 1024
+	errors += allocations != 7 + 96 || g1->ulAllocSize != 1024 || g1->ulCurEntries != 100000;
+	for (unsigned i = 0; g1 && i < 100000; i++)
+		errors += pvHtIGetVal(g1, i * 2654435761u) != (void *)(long)i;
+	for (unsigned i = 0; g2 && i < 2000; i++)
+		iHtIAddVal(g2, i, NULL);
+	errors += g2->ulCurEntries != 1000 || g2->ulSlabBytes > 1000 * g2->ulEntrySize + 8 * 16;	// and a header each
+	printresult(errors, "Blocks of entries doubling in size, up to the cap");
+	vHtFreeHashTable(g1);
+	vHtFreeHashTable(g2);
+
+// -----------------------------------------------------------------------
+	printf ("\nShared Memory Tests\n");
+// -----------------------------------------------------------------------
+
+	// two mappings of the same table stand in for two processes
+	iHtShmUnlink("/htshm-test");
+	htShm_t *m1 = pxHtShmCreate ("/htshm-test", 1000, 501, 0, 2 * sizeof (unsigned long));
+	htShm_t *m2 = pxHtShmAttach ("/htshm-test");
+	unsigned long pair[2];
+	htShmStats_t shmstats;
+
+	errors = !m1 || !m2 || m1 == m2 || pxHtShmCreate ("/htshm-test", 10, 11, 0, 0) != NULL;
+	for (unsigned long k = 0; m1 && k < 1000; k++)
+		errors += !iHtShmISetVal(m1, k, (unsigned long[2]){ k, k * 3 });
+	errors += m1 && iHtShmISetVal(m1, 1000, pair);		// full
+	for (unsigned long k = 0; m2 && k < 1000; k++)
+		errors += !iHtShmIGetVal(m2, k, pair) || pair[0] != k || pair[1] != k * 3;
+	for (unsigned long k = 0; m2 && k < 1000; k += 2)
+		errors += iHtShmIDelete(m2, k) != 1;
+	for (unsigned long k = 0; m1 && k < 1000; k++)
+		errors += iHtShmIGetVal(m1, k, NULL) != (k & 1);
+	errors += m2 && iHtShmSGetVal(m2, "1", pair);		// wrong kind of key
+	if (m2) {
+		vHtShmStats(m2, &shmstats);
+		errors += shmstats.ulEntries != 500 || shmstats.ulMaxEntries != 1000;
+	}
+	printresult(errors, "Table shared between two mappings");
+
+	iHtShmUnlink("/tmp/htshm-test");
+	htShm_t *m3 = pxHtShmCreate ("/tmp/htshm-test", 100, 51, 16, 0);
+	htShm_t *m4 = m3 ? pxHtShmAttach ("/tmp/htshm-test") : NULL;
+	const long *pl;
+
+	errors = !m3 || !m4;
+	errors += m3 && (!iHtShmSSetVal(m3, "alpha", &(long){ 1 }) || !iHtShmSSetVal(m3, "beta", &(long){ 2 })
+					 || iHtShmSSetVal(m3, "much-too-long-for-it", &(long){ 3 }));
+	errors += m4 && (!(pl = pvHtShmSFindVal(m4, "alpha")) || *pl != 1 || !iHtShmSSetVal(m4, "alpha", &(long){ 5 }));
+	errors += m3 && (!(pl = pvHtShmSFindVal(m3, "alpha")) || *pl != 5 || pvHtShmSFindVal(m3, "gamma")
+					 || iHtShmSDelete(m3, "beta") != 1 || pvHtShmSFindVal(m4, "beta"));
+	printresult(errors, "String keys in a mapped file");
+
+	pthread_t shmth;
+
+	errors = !m1 || !m2;
+	for (unsigned long k = 0; m1 && k < SHMKEYS; k++)
+		iHtShmISetVal(m1, k, (unsigned long[2]){ k, k });
+	shmreader = m2;
+	if (!errors && pthread_create(&shmth, NULL, shmthread, NULL) == 0) {
+		for (unsigned long r = 0; r < SHMROUNDS; r++) {
+			unsigned long k = r % SHMKEYS;
+
+			iHtShmISetVal(m1, k, (unsigned long[2]){ r, r });
+			if (r % 7 == 0) {		// and move some around the free list
+				iHtShmIDelete(m1, SHMKEYS + k);
+				iHtShmISetVal(m1, SHMKEYS + k, (unsigned long[2]){ r, r });
+			}
+		}
+		shmdone = 1;
+		pthread_join(shmth, NULL);
+	} else {
+		errors++;
+	}
+	printresult(errors + shmerrors, "Lock-free readers never see half a change");
+	if (m1) vHtShmDetach(m1);
+	if (m2) vHtShmDetach(m2);
+	if (m3) vHtShmDetach(m3);
+	if (m4) vHtShmDetach(m4);
+	iHtShmUnlink("/htshm-test");
+	iHtShmUnlink("/tmp/htshm-test");
+
+// -----------------------------------------------------------------------
+	printf ("\nStatic Table Tests\n");
+// -----------------------------------------------------------------------
+
+	static hashtab_t st1, st2;
+	static Link_t stbuckets1[49], stbuckets2[16];
+	static char stentries1[htSTATIC_ENTRYBYTES(100, 12)], stentries2[htSTATIC_ENTRYBYTES(8, 0) + 5];
+	htConfig_t stcfg = { .ulValSize = 12, .ulValAlign = 4 };
+
+	errors = pxHtNewStaticTable (&st1, "static", stbuckets1, 49, stentries1, sizeof stentries1, &stcfg) != &st1;
+	// at least the 100 asked for; more, since 12 bytes aligned to 4 pack closer than the macro allows
+	errors += ulHtEntrySize(&stcfg) > htSTATIC_ENTRYSIZE(12) || st1.ulMaxEntries < 100;
+	for (unsigned i = 0; i < st1.ulMaxEntries; i++)
+		errors += !iHtIAddVal(&st1, i * 7, (char [12]){ (char)i });
+	errors += iHtIAddVal(&st1, 1000, NULL) != 0 || st1.ulCurEntries != st1.ulMaxEntries;		// full
+	errors += iHtIDelete(&st1, 7) != 1 || !iHtIAddVal(&st1, 1000, NULL) || iHtIAddVal(&st1, 1001, NULL);
+	for (unsigned i = 2; i < st1.ulMaxEntries; i++)
+		errors += *(char *)pvHtIGetVal(&st1, i * 7) != (char)i;
+	errors += pxHtClone ("static-clone", &st1) != NULL || iHtISetDirect(&st1, 0, 0);
+	vHtFreeHashTable(&st1);		// does nothing
+	printresult(errors, "Static table filling its pool, and reusing entries");
+
+	// an odd entries buffer and an even bucket count: the table copes with both
+	errors = pxHtNewStaticTable (&st2, "static-cache", stbuckets2, 16, stentries2 + 5, sizeof stentries2 - 5,
+								 &(htConfig_t){ .xCache = 1, .ulInlineKeys = 16 }) != &st2;
+	errors += st2.ulBucketCount != 15 || st2.ulMaxEntries == 0 || st2.ulMaxEntries > 8;
+	for (unsigned i = 0; i < 20; i++) {
+		char key[8];
+
+		snprintf(key, sizeof key, "k%u", i);
+		errors += !iHtSAddVal(&st2, key, (void *)(long)i);
+	}
+	errors += st2.ulCurEntries != st2.ulMaxEntries || !pvHtSGetVal(&st2, "k19");
+	errors += iHtSAddVal(&st2, "a-key-too-long-to-inline", NULL) != 0;
+	printresult(errors, "Static cache table evicting instead of allocating");
+
+// -----------------------------------------------------------------------
+	printf ("\nCompaction Tests\n");
+// -----------------------------------------------------------------------
+
+	hashtab_t *k1 = pxHtNewHashTable ("compact", 0, 0, 256, 4001);
+	int calls = 0, misplaced = 0;
+	size_t before;
+
+	errors = !k1;
+	for (unsigned i = 0; k1 && i < COMPACTKEYS; i++)
+		iHtIAddVal(k1, i, (void *)(long)i);
+	for (unsigned i = 0; k1 && i < COMPACTKEYS; i++) {
+		if (i % 4)
+			iHtIDelete(k1, i);
+	}
+	for (unsigned i = 0; k1 && i < COMPACTKEYS; i += 4)
+		compactwhere[i] = pxHtIFindEntry(k1, i);
+	before = k1 ? k1->ulSlabBytes : 0;
+	// a pass in small steps, with the table changing between them
+	while (k1 && iHtCompact(k1, 100, compactmoved, &misplaced)) {
+		unsigned k = 1 + 4 * (calls % (COMPACTKEYS / 4));
+
+		calls++;
+		iHtIAddVal(k1, k, (void *)(long)k);
+		compactwhere[k] = pxHtIFindEntry(k1, k);
+		iHtIDelete(k1, 8 * (calls % (COMPACTKEYS / 8)));
+		compactwhere[8 * (calls % (COMPACTKEYS / 8))] = NULL;
+	}
+	errors += calls < 10 || misplaced || !k1 || k1->ulSlabBytes >= before / 2 || k1->pxExt->xStats.ulCompactions != 1;
+	for (unsigned i = 0; k1 && i < COMPACTKEYS; i++) {
+		hashent_t *e = pxHtIFindEntry(k1, i);
+
+		errors += e != compactwhere[i] || (e && e->ulValue != i);
+	}
+	printresult(errors, "Compacting a churned table a little at a time");
+
+	// a pass in one go over a table left alone puts the entries in one
+	// block, in the order the iterator visits them
+	hashent_t *last = NULL;
+
+	errors = !k1 || iHtCompact(k1, 0, compactmoved, &misplaced) != 0 || misplaced;
+	errors += k1 && k1->ulSlabBytes > 16 + (k1->ulCurEntries + k1->ulAllocSize) * k1->ulEntrySize;
+	if (k1) {
+		htFOREACH(cit, ce, k1) {
+			errors += last && ce <= last;
+			last = ce;
+		}
+	}
+	vHtFreeHashTable(k1);
+
+	// a cache table's CLOCK ring, and inline keys, move with their entries
+	hashtab_t *k2 = pxHtNewHashTableEx ("compact-cache", 0, 300, 16, 31,
+										&(htConfig_t){ .xCache = 1, .ulInlineKeys = 16 });
+
+	errors += !k2;
+	for (unsigned i = 0; k2 && i < 1000; i++) {
+		char key[24];
+
+		snprintf(key, sizeof key, i % 3 ? "k%u" : "a-long-key-%u", i);
+		iHtSAddVal(k2, key, (void *)(long)i);
+		if (i % 5 == 0)
+			iHtSDelete(k2, key);
+		if (i % 100 == 99)
+			iHtCompact(k2, 50, NULL, NULL);
+	}
+	while (k2 && iHtCompact(k2, 50, NULL, NULL))
+		;
+	for (unsigned i = 1000; k2 && i < 1400; i++) {		// evicting, so walking the ring
+		char key[24];
+
+		snprintf(key, sizeof key, "k%u", i);
+		errors += !iHtSAddVal(k2, key, (void *)(long)i);
+	}
+	if (k2) {
+		htFOREACH(cit2, ce2, k2) {
+			const char *num = strncmp(ce2->pcName, "a-long-key-", 11) == 0 ? ce2->pcName + 11 : ce2->pcName + 1;
+
+			errors += strtoul(num, NULL, 10) != ce2->ulValue;
+			errors += pvHtSGetVal(k2, ce2->pcName) != ce2->pxValue;
+		}
+		errors += k2->ulCurEntries != 300;
+	}
+	printresult(errors, "Compacting in one go, and a cache table with inline keys");
+	vHtFreeHashTable(k2);
+
+// -----------------------------------------------------------------------
+	printf ("\nKeyed Hash Tests\n");
+// -----------------------------------------------------------------------
+
+	// keys chosen to share a bucket under the ordinary hash: a multiple of
+	// the bucket count apart
+	hashtab_t *f1 = pxHtNewHashTable ("flooded", 0, 0, 256, 1001);
+	hashtab_t *f2 = pxHtNewHashTableEx ("keyed", 0, 0, 256, 1001, &(htConfig_t){ .xKeyedHash = 1 });
+	int longest1 = 0, longest2 = 0;
+
+	errors = !f1 || !f2;
+	for (unsigned i = 0; f1 && f2 && i < 2000; i++) {
+		iHtIAddVal(f1, i * 1001, (void *)(long)i);
+		iHtIAddVal(f2, i * 1001, (void *)(long)i);
+	}
+	for (unsigned b = 0; f1 && f2 && b < 1001; b++) {
+		int n1 = 0, n2 = 0;
+
+		for (Link_t *l = f1->pxBuckets[b].pxNext; l != &f1->pxBuckets[b]; l = l->pxNext)
+			n1++;
+		for (Link_t *l = f2->pxBuckets[b].pxNext; l != &f2->pxBuckets[b]; l = l->pxNext)
+			n2++;
+		longest1 = n1 > longest1 ? n1 : longest1;
+		longest2 = n2 > longest2 ? n2 : longest2;
+	}
+	for (unsigned i = 0; f2 && i < 2000; i++)
+		errors += pvHtIGetVal(f2, i * 1001) != (void *)(long)i;
+	errors += longest1 != 2000 || longest2 > 16 || f2->pxExt->xStats.ulReseeds != 0;
+	printresult(errors, "Keyed hash spreading keys that collide in the ordinary one");
+	vHtFreeHashTable(f1);
+	vHtFreeHashTable(f2);
+
+	// too few buckets, so chains are long whatever the seed: it reseeds,
+	// rehashes a few buckets per add, and keys are found throughout
+	hashtab_t *f3 = pxHtNewHashTableEx ("reseeding", 0, 0, 64, 301,
+										&(htConfig_t){ .xKeyedHash = 1, .ulMaxChain = 4, .xCopyKeys = 1 });
+	int rehashing = 0;
+
+	errors = !f3;
+	for (unsigned i = 0; f3 && i < 3000; i++) {
+		char key[16];
+
+		snprintf(key, sizeof key, "key%u", i);
+		errors += !iHtSAddVal(f3, key, (void *)(long)i);
+		rehashing += f3->pxExt->pxOldBuckets != NULL;
+		if (i % 97 == 0) {
+			for (unsigned j = 0; j <= i; j += 13) {
+				snprintf(key, sizeof key, "key%u", j);
+				errors += pvHtSGetVal(f3, key) != (void *)(long)j;
+			}
+		}
+	}
+	errors += !f3 || f3->pxExt->xStats.ulReseeds < 2 || !rehashing || f3->pxExt->xStats.ulRehashed == 0;
+	if (f3) {
+		unsigned total = 0;
+
+		htFOREACH(fit, fe, f3) {
+			total++;
+		}
+		errors += total != 3000;
+	}
+	printresult(errors, "Reseeding and rehashing after long chains");
+	vHtFreeHashTable(f3);
+
+	// a multimap rehashed part way, with adds and deletes in between
+	hashtab_t *f4 = pxHtNewHashTableEx ("keyed-multimap", 0, 0, 64, 101,
+										&(htConfig_t){ .xKeyedHash = 1, .xMultimap = 1 });
+	htDupIterator_t fdit;
+
+	errors = !f4;
+	for (unsigned i = 0; f4 && i < 500; i++)
+		iHtIAddVal(f4, i % 100, (void *)(long)i);
+	errors += f4 && (!iHtReseed(f4) || !iHtRehashStep(f4, 40) || iHtReseed(f4));
+	for (unsigned i = 500; f4 && i < 600; i++)		// each key's sixth value, maybe moving more
+		iHtIAddVal(f4, i % 100, (void *)(long)i);
+	errors += f4 && iHtIDelete(f4, 7) != 1;
+	for (unsigned k = 0; f4 && k < 100; k++) {
+		unsigned n = 0, v = k + (k == 7) * 100;
+
+		for (hashent_t *e = pxHtIFindFirst(&fdit, f4, k); e; e = pxHtFindNext(&fdit), v += 100)
+			errors += e->ulValue != v || ++n > 6;
+		errors += n != 6 - (k == 7) || ulHtICount(f4, k) != n;
+	}
+	while (f4 && iHtRehashStep(f4, 10))
+		;
+	errors += !f4 || f4->pxExt->pxOldBuckets || ulHtICount(f4, 99) != 6;
+	printresult(errors, "Keyed multimap keeping duplicates together while rehashing");
+	vHtFreeHashTable(f4);
+
+// -----------------------------------------------------------------------
+	printf ("\nHot Key Cache Tests\n");
+// -----------------------------------------------------------------------
+
+	// a few hot keys among many: most of their lookups come from the cache,
+	// and deleting, re-adding and setting them is seen at once
+	hashtab_t *q1 = pxHtNewHashTableEx ("hot", 0, 0, 1024, 4001, &(htConfig_t){ .ulHotKeys = 256 });
+	unsigned long qlookups = 0, qhits = 0;
+
+	errors = !q1;
+	for (unsigned i = 0; q1 && i < 50000; i++)
+		iHtIAddVal(q1, i, (void *)(long)i);
+	if (q1) {			// the adds' lookups count too
+		qlookups = q1->pxExt->xStats.ulHotLookups;
+		qhits = q1->pxExt->xStats.ulHotHits;
+	}
+	for (unsigned round = 0; q1 && round < 20; round++) {
+		for (unsigned i = 0; i < 100; i++)
+			errors += pvHtIGetVal(q1, i * 499) != (void *)(long)(i * 499);
+	}
+	errors += !q1 || q1->pxExt->xStats.ulHotHits - qhits < (q1->pxExt->xStats.ulHotLookups - qlookups) * 9 / 10;
+	errors += q1 && (iHtIDelete(q1, 499) != 1 || pvHtIGetVal(q1, 499) != NULL);
+	errors += q1 && (!iHtIAddVal(q1, 499, (void *)1L) || pvHtIGetVal(q1, 499) != (void *)1L);
+	if (q1)
+		iHtISetVal(q1, 998, (void *)2L);
+	errors += q1 && pvHtIGetVal(q1, 998) != (void *)2L;
+	if (q1)
+		vHtEDelete(pxHtIFindEntry(q1, 1497));
+	errors += q1 && pvHtIGetVal(q1, 1497) != NULL;
+	printresult(errors, "Hot key cache answering repeated lookups, and deletes seen");
+	vHtFreeHashTable(q1);
+
+	// entries moved by compaction, and dropped by a cache table, leave the
+	// hot key cache too
+	hashtab_t *q2 = pxHtNewHashTableEx ("hot-strings", 0, 0, 64, 101,
+										&(htConfig_t){ .ulHotKeys = 16, .xCopyKeys = 1 });
+	hashtab_t *q3 = pxHtNewHashTableEx ("hot-cache", 0, 200, 64, 101,
+										&(htConfig_t){ .ulHotKeys = 16, .xCache = 1 });
+
+	errors = !q2 || !q3;
+	for (unsigned i = 0; q2 && i < 2000; i++) {
+		char key[16];
+
+		snprintf(key, sizeof key, "hot%u", i);
+		iHtSAddVal(q2, key, (void *)(long)i);
+		if (i % 3)
+			iHtSDelete(q2, key);
+	}
+	for (unsigned i = 0; q2 && i < 2000; i += 3) {
+		char key[16];
+
+		snprintf(key, sizeof key, "hot%u", i);
+		errors += pvHtSGetVal(q2, key) != (void *)(long)i;
+	}
+	while (q2 && iHtCompact(q2, 50, NULL, NULL)) {
+		for (unsigned i = 0; i < 30; i += 3) {
+			char key[16];
+
+			snprintf(key, sizeof key, "hot%u", i);
+			errors += pvHtSGetVal(q2, key) != (void *)(long)i;
+		}
+	}
+	errors += !q2 || q2->pxExt->xStats.ulMoved == 0 || q2->pxExt->xStats.ulHotHits == 0;
+	for (unsigned i = 0; q3 && i < 1000; i++) {
+		iHtIAddVal(q3, i, (void *)(long)i);
+		errors += pvHtIGetVal(q3, i) != (void *)(long)i;
+		errors += i >= 200 && pvHtIGetVal(q3, i - 200) != NULL;
+	}
+	errors += !q3 || q3->pxExt->xStats.ulEvictions != 800;
+	printresult(errors, "Hot key cache following compaction and eviction");
+	vHtFreeHashTable(q2);
+	vHtFreeHashTable(q3);
+
+	// a clone starts with the original's cache; changes to either, which
+	// copy entries, aren't seen by the other
+	hashtab_t *q4 = pxHtNewHashTableEx ("hot-original", 0, 0, 256, 1001, &(htConfig_t){ .ulHotKeys = 64 });
+	hashtab_t *q5 = NULL;
+
+	errors = !q4;
+	for (unsigned i = 0; q4 && i < 5000; i++)
+		iHtIAddVal(q4, i, (void *)(long)i);
+	for (unsigned i = 0; q4 && i < 20; i++)
+		errors += pvHtIGetVal(q4, i) != (void *)(long)i;
+	errors += !q4 || !(q5 = pxHtClone("hot-clone", q4));
+	for (unsigned i = 0; q5 && i < 20; i++) {
+		iHtISetVal(q4, i, (void *)(long)(i + 100));
+		errors += pvHtIGetVal(q5, i) != (void *)(long)i;
+		errors += pvHtIGetVal(q4, i) != (void *)(long)(i + 100);
+	}
+	for (unsigned i = 0; q5 && i < 20; i += 2)
+		iHtIDelete(q5, i);
+	for (unsigned i = 0; q5 && i < 20; i++) {
+		errors += pvHtIGetVal(q5, i) != (i % 2 ? (void *)(long)i : NULL);
+		errors += pvHtIGetVal(q4, i) != (void *)(long)(i + 100);
+	}
+	errors += !q5 || q5->pxExt->xStats.ulHotHits == 0;
+	printresult(errors, "Hot key cache in a table and its clone");
+	if (q5)
+		vHtFreeHashTable(q5);
+	vHtFreeHashTable(q4);
+
+// -----------------------------------------------------------------------
+	printf ("\nRemove-If Tests\n");
+// -----------------------------------------------------------------------
+
+	// one pass removing a third of the keys; the entries go back on the
+	// free list, so adding as many again takes no more memory
+	hashtab_t *r1 = pxHtNewHashTable ("remove-if", 0, 0, 256, 1001);
+	unsigned three = 3, five = 5, seven = 7;
+	size_t rbytes = 0;
+
+	errors = !r1;
+	for (unsigned i = 0; r1 && i < 9000; i++)
+		iHtIAddVal(r1, i, (void *)(long)i);
+	if (r1)
+		rbytes = r1->ulSlabBytes;
+	errors += !r1 || ulHtRemoveIf(r1, keymultiple, &three, 0) != 3000 || r1->ulCurEntries != 6000;
+	for (unsigned i = 0; r1 && i < 9000; i++)
+		errors += pvHtIGetVal(r1, i) != (i % 3 ? (void *)(long)i : NULL);
+	for (unsigned i = 9000; r1 && i < 12000; i++)
+		iHtIAddVal(r1, i, (void *)(long)i);
+	errors += !r1 || r1->ulSlabBytes != rbytes;
+	printresult(errors, "Removing by predicate, reusing the entries");
+	vHtFreeHashTable(r1);
+
+	// deleting the entry just returned, in each kind of table the
+	// iterator walks differently, and an entry found by FindEntry
+	htConfig_t rcfg[5] = { { .xMultimap = 1 }, { .xCuckoo = 1 }, { .ulSmallKeys = 64 },
+						   { .ulDirectKeys = 100 }, { .ulHotKeys = 64, .xBloom = 1 } };
+
+	errors = 0;
+	for (int c = 0; c < 5; c++) {
+		hashtab_t *r2 = pxHtNewHashTableEx ("iterator-delete", 0, 0, 64, 101, &rcfg[c]);
+		unsigned n = c == 2 ? 60 : 1000, left = 0;
+
+		errors += !r2;
+		for (unsigned i = 0; r2 && i < n; i++)
+			iHtIAddVal(r2, i, (void *)(long)i);
+		for (unsigned i = 0; r2 && c == 0 && i < n; i += 2)
+			iHtIAddVal(r2, i, (void *)(long)(i + n));		// a second value for even keys
+		if (r2) {
+			htFOREACH(rit, re, r2) {
+				if (re->ulKey % 5 == 0)
+					errors += !iHtIteratorDelete(&rit);
+			}
+			htFOREACH(rit2, re2, r2) {
+				errors += re2->ulKey % 5 == 0;
+				left++;
+			}
+		}
+		errors += !r2 || left != r2->ulCurEntries || left != n - n / 5 + (c == 0) * (n / 2 - n / 10);
+		errors += !r2 || !iHtDeleteEntry(r2, pxHtIFindEntry(r2, 1)) || pvHtIGetVal(r2, 1) != NULL;
+		if (r2)
+			vHtFreeHashTable(r2);
+	}
+	printresult(errors, "Deleting the iterator's entry in multimap, cuckoo, small, direct and cached tables");
+
+	// a clone removing entries leaves the original's alone
+	hashtab_t *r3 = pxHtNewHashTable ("remove-original", 0, 0, 256, 1001);
+	hashtab_t *r4 = NULL;
+
+	errors = !r3;
+	for (unsigned i = 0; r3 && i < 5000; i++)
+		iHtIAddVal(r3, i, (void *)(long)i);
+	errors += !r3 || !(r4 = pxHtClone("remove-clone", r3));
+	errors += !r4 || ulHtRemoveIf(r4, keymultiple, &seven, 0) != 715;
+	for (unsigned i = 0; r4 && i < 5000; i++) {
+		errors += pvHtIGetVal(r3, i) != (void *)(long)i;
+		errors += pvHtIGetVal(r4, i) != (i % 7 ? (void *)(long)i : NULL);
+	}
+	printresult(errors, "Removing by predicate from a clone");
+	if (r4)
+		vHtFreeHashTable(r4);
+	vHtFreeHashTable(r3);
+
+	// the same on several threads, in a big table with a direct-address
+	// range and a Bloom filter
+	hashtab_t *r5 = pxHtNewHashTableEx ("remove-parallel", 0, 0, 4096, 50001,
+										&(htConfig_t){ .ulDirectKeys = 1000, .xBloom = 1 });
+
+	errors = !r5;
+	for (unsigned i = 0; r5 && i < 200000; i++)
+		iHtIAddVal(r5, i, (void *)(long)i);
+	errors += !r5 || ulHtRemoveIf(r5, keymultiple, &five, 4) != 40000 || r5->ulCurEntries != 160000;
+	for (unsigned i = 0; r5 && i < 200000; i++)
+		errors += pvHtIGetVal(r5, i) != (i % 5 ? (void *)(long)i : NULL);
+	printresult(errors, "Removing by predicate on 4 threads");
+	vHtFreeHashTable(r5);
+
+// -----------------------------------------------------------------------
+	printf ("\nOrdered Index Tests\n");
+// -----------------------------------------------------------------------
+
+	// random adds and deletes, checked against a bitmap of the keys present
+	#define ORDERKEYS	100000
+	hashtab_t *o1 = pxHtNewHashTableEx ("ordered", 0, 0, 1024, 10007, &(htConfig_t){ .xOrdered = 1 });
+	static unsigned char present[ORDERKEYS];
+	unsigned seed = 12345, ocount = 0;
+
+	errors = !o1;
+	errors += o1 && iHtSAddVal(o1, "no strings", NULL);
+	for (unsigned i = 0; o1 && i < 300000; i++) {
+		unsigned k;
+
+		seed = seed * 1103515245 + 12345;
+		k = (seed >> 8) % ORDERKEYS;
+		if (i < 150000 ? seed % 4 != 0 : seed % 4 == 0) {
+			iHtIAddVal(o1, k, (void *)(long)k);
+			present[k] = 1;
+		} else {
+			iHtIDelete(o1, k);
+			present[k] = 0;
+		}
+	}
+	for (unsigned k = 0; k < ORDERKEYS; k++)
+		ocount += present[k];
+	if (o1) {
+		htRangeIterator_t oit;
+		unsigned n = 0, last = 0;
+		hashent_t *oe;
+
+		for (oe = pxHtIRangeFirst(&oit, o1, 0, ~0u); oe; oe = pxHtRangeNext(&oit), n++) {
+			errors += !present[oe->ulKey] || (n && oe->ulKey <= last) || oe->ulValue != oe->ulKey;
+			last = oe->ulKey;
+		}
+		errors += n != ocount || n != o1->ulCurEntries;
+		for (unsigned r = 0; r < 200; r++) {		// ranges, some empty
+			unsigned lo = r * 499, hi = lo + r * 7, expect = 0;
+
+			for (unsigned k = lo; k <= hi && k < ORDERKEYS; k++)
+				expect += present[k];
+			n = 0;
+			for (oe = pxHtIRangeFirst(&oit, o1, lo, hi); oe; oe = pxHtRangeNext(&oit), n++)
+				errors += oe->ulKey < lo || oe->ulKey > hi;
+			errors += n != expect;
+			for (oe = pxHtILowerBound(o1, lo); lo < ORDERKEYS && !present[lo]; lo++)
+				;
+			errors += lo < ORDERKEYS ? !oe || oe->ulKey != lo : oe != NULL;
+		}
+		for (n = 0; !present[n]; n++)
+			;
+		errors += !pxHtIMin(o1) || pxHtIMin(o1)->ulKey != n;
+		for (n = ORDERKEYS - 1; !present[n]; n--)
+			;
+		errors += !pxHtIMax(o1) || pxHtIMax(o1)->ulKey != n;
+	}
+	printresult(errors, "Ordered index through random adds and deletes");
+
+	// deleting what the range iterator returns, and adding ahead of it;
+	// then emptied, and used again
+	htRangeIterator_t oit2;
+	unsigned added = 0;
+
+	errors = !o1;
+	for (hashent_t *oe = o1 ? pxHtIRangeFirst(&oit2, o1, 1000, 60000) : NULL; oe; oe = pxHtRangeNext(&oit2)) {
+		if (oe->ulKey % 2)
+			errors += !iHtDeleteEntry(o1, oe);
+		if (oe->ulKey >= 30000 && !added++)
+			iHtIAddVal(o1, 50002, (void *)50002L);
+	}
+	for (unsigned k = 1000; o1 && k <= 60000; k++) {
+		if (k % 2 && present[k])
+			present[k] = 0;
+		errors += (pvHtIFindValPtr(o1, k) != NULL) != (present[k] || k == 50002);
+	}
+	if (o1) {
+		htRangeIterator_t oit3;
+
+		for (hashent_t *oe = pxHtIRangeFirst(&oit3, o1, 0, ~0u); oe; oe = pxHtRangeNext(&oit3))
+			errors += !iHtDeleteEntry(o1, oe);
+	}
+	errors += !o1 || o1->ulCurEntries != 0 || pxHtIMin(o1) || pxHtIMax(o1) || pxHtILowerBound(o1, 0);
+	for (unsigned k = 5; o1 && k > 0; k--)
+		iHtIAddVal(o1, k * 10, NULL);
+	errors += !o1 || pxHtIMin(o1)->ulKey != 10 || pxHtIMax(o1)->ulKey != 50 || pxHtILowerBound(o1, 11)->ulKey != 20;
+	printresult(errors, "Range iteration while deleting and adding");
+	vHtFreeHashTable(o1);
+
+	// a direct-address range, cache evictions and compaction moving entries
+	hashtab_t *o2 = pxHtNewHashTableEx ("ordered-direct", 0, 0, 256, 1001,
+										&(htConfig_t){ .xOrdered = 1, .ulDirectKeys = 500 });
+	hashtab_t *o3 = pxHtNewHashTableEx ("ordered-cache", 0, 1000, 256, 1001,
+										&(htConfig_t){ .xOrdered = 1, .xCache = 1 });
+
+	errors = !o2 || !o3;
+	for (unsigned i = 0; o2 && o3 && i < 5000; i++) {
+		iHtIAddVal(o2, i * 3, (void *)(long)i);
+		iHtIAddVal(o3, i, (void *)(long)i);
+	}
+	for (unsigned i = 0; o2 && i < 5000; i += 2)
+		iHtIDelete(o2, i * 3);
+	while (o2 && iHtCompact(o2, 100, NULL, NULL))
+		;
+	if (o2 && o3) {
+		htRangeIterator_t oit4;
+		unsigned n = 0;
+
+		for (hashent_t *oe = pxHtIRangeFirst(&oit4, o2, 0, ~0u); oe; oe = pxHtRangeNext(&oit4), n++)
+			errors += oe->ulKey != (2 * n + 1) * 3 || oe->ulValue != 2 * n + 1;
+		errors += n != 2500 || o2->pxExt->xStats.ulMoved == 0;
+		n = 0;
+		for (hashent_t *oe = pxHtIRangeFirst(&oit4, o3, 0, ~0u); oe; oe = pxHtRangeNext(&oit4), n++)
+			errors += oe->ulKey != 4000 + n;
+		errors += n != 1000 || pxHtIMin(o3)->ulKey != 4000;
+	}
+	printresult(errors, "Ordered index with direct keys, compaction and eviction");
+	vHtFreeHashTable(o2);
+	vHtFreeHashTable(o3);
 	return 0;
 }
 
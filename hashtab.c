@@ -4,8 +4,11 @@
  *  Copyright 2010,2022 TRIA Network Systems. See LICENSE file for details.
  */
 
+#define _GNU_SOURCE			// for clock_gettime, mmap flags and syscall
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
+#include <limits.h>
 
 #ifndef _LISTUTILS_H_
 #define dlList_t 	Link_t		// compatible libraries, different names...
@@ -20,12 +23,78 @@
 #define POSIX 1
 #ifdef POSIX // ----- POSIX ------
 #include <stdio.h>
+#include <time.h>
+#include <pthread.h>
 #include "hashtab.h"
 #include "rsrc.h"	// hash tables are allocated from a pool
 
+#define htTHREADS	1		// set operations can split their probes across threads
+
 #define DEBUGPRINTF(tag,format,x...)	printf("%s " format "\n",TAG,x)
 #define logPrintf(tag,format,x...)		printf("%s " format "\n",TAG,x)
 
+static inline unsigned htNOWMS (void)	// millisecond clock for cache expiry
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((unsigned)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000));
+}
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define htMPOL_BIND			2	// from linux/mempolicy.h
+#define htMPOL_INTERLEAVE	3
+
+// Map memory for an arena chunk.  Huge pages are tried first as explicitly
+// reserved ones (MAP_HUGETLB), then as transparent huge pages on a mapping
+// trimmed to huge page alignment.  NUMA policy is set before the pages are
+// first touched.  bytes must be a multiple of htHUGEPAGE.
+static void *prvMapChunk (size_t bytes, unsigned flags, unsigned long nodemask)
+{
+	char *p = MAP_FAILED;
+
+	if (flags & htARENA_HUGEPAGES)
+		p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p == MAP_FAILED) {
+		size_t extra = (flags & htARENA_HUGEPAGES) ? htHUGEPAGE : 0;
+		char *m = mmap(NULL, bytes + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		size_t lead;
+
+		if (m == MAP_FAILED)
+			return (NULL);
+		lead = extra ? (htHUGEPAGE - ((unsigned long)m & (htHUGEPAGE - 1))) & (htHUGEPAGE - 1) : 0;
+		if (lead)
+			munmap(m, lead);
+		if (extra - lead)
+			munmap(m + lead + bytes, extra - lead);
+		p = m + lead;
+#ifdef MADV_HUGEPAGE
+		if (flags & htARENA_HUGEPAGES)
+			(void) madvise(p, bytes, MADV_HUGEPAGE);	// just advice, may be ignored
+#endif
+	}
+	if (flags & (htARENA_NUMA_BIND | htARENA_NUMA_INTERLEAVE)) {
+		int mode = (flags & htARENA_NUMA_BIND) ? htMPOL_BIND : htMPOL_INTERLEAVE;
+
+		// if this fails, the pages just go wherever the default policy puts them
+		(void) syscall(SYS_mbind, p, bytes, mode, &nodemask, 8 * sizeof nodemask + 1, 0);
+	}
+	return (p);
+}
+static void prvUnmapChunk (void *p, size_t bytes)
+{
+	munmap(p, bytes);
+}
+#define htGETRANDOM(buf,len)	(syscall(SYS_getrandom, (buf), (len), 0) == (long)(len))
+#else
+#define prvMapChunk(bytes,flags,nodemask)	NULL
+#define prvUnmapChunk(p,bytes)
+#define htGETRANDOM(buf,len)	0		// seeds come from the clock instead
+#endif // __linux__
+
 #else // ---- FreeRTOS -----
 #include "portability/port.h"
 #include "Common/hashtab.h"
@@ -35,6 +104,11 @@
 #define free(res)	vRsMemFree(res)
 #define DEBUGPRINTF			LOGI
 #define logPrintf			LOGI
+#define htNOWMS()			((unsigned)(xTaskGetTickCount() * portTICK_PERIOD_MS))
+#define prvMapChunk(bytes,flags,nodemask)	NULL	// no huge pages or NUMA here
+#define prvUnmapChunk(p,bytes)
+#include "esp_random.h"
+#define htGETRANDOM(buf,len)	(esp_fill_random((buf), (len)), 1)
 
 #endif // POSIX
 
@@ -44,283 +118,3744 @@
 
 static const char* TAG = "[hashtab]"; // labels log message origin
 
-// allocate and add more entries to freelist, if allowed and if malloc succeeds
-static int prvMorefree(hashtab_t *tab, unsigned num2add)
+// Default allocator for table memory, used unless the table was given its own
+static void *prvDefaultAlloc (size_t size, void *ctx)
 {
-	int i;
-	hashent_t *e;
-	unsigned size = sizeof(hashent_t);
-	
-	size += sizeof (size_t) - (size & (sizeof (size_t) - 1));
+	return (malloc(size));
+}
+static void prvDefaultFree (void *ptr, size_t size, void *ctx)
+{
+	free(ptr);
+}
+#define htALLOC(table,size)			((table)->pxAlloc((size), (table)->pvAllocCtx))
+#define htFREE(table,ptr,size)		((table)->pxFree((ptr), (size), (table)->pvAllocCtx))
+
+// Tables using no optional features share this, and never write to it; a
+// table is given its own htExt_t before anything in it has to change
+static const htExt_t xNoExt;
+#define htNOEXT			((htExt_t *)&xNoExt)
+
+static void prvInitExt (htExt_t *ext)
+{
+	*ext = xNoExt;
+	LLINKSINIT(&ext->xClockRing);
+	ext->pxClockHand = &ext->xClockRing;
+}
+
+// Give back the table itself, and its htExt_t if it has its own
+static void prvFreeTable (hashtab_t *table)
+{
+	if (table->pxExt != htNOEXT)
+		htFREE(table, table->pxExt, sizeof (htExt_t));
+	vRsrcFree(table);
+}
+
+// Give a table still sharing xNoExt its own, from its allocator.  0 if
+// there's no memory.
+static int prvOwnExt (hashtab_t *table)
+{
+	htExt_t *ext;
+
+	if (table->pxExt != htNOEXT)
+		return (1);
+	if (!(ext = htALLOC(table, sizeof (htExt_t))))
+		return (0);
+	prvInitExt(ext);
+	table->pxExt = ext;
+	return (1);
+}
+
+// Blocks of entries start with this header, so they can be found and freed.
+// It's padded so the entries after it keep htMAX_VALALIGN alignment.
+typedef struct _htSlab {
+	struct _htSlab *pxNext;	// all the blocks of a table
+	size_t ulBytes;			// size of this block, including the header
+} htSlab_t;
+#define htSLABHDR	((sizeof (htSlab_t) + htMAX_VALALIGN - 1) & ~(htMAX_VALALIGN - 1))
+
+// Once a table has been cloned, its buckets are reached through a directory
+// of pages of htPAGEBUCKETS, each of which may be in several tables' directories
+#define htPAGEBUCKETS	256
+#define htNPAGES(table)	(((table)->ulBucketCount + htPAGEBUCKETS - 1) / htPAGEBUCKETS)
+
+typedef struct _htPage {
+	unsigned ulRefs;		// tables with this page in their directory
+	unsigned xOwnMem:1;		// the buckets follow this header, and go with it
+	dlList_t *pxBuckets;
+} htPage_t;
+
+// Memory a table shares with its clones: the blocks of entries it had when
+// it was cloned, and the first time, its bucket array and the pages made
+// from it.  Freed with the last table using it.
+typedef struct _htShared {
+	unsigned ulRefs;
+	htSlab_t *pxSlabs;
+	dlList_t *pxBuckets;	// original bucket array, or NULL
+	size_t ulBucketBytes;
+	htPage_t *pxPages;		// pages describing it
+	struct _htShared *pxOlder;	// shared at earlier clones
+} htShared_t;
+
+// Page reference counts, changed by tables that may be in different threads
+#ifdef __GNUC__
+#define htREFS(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define htREFINC(p)		((void) __atomic_add_fetch((p), 1, __ATOMIC_RELAXED))
+#define htREFDEC(p)		__atomic_sub_fetch((p), 1, __ATOMIC_ACQ_REL)
+#else
+#define htREFS(p)		(*(p))
+#define htREFINC(p)		((void) ++*(p))
+#define htREFDEC(p)		(--*(p))
+#endif
+
+static inline dlList_t *prvBucket (hashtab_t *table, unsigned b)
+{
+	if (table->pxExt->ppxPages)
+		return (&table->pxExt->ppxPages[b / htPAGEBUCKETS]->pxBuckets[b % htPAGEBUCKETS]);
+	return (&table->pxBuckets[b]);
+}
+
+// Direct-address tables: entry i of the array is for key ulDirectBase + i
+#define htDIRENT(table,i)	((hashent_t *)((table)->pxExt->pcDirect + (size_t)(i) * (table)->ulEntrySize))
+#define htDIRBIT(table,i)	((table)->pxExt->pxDirectBits[(i) >> 6] & (1ULL << ((i) & 63)))
+
+static inline hashent_t *prvDirectFind (hashtab_t *table, unsigned key)
+{
+	unsigned i = key - table->pxExt->ulDirectBase;
+
+	return (htDIRBIT(table, i) ? htDIRENT(table, i) : NULL);
+}
+static inline int prvIsDirect (hashtab_t *table, hashent_t *e)
+{
+	return (table->pxExt->pcDirect
+			&& (size_t)((char *)e - table->pxExt->pcDirect) < (size_t)table->pxExt->ulDirectCount * table->ulEntrySize);
+}
+
+// Cache tables keep this in front of each entry, so entries can be found
+// from the CLOCK ring and the ring position from the entry.
+typedef struct {
+	Link_t xRing;			// links all entries in the table in CLOCK order
+	unsigned ulExpires;		// htNOWMS() time to expire, 0 if never
+	unsigned xReferenced:1;	// looked up since the CLOCK hand last passed
+} htCacheMeta_t;
+
+#define htMETA(table,entry)	((htCacheMeta_t *)((char *)(entry) - (table)->ulEntryOffset))
+#define htMETAENTRY(table,meta)	((hashent_t *)((char *)(meta) + (table)->ulEntryOffset))
+
+// allocate a block of entries and add them to the freelist
+static int prvAddSlab(hashtab_t *tab, size_t num2add)
+{
+	size_t i;
+	char *slot;
+	htSlab_t *slab;
+	unsigned size = tab->ulEntrySize;
+	size_t bytes = htSLABHDR + (size_t)size * num2add;
 	
-	// check if we're allowed to add more, and if so, can acquire space
-	if ((tab->ulMaxEntries && tab->ulCurEntries + num2add > tab->ulMaxEntries)
-		 || !(e = (hashent_t *) malloc(size * num2add))) {
+	if (num2add == 0 || !(slab = (htSlab_t *) htALLOC(tab, bytes))) {
 		return (0);
 	}
-	for (i = 0; i < num2add; i++) {
+	slab->pxNext = tab->pxSlabs;
+	slab->ulBytes = bytes;
+	tab->pxSlabs = slab;
+	tab->ulSlabBytes += bytes;
+	slot = (char *)slab + htSLABHDR + (size_t)size * num2add;
+	for (i = 0; i < num2add; i++) {		// from the end, so they're handed out in order
+		hashent_t *e = (hashent_t *)((slot -= size) + tab->ulEntryOffset);
+
 		e->pxFreelist = tab->pxFreelist; // put entry on free list
 		tab->pxFreelist = e;
-		void *alignit = e; alignit += size; e = alignit; // nuts
 	}
-	return (tab->ulAllocSize);
+	return (num2add);
+}
+
+// allocate and add more entries to freelist, if allowed and if malloc succeeds
+static int prvMorefree(hashtab_t *tab, size_t num2add)
+{
+	// check if we're allowed to add more (only up to the cap), and if so, can acquire space
+	if (tab->ulMaxEntries && tab->ulCurEntries + num2add > tab->ulMaxEntries) {
+		num2add = tab->ulMaxEntries > tab->ulCurEntries ? tab->ulMaxEntries - tab->ulCurEntries : 0;
+	}
+	return (prvAddSlab(tab, num2add));
 }
 
-// Get a free entry from the freelist of a table to add to the table
-static hashent_t *prvNewhashent(hashtab_t *table)
+static int prvEvict (hashtab_t *table, hashent_t *keep);
+
+// Get a free entry from the freelist of a table to add to the table.
+// NULL if the table is at its cap (and nothing can be evicted) or out of memory.
+static hashent_t *prvNewhashent(hashtab_t *table, hashent_t *keep)
 {
 	hashent_t *e = table->pxFreelist;
 	
-	if (e) {
+	// (a compaction pass may leave more free entries than the cap allows)
+	if (e && (!table->ulMaxEntries || table->ulCurEntries < table->ulMaxEntries)) {
 		table->pxFreelist = (hashent_t *)e->pxFreelist;
 	} else {
-		if (prvMorefree(table, table->ulAllocSize))
-			return (prvNewhashent(table));
+		if (prvMorefree(table, table->ulAllocSize)) {
+			if (table->ulAllocSize < table->ulAllocMax)	// growing geometrically
+				table->ulAllocSize = table->ulAllocSize > table->ulAllocMax / 2
+									 ? table->ulAllocMax : 2 * table->ulAllocSize;
+			return (prvNewhashent(table, keep));
+		}
+		if (table->xCache && prvEvict(table, keep))
+			return (prvNewhashent(table, keep));
+		return (NULL);
 	}
 	table->ulCurEntries++;
 	LLINKSINIT((dlList_t *)e);
+	if (table->xCache) {
+		htCacheMeta_t *m = htMETA(table, e);
+		dlList_t *hand = table->pxExt->pxClockHand;
+
+		m->xReferenced = 0;
+		m->ulExpires = 0;
+		lInsert(hand->left, &m->xRing);	// just behind the hand, the last to be looked at
+	}
 	return(e);
 }
+static inline int prvOwnsKey (hashtab_t *table, hashent_t *e);
+static inline void prvReleaseKey (hashtab_t *table, hashent_t *entry)
+{
+	if (prvOwnsKey(table, entry)) {
+		size_t len = strlen(entry->pcName) + 1;
+
+		htFREE(table, (void *)entry->pcName, len);
+		table->pxExt->ulKeyBytes -= len;
+	}
+}
+static int prvInOldSlab (hashtab_t *table, hashent_t *e);
 static void prvFreehashent (hashtab_t *table, hashent_t *entry)
 {
+	prvReleaseKey(table, entry);
+	if (table->xCache) {
+		htCacheMeta_t *m = htMETA(table, entry);
+
+		if (table->pxExt->pxClockHand == &m->xRing)
+			table->pxExt->pxClockHand = m->xRing.right;
+		lDelete(&m->xRing);
+	}
+	table->ulCurEntries--;
+	if (table->pxExt->pxCompact && prvInOldSlab(table, entry))
+		return;			// going with its block, see iHtCompact
 	entry->pxFreelist = table->pxFreelist;
 	table->pxFreelist = entry;
-	table->ulCurEntries--;
 }
 
-// Hashing functions.  Feel free to improve this, it's ad-hoc
-static inline unsigned prvHashedName(const char *name)
+static void prvCkRemove (hashtab_t *table, hashent_t *e);
+static void prvSmallRemove (hashtab_t *table, hashent_t *e);
+static void prvBloomRebuild (hashtab_t *table);
+static void prvHotMoved (hashtab_t *table, hashent_t *e, hashent_t *to);
+static void prvHotFlush (hashtab_t *table);
+static void prvOrderDelete (hashtab_t *table, unsigned key);
+
+// Tell the table's change callback, if it has one, about a change to an entry
+#define htCHANGED(table,e,deleted)	\
+	do { if ((table)->pxExt->pxChangeCallback) (table)->pxExt->pxChangeCallback((table), (e), (deleted), (table)->pxExt->pvChangeCtx); } while (0)
+
+// Take an entry out of the table and free it
+static void prvRemoveEntry (hashtab_t *table, hashent_t *e)
 {
-	unsigned hash = 0;
-	
-	for (; *name; name++)
-		hash = (hash >> 16) + ((hash << 5) ^ (*name));
-	return (hash);
+	htExt_t *ext = table->pxExt;
+
+	htCHANGED(table, e, 1);
+	if (ext->pxOrder)
+		prvOrderDelete(table, e->ulKey);
+	if (prvIsDirect(table, e)) {
+		unsigned i = e->ulKey - ext->ulDirectBase;
+
+		ext->pxDirectBits[i >> 6] &= ~(1ULL << (i & 63));
+		ext->ulDirectUsed--;
+		table->ulCurEntries--;
+		return;
+	}
+	if (table->xCuckoo) {
+		prvReleaseKey(table, e);
+		prvCkRemove(table, e);
+		return;
+	}
+	if (table->pxSmall) {
+		prvReleaseKey(table, e);
+		prvSmallRemove(table, e);
+		return;
+	}
+	if (ext->pxHot)
+		prvHotMoved(table, e, NULL);
+	lDelete ((dlList_t *) e);		// unlink it
+	prvFreehashent (table, e);		// put entry on free list
+	if (ext->pxBloom && ++ext->ulBloomDeletes > table->ulCurEntries)
+		prvBloomRebuild(table);		// too many stale bits
 }
-static inline unsigned prvHashedInt (unsigned key)
+
+// Remove an entry the table has decided to drop, telling its owner first
+static void prvDropEntry (hashtab_t *table, hashent_t *e)
 {
-	return (277 * key + key + 12345);
+	if (table->pxExt->pxEvictCallback)
+		table->pxExt->pxEvictCallback(table, e, table->pxExt->pvEvictCtx);
+	prvRemoveEntry(table, e);
 }
 
-// Hash table lookup common routine.  Used to find the correct listhead, and if
-// the entry is present, the correct hash entry.  Returns non-zero if the entry
-// was found.  The listhead arg is where we return the list it should have been in.
-// if name is NULL, the key is used to determine a match. If not, strcmp is used
-static int prvHashLookupCom (hashtab_t *table, unsigned key, const char *name,
-				   dlList_t **listheadp, hashent_t **entry)
+static inline int prvExpired (hashtab_t *table, hashent_t *e)
 {
-	dlList_t *listhead;		// correct list for this name
-	hashent_t *e;			// the roamer through the list off the head
-	int bucketno = (name ? prvHashedName (name) : prvHashedInt(key) ) % table->ulBucketCount;
-	
-	*listheadp = listhead = &table->pxBuckets[bucketno];
+	unsigned expires = htMETA(table, e)->ulExpires;
+
+	return (expires && (int)(htNOWMS() - expires) >= 0);
+}
+
+// CLOCK replacement: sweep the ring from the hand, giving each referenced entry
+// a second chance by clearing its bit, and evict the first unreferenced (or
+// expired) one.  keep is an entry the caller is still using.  Returns non-zero
+// if an entry was freed.
+static int prvEvict (hashtab_t *table, hashent_t *keep)
+{
+	htExt_t *ext = table->pxExt;
+	dlList_t *ring = &ext->xClockRing;
+	dlList_t *hand = ext->pxClockHand;
 	
-	e = (hashent_t *)listhead->right;
-	for (; (dlList_t *)e != listhead; e = (hashent_t *)e->xLinks.right) {
-		if (!name && key != e->ulKey)
+	for (size_t n = 0; n <= 2 * table->ulCurEntries; n++, hand = hand->right) {
+		htCacheMeta_t *m;
+		hashent_t *e;
+		
+		if (hand == ring)
 			continue;
-		if (name && strcmp(name, e->pcName) != 0)
+		m = listCONTAINER(hand, htCacheMeta_t, xRing);
+		e = htMETAENTRY(table, m);
+		if (e == keep || (m->xReferenced && !prvExpired(table, e))) {
+			m->xReferenced = 0;
 			continue;
-		*entry = e;
+		}
+		if (prvExpired(table, e))
+			ext->xStats.ulExpired++;
+		else
+			ext->xStats.ulEvictions++;
+		ext->pxClockHand = hand;
+		prvDropEntry(table, e);		// moves the hand on past e
 		return (1);
 	}
-	*entry = NULL;
 	return (0);
 }
-hashent_t * pxHtIFindEntry (hashtab_t *table, unsigned key)
-{
-	dlList_t *listhead;
-	hashent_t *e;
-	
-	if (prvHashLookupCom(table, key, NULL, &listhead, &e))
-		return (e);
-	return (NULL);
-}
-hashent_t * pxHtSFindEntry (hashtab_t *table, const char *name)
-{
-	dlList_t *listhead;
-	hashent_t *e;
-	
-	if (prvHashLookupCom(table, 0, name, &listhead, &e))
-		return (e);
-	return (NULL);
-}
 
-// Hash lookup general lookup routines.  Pass a name, get back a value, or not.
-void *pvHtSGetVal (hashtab_t *table, const char *name)
+// Entry was just set: restart its time to live
+static inline void prvCacheSet (hashtab_t *table, hashent_t *e)
 {
-	dlList_t *listhead;		// dumping ground - don't need this
-	hashent_t *e;
-	
-	(void) prvHashLookupCom(table, 0, name, &listhead, &e);
-	return (e ? e->pxValue : NULL);
+	if (table->pxExt->ulTtl)
+		vHtESetTtl(table, e, table->pxExt->ulTtl);
 }
-void *pvHtIGetVal (hashtab_t *table, unsigned key)
+void vHtESetTtl (hashtab_t *table, hashent_t *entry, unsigned ttl)
 {
-	dlList_t *listhead;		// dumping ground - don't need this
-	hashent_t *e;
-	
-	(void) prvHashLookupCom(table, key, NULL, &listhead, &e);
-	return (e ? e->pxValue : NULL);
+	if (table->xCache)
+		htMETA(table, entry)->ulExpires = ttl ? (htNOWMS() + ttl) | 1 : 0;
 }
 
-// Finds an entry, selectively rewrites its value if found, adds it if not
-static int prvHtISAddVal (hashtab_t *table, int overwrite, unsigned key, const char *name, void *value)
+// Count a lookup of a cache table, and mark the entry as recently used
+static inline void prvCacheLookup (hashtab_t *table, hashent_t *e)
 {
-	dlList_t *listhead;
-	hashent_t *e;
-	
-	if (prvHashLookupCom(table, key, name, &listhead, &e)) {
-		if (overwrite == htOVERWRITE) {
-			e->pxValue = value;
-			return (1);
-		}
-		else
-			return (0);					//   already there, we don't touch it
+	table->pxExt->xStats.ulLookups++;
+	if (e) {
+		table->pxExt->xStats.ulHits++;
+		htMETA(table, e)->xReferenced = 1;
 	}
-	e = prvNewhashent(table);				// new entry, create and fill it
-	if (name)
-		e->pcName = name;
-	else
-		e->ulKey = key;
-	e->pxValue = value;
-//	DEBUGPRINTF(TAG,"entry %p, head %p (%p, %p): ", e, listhead, listhead->pxNext, listhead->pxPrev);
-	lInsert(listhead, (dlList_t *) e);
-//	DEBUGPRINTF(TAG,"now: entry (%p, %p), head (%p, %p)", ((dlList_t *)e)->pxNext, ((dlList_t *)e)->pxPrev,listhead->pxNext, listhead->pxPrev);
-	return (1);
-}
-int iHtIAddVal (hashtab_t *table, unsigned key, void *value)
-{
-	return prvHtISAddVal (table, htNOOVERWRITE, key, NULL, value);
 }
-int iHtSAddVal (hashtab_t *table, const char *name, void *value)
+
+// Hashing functions.  Feel free to improve this, it's ad-hoc
+static inline unsigned prvHashedName(const char *name)
 {
-	return prvHtISAddVal(table, htNOOVERWRITE, 0, name, value);
+	unsigned hash = 0;
+	
+	for (; *name; name++)
+		hash = (hash >> 16) + ((hash << 5) ^ (*name));
+	return (hash);
 }
-int iHtISetVal (hashtab_t *table, unsigned key, void *value)
+static inline unsigned prvHashedInt (unsigned key)
 {
-	return prvHtISAddVal(table, htOVERWRITE, key, NULL, value);
+	return (277 * key + key + 12345);
 }
-int iHtSSetVal (hashtab_t *table, const char *name, void *value)
+
+// Spread a hash over 64 bits (splitmix64's finalizer), for uses that need
+// more, and better mixed, bits than bucket selection does
+static inline uint64_t prvMixHash64 (unsigned h)
 {
-	return prvHtISAddVal(table, htOVERWRITE, 0, name, value);
+	uint64_t x = h + 0x9e3779b97f4a7c15ULL;
+
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return (x ^ (x >> 31));
 }
 
-// delete an entry from the hash table, if found. returns # freed, 0 or 1
-int iHtISDelete (hashtab_t *table, unsigned key, const char *name)
+// Keyed tables hash with SipHash-1-3, so that without the table's seed
+// nobody can choose keys that collide.  Folded to 32 bits like the others.
+#define htROTL(x,b)		(((x) << (b)) | ((x) >> (64 - (b))))
+#define htSIPROUND(v0,v1,v2,v3)	do {										\
+		v0 += v1; v1 = htROTL(v1, 13); v1 ^= v0; v0 = htROTL(v0, 32);	\
+		v2 += v3; v3 = htROTL(v3, 16); v3 ^= v2;						\
+		v0 += v3; v3 = htROTL(v3, 21); v3 ^= v0;						\
+		v2 += v1; v1 = htROTL(v1, 17); v1 ^= v2; v2 = htROTL(v2, 32);	\
+	} while (0)
+
+static unsigned prvSipHash (const uint64_t *seed, const void *data, size_t len)
 {
-	dlList_t *listhead;
-	hashent_t *e;
+	uint64_t v0 = seed[0] ^ 0x736f6d6570736575ULL, v1 = seed[1] ^ 0x646f72616e646f6dULL;
+	uint64_t v2 = seed[0] ^ 0x6c7967656e657261ULL, v3 = seed[1] ^ 0x7465646279746573ULL;
+	uint64_t m, last = (uint64_t)len << 56;
+	const char *p = data;
 
-	if (prvHashLookupCom(table, key, name, &listhead, &e)) {
-		lDelete ((dlList_t *) e);// unlink it
-		prvFreehashent (table, e);			// put entry on free list
-		return (1);
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&m, p, 8);
+		v3 ^= m;
+		htSIPROUND(v0, v1, v2, v3);
+		v0 ^= m;
 	}
-	return (0);
+	m = 0;
+	memcpy(&m, p, len);
+	last |= m;
+	v3 ^= last;
+	htSIPROUND(v0, v1, v2, v3);
+	v0 ^= last;
+	v2 ^= 0xff;
+	htSIPROUND(v0, v1, v2, v3);
+	htSIPROUND(v0, v1, v2, v3);
+	htSIPROUND(v0, v1, v2, v3);
+	m = v0 ^ v1 ^ v2 ^ v3;
+	return ((unsigned)(m ^ (m >> 32)));
 }
-int iHtSDelete (hashtab_t *table, const char *name)
+static inline unsigned prvKeyedHash (const uint64_t *seed, unsigned key, const char *name)
 {
-	return (iHtISDelete (table, 0, name));
+	return (name ? prvSipHash(seed, name, strlen(name)) : prvSipHash(seed, &key, sizeof key));
 }
-int iHtIDelete (hashtab_t *table, unsigned key)
+
+// A new seed for a keyed table, from the system's random numbers if there
+// are any, else from whatever changes from table to table and run to run
+static void prvNewSeed (hashtab_t *table, uint64_t *seed)
 {
-	return (iHtISDelete (table, key, NULL));
+	static unsigned count;
+
+	if (htGETRANDOM(seed, 2 * sizeof (uint64_t)))
+		return;
+	seed[0] = prvMixHash64(htNOWMS() ^ (unsigned)(uintptr_t)table) ^ (uintptr_t)&count;
+	seed[1] = prvMixHash64(++count ^ (unsigned)seed[0]) ^ (uintptr_t)seed;
 }
-void vHtEDelete (hashent_t *entry)
+
+// **************************************************
+// Inline keys.  Tables created with ulInlineKeys keep string keys shorter
+// than that many bytes (16 or 24) in the entry itself, just after the
+// hashent_t, zero padded, with pcName pointing at them.  A lookup loads the
+// key it's given into words once, and then compares each entry with two or
+// three word compares, without following pcName.  Longer keys are copied out
+// of line as with xCopyKeys, but their first bytes are kept inline as well;
+// having no terminator there, they can't match a short key, and only need
+// strcmp on the rest.  The hash for these tables also works a word at a time.
+// ***************************************************
+
+#define htINLINEKEY(e)	((uint64_t *)((char *)(e) + sizeof (hashent_t)))
+
+// Load the inline part of a key into words, as an entry would hold it, and
+// return the key's length.  Where the byte order allows, the key is read a
+// word at a time, finding the terminator in each word with the usual bit
+// trick.  That reads past the end of the string, so only words which can't
+// cross into the next page are read whole; nothing else notices.
+#define htPAGEBYTES		4096
+#define htLOWBYTES		0x0101010101010101ULL
+#define htHIGHBITS		0x8080808080808080ULL
+
+typedef uint64_t __attribute__((may_alias, aligned(1))) htUnalignedWord_t;
+
+__attribute__((no_sanitize_address))
+static inline size_t prvKeyWords (hashtab_t *table, const char *name, uint64_t *words)
 {
-	lDelete ((dlList_t *)entry);
+	char *w = (char *)words;
+	size_t len;
+
+	words[0] = words[1] = words[2] = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	for (unsigned i = 0; i < table->ulKeyInline / 8; i++) {
+		const char *p = name + 8 * i;
+		uint64_t v, zeros;
+
+		if (((uintptr_t)p & (htPAGEBYTES - 1)) > htPAGEBYTES - 8)
+			break;				// finish off a byte at a time
+		v = *(const htUnalignedWord_t *)p;
+		if ((zeros = (v - htLOWBYTES) & ~v & htHIGHBITS)) {
+			unsigned bytes = __builtin_ctzll(zeros) / 8;
+
+			words[i] = v & ((1ULL << (8 * bytes)) - 1);
+			return (8 * i + bytes);
+		}
+		words[i] = v;
+	}
+#endif
+	for (len = 0; len < table->ulKeyInline && name[len]; len++)
+		w[len] = name[len];
+	if (len == table->ulKeyInline)
+		len += strlen(name + len);
+	return (len);
 }
 
-static void prvNextentry (htIterator_t *it) {
-	// step through the buckets, and for each, step through the chain
-	while (it->ulBucket < it->pxTable->ulBucketCount) {
-		hashent_t *curbucket = (hashent_t *)&it->pxTable->pxBuckets[it->ulBucket];
-		
-		if((it->pxNext = (hashent_t *)((dlList_t *)it->pxNext)->right) != curbucket) {
-			return;
+// Hash a key loaded by prvKeyWords: the inline words, then whatever of a
+// long key is past them, also a word at a time
+static inline unsigned prvHashedWords (hashtab_t *table, const uint64_t *words,
+									   const char *name, size_t len)
+{
+	uint64_t h = len, w;
+
+	for (unsigned i = 0; i < table->ulKeyInline / 8; i++) {
+		h = (h ^ words[i]) * 0x9e3779b97f4a7c15ULL;
+		h ^= h >> 29;
+	}
+	if (len >= table->ulKeyInline) {
+		name += table->ulKeyInline;
+		for (len -= table->ulKeyInline; len; len -= len < 8 ? len : 8, name += 8) {
+			w = 0;
+			memcpy(&w, name, len < 8 ? len : 8);
+			h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+			h ^= h >> 29;
 		}
-		if (++it->ulBucket < it->pxTable->ulBucketCount)
-			it->pxNext = (hashent_t *)&it->pxTable->pxBuckets[it->ulBucket];
 	}
-	it->pxNext = NULL;
+	return ((unsigned)(h ^ (h >> 32)));
 }
-void vHtInitIterator (htIterator_t *it, hashtab_t *table)
+
+static inline int prvInlineKeyMatch (hashtab_t *table, hashent_t *e, const uint64_t *words,
+									 const char *name, size_t len)
 {
-	it->pxTable = table;
-	it->ulBucket = 0;
-	it->pxNext = (hashent_t *)&table->pxBuckets[0];
-	// find the next/first entry, if there are any
-	prvNextentry(it);
+	const uint64_t *k = htINLINEKEY(e);
+	uint64_t diff = (k[0] ^ words[0]) | (k[1] ^ words[1]);
+
+	if (table->ulKeyInline > 16)
+		diff |= k[2] ^ words[2];
+	if (diff)
+		return (0);
+	return (len < table->ulKeyInline
+			|| strcmp(name + table->ulKeyInline, e->pcName + table->ulKeyInline) == 0);
 }
-hashent_t *pxHtIteratorNext (htIterator_t *it)
+
+// True if the table allocated this entry's key, and has to free it
+static inline int prvOwnsKey (hashtab_t *table, hashent_t *e)
 {
-	hashent_t *retval = it->pxNext;
-	
-	prvNextentry(it);
-	return (retval);
+	if (table->ulKeyInline)
+		return (e->pcName != (char *)htINLINEKEY(e));
+	return (table->xCopyKeys && table->xHasString);
+}
+
+static inline unsigned prvHashedKey (hashtab_t *table, unsigned key, const char *name)
+{
+	if (table->xKeyed)
+		return (prvKeyedHash(table->pxExt->aulSeed, key, name));
+	if (!name)
+		return (prvHashedInt (key));
+	if (table->ulKeyInline) {
+		uint64_t words[3];
+		size_t len = prvKeyWords(table, name, words);
+
+		return (prvHashedWords(table, words, name, len));
+	}
+	return (prvHashedName (name));
 }
 
 // **************************************************
-// We are making hash tables into a rsrc resource.  We can in the future,
-// once we keep track of hash table mallocs, make it possible to free them
-// up.  For now, we create a pool of hash tables -- once -- and then allocate
-// new ones from that pool when they are created.  Hash entry blocks could also
-// be allocated using rsrc, which might make sense, but we don't for now.
+// Bloom filters.  A table may keep a blocked Bloom filter of the hashes of
+// its keys, checked before walking a chain, so most lookups of absent keys
+// cost a hash and one cache line instead of a chain walk.  Each key sets
+// htBLOOM_PROBES bits, all within one 64-byte block.  Bits can't be cleared
+// when keys are deleted, so the filter is rebuilt from the table once as
+// many deletes have happened as there are entries, and it's rebuilt larger
+// if the table grows to twice the keys it was sized for.
 // ***************************************************
 
-rsrcPoolP_t xHashTablePool;	// allocated once, when first needed
+#define htBLOOM_BITSPERKEY	10		// about 1% false positives
+#define htBLOOM_PROBES		4
+#define htBLOOM_BLOCK		64		// bytes per block, one cache line
 
-// The "long" print routine for hash table resources calls this
-static void prvPrintStatWrapper (rsrcPoolP_t pool, void *body)
+static inline uint64_t *prvBloomBlock (hashtab_t *table, uint64_t m)
 {
-	vHtPrintStats ((hashtab_t *)body);
+	return (table->pxExt->pxBloom + ((m >> 36) % table->pxExt->ulBloomBlocks) * (htBLOOM_BLOCK / 8));
 }
-void static inline initHashtabPool ()
+static inline int prvBloomMayHave (hashtab_t *table, unsigned h)
 {
-	if (xHashTablePool)
-		return;
+	uint64_t m = prvMixHash64(h);
+	uint64_t *block = prvBloomBlock(table, m);
+
+	for (int i = 0; i < htBLOOM_PROBES; i++, m >>= 9) {
+		if (!(block[(m & 511) >> 6] & (1ULL << (m & 63))))
+			return (0);
+	}
+	return (1);
+}
+static inline void prvBloomAdd (hashtab_t *table, unsigned h)
+{
+	uint64_t m = prvMixHash64(h);
+	uint64_t *block = prvBloomBlock(table, m);
+
+	for (int i = 0; i < htBLOOM_PROBES; i++, m >>= 9)
+		block[(m & 511) >> 6] |= 1ULL << (m & 63);
+}
+
+// Size (or resize) the filter for keys entries.  The blocks are aligned to
+// cache lines, so the allocation has room to spare.
+static int prvBloomAlloc (hashtab_t *table, size_t keys)
+{
+	htExt_t *ext = table->pxExt;
+	unsigned blocks = (keys * htBLOOM_BITSPERKEY + 8 * htBLOOM_BLOCK - 1) / (8 * htBLOOM_BLOCK);
+	size_t bytes = (size_t)(blocks ? blocks : 1) * htBLOOM_BLOCK + htBLOOM_BLOCK;
+	char *mem = htALLOC(table, bytes);
+
+	if (!mem)
+		return (0);
+	if (ext->pvBloomMem)
+		htFREE(table, ext->pvBloomMem, ext->ulBloomBytes);
+	ext->pvBloomMem = mem;
+	ext->ulBloomBytes = bytes;
+	ext->ulBloomBlocks = blocks ? blocks : 1;
+	ext->ulBloomKeys = keys;
+	ext->pxBloom = (uint64_t *)(((uintptr_t)mem + htBLOOM_BLOCK - 1) & ~(uintptr_t)(htBLOOM_BLOCK - 1));
+	memset(ext->pxBloom, 0, (size_t)ext->ulBloomBlocks * htBLOOM_BLOCK);
+	return (1);
+}
+
+// Start again from the keys actually in the table
+static void prvBloomRebuild (hashtab_t *table)
+{
+	htExt_t *ext = table->pxExt;
+
+	if (table->xHasString && table->xHasInt) {
+		// can't tell which entries have which kind of key, so can't hash
+		// them again; do without
+		htFREE(table, ext->pvBloomMem, ext->ulBloomBytes);
+		ext->pvBloomMem = NULL;
+		ext->pxBloom = NULL;
+		ext->ulBloomBytes = 0;
+		return;
+	}
+	if (table->ulCurEntries > 2 * ext->ulBloomKeys)
+		(void) prvBloomAlloc(table, 2 * table->ulCurEntries);	// on failure the old one still works, just less well
+	else
+		memset(ext->pxBloom, 0, (size_t)ext->ulBloomBlocks * htBLOOM_BLOCK);
+	for (unsigned b = 0; b < table->ulBucketCount; b++) {
+		dlList_t *listhead = prvBucket(table, b);
+
+		for (dlList_t *l = listhead->right; l != listhead; l = l->right)
+			prvBloomAdd(table, prvHashedKey(table, ((hashent_t *)l)->ulKey,
+											table->xHasString ? ((hashent_t *)l)->pcName : NULL));
+	}
+	ext->ulBloomDeletes = 0;
+	ext->xStats.ulBloomRebuilds++;
+}
+
+static inline int prvKeyMatch (hashent_t *e, unsigned key, const char *name)
+{
+	return (name ? strcmp(name, e->pcName) == 0 : key == e->ulKey);
+}
+
+// **************************************************
+// Cuckoo tables.  Every key has two candidate buckets, chosen by two hashes,
+// each bucket holding htCK_WAYS entries, so a lookup reads at most two buckets
+// (plus the small stash, only when it's in use).  An insert that finds both
+// buckets full moves an entry out to its other bucket, which may move another,
+// and so on.  If that goes on too long, the last entry moved goes in the stash.
+// When the stash is full the moves are undone, and the table is grown and
+// rehashed if it is at least half full (if not, the insert fails).  Entries are
+// kept in the buckets themselves, not linked, so entry pointers only stay
+// valid until the next add or delete.  The xHashes member of each entry
+// holds its two hashes, so entries can be moved without rehashing keys.
+// ***************************************************
+
+#define htCK_WAYS		4		// entries per bucket
+#define htCK_STASH		8		// entries that may overflow the buckets
+#define htCK_MAXKICKS	500		// entries moved by one insert before using the stash
+#define htCKHDR			htMAX_VALALIGN	// bucket header: tags, padded to keep entries aligned
+
+typedef struct _htCuckoo {
+	char *pcBuckets;		// each bucket is htCK_WAYS tags, then htCK_WAYS entries
+	char *pcStash;			// entries that didn't fit, the first ulStashCount in use
+	char *pcScratch;		// room for the three entries an insert juggles
+	unsigned *pulPath;		// the ways an insert moved entries out of, to undo it
+	unsigned ulBuckets;
+	unsigned ulBucketSize;	// bytes per bucket
+	unsigned ulStashCount;
+	unsigned ulRandom;		// to choose which entry to move out of a bucket
+	unsigned long ulDisplacements;	// entries moved to make room, ever
+	unsigned long ulStashed;	// inserts that left an entry in the stash
+	unsigned ulLongestPath;	// most entries moved by one insert
+	unsigned ulRehashes;	// times the table has been grown
+} htCuckoo_t;
+
+#define htCKBUCKET(ck,b)		((ck)->pcBuckets + (size_t)(b) * (ck)->ulBucketSize)
+#define htCKSLOT(table,bucket,w)	((hashent_t *)((bucket) + htCKHDR + (w) * (table)->ulEntrySize))
+#define htCKSTASH(table,i)		((hashent_t *)((table)->pxCuckoo->pcStash + (i) * (table)->ulEntrySize))
+
+// Second hash, from the key itself (FNV-1a for strings) and a good mixing
+// function.  Taking it from the first hash instead would give keys whose
+// first hashes collide the same pair of buckets however big the table grew.
+static inline unsigned prvCkHash2 (unsigned key, const char *name)
+{
+	unsigned h = key;
+
+	if (name) {
+		for (h = 2166136261u; *name; name++)
+			h = (h ^ (unsigned char)*name) * 16777619u;
+	}
+	h ^= 0x9e3779b9;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	return (h ^ (h >> 16));
+}
+// Tags are 1..255 (0 marks an empty way), so most non-matching entries are
+// passed over without looking at them
+static inline unsigned char prvCkTag (unsigned h2)
+{
+	return ((h2 >> 24) % 255 + 1);
+}
+static inline void prvCkBuckets (htCuckoo_t *ck, unsigned h1, unsigned h2, unsigned b[2])
+{
+	b[0] = h1 % ck->ulBuckets;
+	b[1] = h2 % ck->ulBuckets;
+	if (b[1] == b[0])
+		b[1] = (b[0] + 1) % ck->ulBuckets;
+}
+
+static hashent_t *prvCkLookup (hashtab_t *table, unsigned key, const char *name)
+{
+	htCuckoo_t *ck = table->pxCuckoo;
+	unsigned h1 = name ? prvHashedName (name) : prvHashedInt(key);
+	unsigned h2 = prvCkHash2(key, name), b[2];
+	unsigned char tag = prvCkTag(h2);
+
+	prvCkBuckets(ck, h1, h2, b);
+	for (int i = 0; i < 2; i++) {
+		char *bucket = htCKBUCKET(ck, b[i]);
+
+		for (int w = 0; w < htCK_WAYS; w++) {
+			if ((unsigned char)bucket[w] == tag && prvKeyMatch(htCKSLOT(table, bucket, w), key, name))
+				return (htCKSLOT(table, bucket, w));
+		}
+	}
+	for (unsigned i = 0; i < ck->ulStashCount; i++) {
+		hashent_t *e = htCKSTASH(table, i);
+
+		if (e->xHashes.ulHash1 == h1 && prvKeyMatch(e, key, name))
+			return (e);
+	}
+	return (NULL);
+}
+
+// Copy an entry into an empty way of bucket b, if there is one
+static hashent_t *prvCkFreeWay (hashtab_t *table, unsigned b, hashent_t *src)
+{
+	char *bucket = htCKBUCKET(table->pxCuckoo, b);
+
+	for (int w = 0; w < htCK_WAYS; w++) {
+		if (bucket[w] == 0) {
+			hashent_t *e = htCKSLOT(table, bucket, w);
+
+			memcpy(e, src, table->ulEntrySize);
+			bucket[w] = prvCkTag(src->xHashes.ulHash2);
+			return (e);
+		}
+	}
+	return (NULL);
+}
+
+// Swap the carried entry with the one in a bucket's way
+static void prvCkSwap (hashtab_t *table, char *bucket, unsigned w, hashent_t *carry, hashent_t *tmp)
+{
+	hashent_t *slot = htCKSLOT(table, bucket, w);
+
+	memcpy(tmp, slot, table->ulEntrySize);
+	memcpy(slot, carry, table->ulEntrySize);
+	bucket[w] = prvCkTag(slot->xHashes.ulHash2);
+	memcpy(carry, tmp, table->ulEntrySize);
+}
+
+// Put a copy of the entry at src into the table, moving other entries to their
+// other buckets if necessary.  Returns where src went; it isn't moved again
+// by this insert.  NULL if the moves ended with an entry that has no room
+// even in the stash; the moves are then undone, leaving the table as it was.
+static hashent_t *prvCkPlace (hashtab_t *table, hashent_t *src)
+{
+	htCuckoo_t *ck = table->pxCuckoo;
+	unsigned size = table->ulEntrySize;
+	hashent_t *carry = (hashent_t *)ck->pcScratch;
+	hashent_t *tmp = (hashent_t *)(ck->pcScratch + size);
+	hashent_t *placed = NULL, *e;
+	unsigned b[2], cur;
+
+	prvCkBuckets(ck, src->xHashes.ulHash1, src->xHashes.ulHash2, b);
+	if ((e = prvCkFreeWay(table, b[0], src)) || (e = prvCkFreeWay(table, b[1], src)))
+		return (e);
+	memcpy(carry, src, size);
+	cur = b[++ck->ulRandom & 1];
+	for (unsigned kicks = 1; kicks <= htCK_MAXKICKS; kicks++) {
+		char *bucket = htCKBUCKET(ck, cur);
+		unsigned w = (ck->ulRandom = ck->ulRandom * 1103515245 + 12345) >> 16;
+		hashent_t *victim = htCKSLOT(table, bucket, w % htCK_WAYS);
+
+		if (victim == placed)
+			victim = htCKSLOT(table, bucket, ++w % htCK_WAYS);
+		ck->pulPath[kicks - 1] = cur * htCK_WAYS + w % htCK_WAYS;
+		prvCkSwap(table, bucket, w % htCK_WAYS, carry, tmp);
+		if (!placed)
+			placed = victim;
+		ck->ulDisplacements++;
+		prvCkBuckets(ck, carry->xHashes.ulHash1, carry->xHashes.ulHash2, b);
+		cur = (cur == b[0]) ? b[1] : b[0];	// the one it wasn't in
+		if (prvCkFreeWay(table, cur, carry)) {
+			if (kicks > ck->ulLongestPath)
+				ck->ulLongestPath = kicks;
+			return (placed);
+		}
+	}
+	ck->ulLongestPath = htCK_MAXKICKS;
+	if (ck->ulStashCount == htCK_STASH) {
+		// swap everything back along the path, so the entry left over is
+		// src again and not one that was already in the table
+		for (unsigned i = htCK_MAXKICKS; i-- > 0; )
+			prvCkSwap(table, htCKBUCKET(ck, ck->pulPath[i] / htCK_WAYS), ck->pulPath[i] % htCK_WAYS, carry, tmp);
+		return (NULL);
+	}
+	memcpy(htCKSTASH(table, ck->ulStashCount++), carry, size);
+	ck->ulStashed++;
+	return (placed);
+}
+
+// Double the number of buckets and move everything into them.  The old
+// buckets aren't touched until all the entries have been placed, so if that
+// fails the table is left as it was.
+static int prvCkGrow (hashtab_t *table)
+{
+	htCuckoo_t *ck = table->pxCuckoo, old = *ck;
+	unsigned n = ck->ulBuckets * 2 + 1;
+	size_t bytes = (size_t)n * ck->ulBucketSize;
+	size_t stashbytes = htCK_STASH * table->ulEntrySize;
+	char *oldstash = htALLOC(table, stashbytes);
+	int ok = 1;
+
+	if (!oldstash || !(ck->pcBuckets = htALLOC(table, bytes))) {
+		if (oldstash)
+			htFREE(table, oldstash, stashbytes);
+		ck->pcBuckets = old.pcBuckets;
+		return (0);
+	}
+	memset(ck->pcBuckets, 0, bytes);
+	memcpy(oldstash, ck->pcStash, stashbytes);
+	ck->ulBuckets = n;
+	ck->ulStashCount = 0;
+	for (unsigned b = 0; ok && b < old.ulBuckets; b++) {
+		char *bucket = old.pcBuckets + (size_t)b * old.ulBucketSize;
+
+		for (int w = 0; ok && w < htCK_WAYS; w++) {
+			if (bucket[w])
+				ok = prvCkPlace(table, htCKSLOT(table, bucket, w)) != NULL;
+		}
+	}
+	for (unsigned i = 0; ok && i < old.ulStashCount; i++)
+		ok = prvCkPlace(table, (hashent_t *)(oldstash + i * table->ulEntrySize)) != NULL;
+	if (!ok) {
+		htFREE(table, ck->pcBuckets, bytes);
+		memcpy(ck->pcStash, oldstash, stashbytes);
+		*ck = old;
+	} else {
+		htFREE(table, old.pcBuckets, table->ulBucketBytes);
+		ck->ulRehashes++;
+		table->ulBucketCount = n;
+		table->ulBucketBytes = bytes;
+	}
+	htFREE(table, oldstash, stashbytes);
+	return (ok);
+}
+
+// Add a new key (the caller has already looked for it).  The value is left
+// for the caller to fill in.
+static hashent_t *prvCkInsert (hashtab_t *table, unsigned key, const char *name)
+{
+	htCuckoo_t *ck = table->pxCuckoo;
+	hashent_t *e = (hashent_t *)(ck->pcScratch + 2 * table->ulEntrySize), *placed;
+
+	if (table->ulMaxEntries && table->ulCurEntries >= table->ulMaxEntries)
+		return (NULL);
+	e->xHashes.ulHash1 = name ? prvHashedName (name) : prvHashedInt(key);
+	e->xHashes.ulHash2 = prvCkHash2(key, name);
+	if (name)
+		e->pcName = name;
+	else
+		e->ulKey = key;
+	// A place that fails leaves the table as it was, with the stash full.
+	// Growing spreads the keys over twice the buckets, but only helps a table
+	// that was fairly full: under half full, the keys must collide in both
+	// hashes, and growing again and again would never separate them.
+	while (!(placed = prvCkPlace(table, e))) {
+		if (table->ulCurEntries * 2 < (size_t)ck->ulBuckets * htCK_WAYS || !prvCkGrow(table))
+			return (NULL);
+	}
+	table->ulCurEntries++;
+	return (placed);
+}
+
+static void prvCkRemove (hashtab_t *table, hashent_t *e)
+{
+	htCuckoo_t *ck = table->pxCuckoo;
+	char *p = (char *)e;
+
+	if (p >= ck->pcStash && p < ck->pcStash + htCK_STASH * table->ulEntrySize) {
+		hashent_t *last = htCKSTASH(table, --ck->ulStashCount);
+
+		if (last != e)				// keep the stash packed
+			memcpy(e, last, table->ulEntrySize);
+	} else {
+		size_t off = p - ck->pcBuckets;
+		char *bucket = htCKBUCKET(ck, off / ck->ulBucketSize);
+
+		bucket[(off % ck->ulBucketSize - htCKHDR) / table->ulEntrySize] = 0;
+	}
+	table->ulCurEntries--;
+}
+
+// Iteration walks the ways of all the buckets, then the stash from the end,
+// so deleting the entry just returned never moves one not yet visited.
+static void prvCkNextentry (htIterator_t *it)
+{
+	hashtab_t *table = it->pxTable;
+	htCuckoo_t *ck = table->pxCuckoo;
+
+	while (it->ulBucket < ck->ulBuckets * htCK_WAYS) {
+		unsigned pos = it->ulBucket++;
+		char *bucket = htCKBUCKET(ck, pos / htCK_WAYS);
+
+		if (bucket[pos % htCK_WAYS]) {
+			it->pxNext = htCKSLOT(table, bucket, pos % htCK_WAYS);
+			return;
+		}
+	}
+	it->pxNext = it->ulStash ? htCKSTASH(table, --it->ulStash) : NULL;
+}
+
+static int prvCkCreate (hashtab_t *table, unsigned numbuckets, size_t initentries)
+{
+	htCuckoo_t *ck = htALLOC(table, sizeof (htCuckoo_t));
+	size_t need = (initentries * 10 / 9 + htCK_WAYS - 1) / htCK_WAYS;	// 90% full
+
+	if (!ck)
+		return (0);
+	memset(ck, 0, sizeof (htCuckoo_t));
+	ck->ulBuckets = (numbuckets > need ? numbuckets : need) | 1;
+	if (ck->ulBuckets < 3)
+		ck->ulBuckets = 3;
+	ck->ulBucketSize = htCKHDR + htCK_WAYS * table->ulEntrySize;
+	table->pxCuckoo = ck;
+	table->ulBucketCount = ck->ulBuckets;
+	table->ulBucketBytes = (size_t)ck->ulBuckets * ck->ulBucketSize;
+	ck->pcBuckets = htALLOC(table, table->ulBucketBytes);
+	ck->pcStash = htALLOC(table, htCK_STASH * table->ulEntrySize);
+	ck->pcScratch = htALLOC(table, 3 * table->ulEntrySize);
+	ck->pulPath = htALLOC(table, htCK_MAXKICKS * sizeof (unsigned));
+	if (!ck->pcBuckets || !ck->pcStash || !ck->pcScratch || !ck->pulPath) {
+		if (ck->pcBuckets)
+			htFREE(table, ck->pcBuckets, table->ulBucketBytes);
+		if (ck->pcStash)
+			htFREE(table, ck->pcStash, htCK_STASH * table->ulEntrySize);
+		if (ck->pcScratch)
+			htFREE(table, ck->pcScratch, 3 * table->ulEntrySize);
+		if (ck->pulPath)
+			htFREE(table, ck->pulPath, htCK_MAXKICKS * sizeof (unsigned));
+		htFREE(table, ck, sizeof (htCuckoo_t));
+		return (0);
+	}
+	memset(ck->pcBuckets, 0, table->ulBucketBytes);
+	return (1);
+}
+static void prvCkFree (hashtab_t *table)
+{
+	htCuckoo_t *ck = table->pxCuckoo;
+
+	htFREE(table, ck->pcBuckets, table->ulBucketBytes);
+	htFREE(table, ck->pcStash, htCK_STASH * table->ulEntrySize);
+	htFREE(table, ck->pcScratch, 3 * table->ulEntrySize);
+	htFREE(table, ck->pulPath, htCK_MAXKICKS * sizeof (unsigned));
+	htFREE(table, ck, sizeof (htCuckoo_t));
+}
+
+// **************************************************
+// Small tables.  While a table has few entries, its keys are kept packed in
+// an array (integer keys as they are, string keys as their hash) and
+// compared with it several at a time, with the entries after them, so a
+// lookup touches a cache line or two and no chain.  Past ulSmallMax entries
+// it moves to buckets like any other table, and back at the first add after
+// it shrinks to half that.  Entries are copied when they move, and packed
+// down on delete, so entry pointers only stay valid until the next change.
+// ***************************************************
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define htSMALLFIRST	8		// slots in a new array; always a multiple of 8
+#define htSMALLLIMIT	64		// most slots, one bit each in ulStrings
+
+typedef struct _htSmall {
+	uint64_t ulStrings;		// bit i set if slot i holds a string key
+	unsigned ulCount;		// slots in use, from the first
+	unsigned ulCap;			// slots allocated
+	uint32_t aulKeys[];		// ulCap keys or hashes, then ulCap entries
+} htSmall_t;
+
+#define htSMALLBYTES(table,cap)	(sizeof (htSmall_t) + (size_t)(cap) * (sizeof (uint32_t) + (table)->ulEntrySize))
+#define htSMALLENT(table,sm,i)	((hashent_t *)((char *)((sm)->aulKeys + (sm)->ulCap) + (size_t)(i) * (table)->ulEntrySize))
+
+static htSmall_t *prvSmallAlloc (hashtab_t *table, unsigned cap)
+{
+	htSmall_t *sm = htALLOC(table, htSMALLBYTES(table, cap));
+
+	if (sm) {
+		memset(sm, 0, sizeof (htSmall_t) + cap * sizeof (uint32_t));	// scans read every key
+		sm->ulCap = cap;
+	}
+	return (sm);
+}
+
+// Bit i set for each slot in use whose key (or hash) is k
+static inline uint64_t prvSmallMatch (htSmall_t *sm, uint32_t k)
+{
+	unsigned n = sm->ulCount;
+	uint64_t m = 0;
+
+	if (!n)
+		return (0);
+#if defined(__AVX2__)
+	__m256i kk = _mm256_set1_epi32(k);
+
+	for (unsigned i = 0; i < n; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(sm->aulKeys + i));
+
+		m |= (uint64_t)(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, kk))) << i;
+	}
+#elif defined(__SSE2__)
+	__m128i kk = _mm_set1_epi32(k);
+
+	for (unsigned i = 0; i < n; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(sm->aulKeys + i));
+
+		m |= (uint64_t)(unsigned)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, kk))) << i;
+	}
+#else
+	for (unsigned i = 0; i < n; i++)
+		m |= (uint64_t)(sm->aulKeys[i] == k) << i;
+#endif
+	return (m & ((2ULL << (n - 1)) - 1));	// not the slots past the end
+}
+
+static inline hashent_t *prvSmallFind (hashtab_t *table, unsigned key, const char *name)
+{
+	htSmall_t *sm = table->pxSmall;
+	uint64_t m;
+
+	if (!name) {
+		m = prvSmallMatch(sm, key) & ~sm->ulStrings;
+		return (m ? htSMALLENT(table, sm, __builtin_ctzll(m)) : NULL);
+	}
+	for (m = prvSmallMatch(sm, prvHashedName(name)) & sm->ulStrings; m; m &= m - 1) {
+		hashent_t *e = htSMALLENT(table, sm, __builtin_ctzll(m));
+
+		if (strcmp(name, e->pcName) == 0)
+			return (e);
+	}
+	return (NULL);
+}
+
+// Give back every block of entries.  Only for when none of them are in use.
+static void prvFreeSlabs (hashtab_t *table)
+{
+	while (table->pxSlabs) {
+		htSlab_t *s = table->pxSlabs;
+
+		table->pxSlabs = s->pxNext;
+		htFREE(table, s, s->ulBytes);
+	}
+	table->pxFreelist = NULL;
+	table->ulSlabBytes = 0;
+}
+
+// Move the entries into a new array of cap slots
+static int prvSmallResize (hashtab_t *table, unsigned cap)
+{
+	htSmall_t *sm = table->pxSmall, *n = prvSmallAlloc(table, cap);
+
+	if (!n)
+		return (0);
+	n->ulStrings = sm->ulStrings;
+	n->ulCount = sm->ulCount;
+	memcpy(n->aulKeys, sm->aulKeys, sm->ulCount * sizeof (uint32_t));
+	memcpy(htSMALLENT(table, n, 0), htSMALLENT(table, sm, 0), (size_t)sm->ulCount * table->ulEntrySize);
+	htFREE(table, sm, htSMALLBYTES(table, sm->ulCap));
+	table->pxSmall = n;
+	return (1);
+}
+
+// Move the entries into chains, in a bucket array of the size the table was
+// created with and a block big enough for them and ulAllocSize more
+static int prvSmallPromote (hashtab_t *table)
+{
+	htSmall_t *sm = table->pxSmall;
+	unsigned n = table->ulBucketCount, want = sm->ulCount + table->ulAllocSize;
+	dlList_t *listheads;
+
+	if (table->ulMaxEntries && want > table->ulMaxEntries)
+		want = table->ulMaxEntries;
+	if (!(listheads = htALLOC(table, sizeof (dlList_t) * n)))
+		return (0);
+	if (!prvAddSlab(table, want)) {
+		htFREE(table, listheads, sizeof (dlList_t) * n);
+		return (0);
+	}
+	for (unsigned b = 0; b < n; b++)
+		LLINKSINIT(&listheads[b]);
+	for (unsigned i = 0; i < sm->ulCount; i++) {
+		hashent_t *e = table->pxFreelist;
+		unsigned hash = (sm->ulStrings >> i & 1) ? sm->aulKeys[i] : prvHashedInt(sm->aulKeys[i]);
+
+		table->pxFreelist = e->pxFreelist;
+		memcpy(e, htSMALLENT(table, sm, i), table->ulEntrySize);
+		lInsert(&listheads[hash % n], (dlList_t *)e);
+	}
+	table->pxBuckets = listheads;
+	table->ulBucketBytes = sizeof (dlList_t) * n;
+	htFREE(table, sm, htSMALLBYTES(table, sm->ulCap));
+	table->pxSmall = NULL;
+	return (1);
+}
+
+// Move the entries back out of the chains into an array, and give back the
+// buckets and blocks of entries.  Tables holding both kinds of key stay in
+// chains, since there's no telling which an entry has.
+static int prvSmallDemote (hashtab_t *table)
+{
+	unsigned cap = htSMALLFIRST;
+	htSmall_t *sm;
+
+	if (table->xHasInt && table->xHasString)
+		return (0);
+	while (cap < 2 * table->ulCurEntries && cap < table->ulSmallMax)
+		cap *= 2;
+	if (cap > table->ulSmallMax)
+		cap = table->ulSmallMax;
+	if (!(sm = prvSmallAlloc(table, cap)))
+		return (0);
+	for (unsigned b = 0; b < table->ulBucketCount; b++) {
+		dlList_t *listhead = &table->pxBuckets[b];
+
+		for (dlList_t *l = listhead->right; l != listhead; l = l->right) {
+			hashent_t *e = (hashent_t *)l;
+			unsigned i = sm->ulCount++;
+
+			memcpy(htSMALLENT(table, sm, i), e, table->ulEntrySize);
+			if (table->xHasString) {
+				sm->aulKeys[i] = prvHashedName(e->pcName);
+				sm->ulStrings |= 1ULL << i;
+			} else {
+				sm->aulKeys[i] = e->ulKey;
+			}
+		}
+	}
+	prvFreeSlabs(table);
+	htFREE(table, table->pxBuckets, table->ulBucketBytes);
+	table->pxBuckets = NULL;
+	table->ulBucketBytes = 0;
+	table->pxSmall = sm;
+	return (1);
+}
+
+// Make room for one more entry in a small table, in its array or by moving
+// it to chains, or move a table that has shrunk back to an array.  0 if the
+// table is full or out of memory.
+static int prvSmallFit (hashtab_t *table)
+{
+	htSmall_t *sm = table->pxSmall;
+
+	if (table->ulMaxEntries && table->ulCurEntries >= table->ulMaxEntries)
+		return (0);
+	if (!sm) {
+		if (table->ulCurEntries <= table->ulSmallMax / 2)
+			(void) prvSmallDemote(table);	// if it can't, chains work as well
+		return (1);
+	}
+	if (sm->ulCount < sm->ulCap)
+		return (1);
+	if (sm->ulCap < table->ulSmallMax)
+		return (prvSmallResize(table, sm->ulCap * 2 < table->ulSmallMax ? sm->ulCap * 2 : table->ulSmallMax));
+	return (table->ulAllocSize && prvSmallPromote(table));	// no increment, no room for more
+}
+
+static hashent_t *prvSmallInsert (hashtab_t *table, unsigned key, const char *name)
+{
+	htSmall_t *sm = table->pxSmall;
+	unsigned i = sm->ulCount++;
+	hashent_t *e = htSMALLENT(table, sm, i);
+
+	memset(e, 0, table->ulEntrySize);
+	if (name) {
+		sm->aulKeys[i] = prvHashedName(name);
+		sm->ulStrings |= 1ULL << i;
+	} else {
+		sm->aulKeys[i] = key;
+	}
+	table->ulCurEntries++;
+	return (e);
+}
+
+static void prvSmallRemove (hashtab_t *table, hashent_t *e)
+{
+	htSmall_t *sm = table->pxSmall;
+	unsigned i = ((char *)e - (char *)htSMALLENT(table, sm, 0)) / table->ulEntrySize;
+	unsigned last = --sm->ulCount;
+
+	if (i != last) {			// keep the array packed
+		sm->aulKeys[i] = sm->aulKeys[last];
+		memcpy(e, htSMALLENT(table, sm, last), table->ulEntrySize);
+		sm->ulStrings = (sm->ulStrings & ~(1ULL << i)) | ((sm->ulStrings >> last & 1) << i);
+	}
+	sm->ulStrings &= ~(1ULL << last);
+	table->ulCurEntries--;
+}
+
+// **************************************************
+// Pages of buckets shared with clones.  A table about to change something in
+// a page it shares copies the page, and every entry in its chains, and drops
+// its reference to the old one.  The copies come from its own entries, so
+// the other tables' view is never written to.
+// ***************************************************
+
+static inline unsigned prvPageBuckets (hashtab_t *table, unsigned p)
+{
+	unsigned n = table->ulBucketCount - p * htPAGEBUCKETS;
+
+	return (n < htPAGEBUCKETS ? n : htPAGEBUCKETS);
+}
+
+// Let go of a page of n buckets, and if no table has it now, of the keys
+// of its entries and the page itself
+static void prvReleasePage (hashtab_t *table, htPage_t *page, unsigned n)
+{
+	if (htREFDEC(&page->ulRefs) != 0)
+		return;
+	if ((table->xCopyKeys || table->ulKeyInline) && table->xHasString) {
+		for (unsigned b = 0; b < n; b++) {
+			dlList_t *listhead = &page->pxBuckets[b];
+
+			for (dlList_t *l = listhead->right; l != listhead; l = l->right) {
+				if (prvOwnsKey(table, (hashent_t *)l))
+					htFREE(table, (void *)((hashent_t *)l)->pcName, strlen(((hashent_t *)l)->pcName) + 1);
+			}
+		}
+	}
+	if (page->xOwnMem)
+		htFREE(table, page, sizeof (htPage_t) + (size_t)n * sizeof (dlList_t));
+}
+
+// A private copy of an entry, with its own copy of the key if the table
+// keeps keys.  Doesn't count as a new entry, and isn't limited by maxentries.
+static hashent_t *prvCopyEntry (hashtab_t *table, hashent_t *from)
+{
+	hashent_t *e;
+
+	if (!table->pxFreelist && !prvAddSlab(table, table->ulAllocSize ? table->ulAllocSize : htPAGEBUCKETS))
+		return (NULL);
+	e = table->pxFreelist;
+	table->pxFreelist = e->pxFreelist;
+	memcpy(e, from, table->ulEntrySize);
+	if (prvOwnsKey(table, from)) {
+		size_t len = strlen(from->pcName) + 1;
+		char *copy = htALLOC(table, len);
+
+		if (!copy) {
+			e->pxFreelist = table->pxFreelist;
+			table->pxFreelist = e;
+			return (NULL);
+		}
+		e->pcName = memcpy(copy, from->pcName, len);
+	} else if (table->ulKeyInline) {
+		e->pcName = (const char *)htINLINEKEY(e);
+	}
+	return (e);
+}
+
+// Replace page p in the table's directory with a copy of its own
+static int prvCopyPage (hashtab_t *table, unsigned p)
+{
+	htPage_t *old = table->pxExt->ppxPages[p], *page;
+	unsigned n = prvPageBuckets(table, p);
+	size_t bytes = sizeof (htPage_t) + (size_t)n * sizeof (dlList_t);
+
+	if (!(page = htALLOC(table, bytes)))
+		return (0);
+	page->ulRefs = 1;
+	page->xOwnMem = 1;
+	page->pxBuckets = (dlList_t *)(page + 1);
+	for (unsigned b = 0; b < n; b++)
+		LLINKSINIT(&page->pxBuckets[b]);
+	for (unsigned b = 0; b < n; b++) {
+		dlList_t *from = &old->pxBuckets[b], *to = &page->pxBuckets[b];
+
+		for (dlList_t *l = from->right; l != from; l = l->right) {
+			hashent_t *e = prvCopyEntry(table, (hashent_t *)l);
+
+			if (e) {
+				lInsert(to->left, (dlList_t *)e);	// at the end, keeping the order
+				continue;
+			}
+			// out of memory: give back the copies made so far
+			for (b = 0; b < n; b++) {
+				to = &page->pxBuckets[b];
+				while ((e = (hashent_t *)to->right) != (hashent_t *)to) {
+					lDelete((dlList_t *)e);
+					if (prvOwnsKey(table, e))
+						htFREE(table, (void *)e->pcName, strlen(e->pcName) + 1);
+					e->pxFreelist = table->pxFreelist;
+					table->pxFreelist = e;
+				}
+			}
+			htFREE(table, page, bytes);
+			return (0);
+		}
+	}
+	table->pxExt->ppxPages[p] = page;
+	table->ulBucketBytes += bytes;
+	prvReleasePage(table, old, n);
+	prvHotFlush(table);		// it may hold the entries just copied
+	return (1);
+}
+
+// Drop a table's reference to what it shares, freeing what no table uses
+static void prvReleaseShared (hashtab_t *table, htShared_t *sh)
+{
+	while (sh && htREFDEC(&sh->ulRefs) == 0) {
+		htShared_t *older = sh->pxOlder;
+
+		while (sh->pxSlabs) {
+			htSlab_t *s = sh->pxSlabs;
+
+			sh->pxSlabs = s->pxNext;
+			htFREE(table, s, s->ulBytes);
+		}
+		if (sh->pxBuckets) {
+			htFREE(table, sh->pxBuckets, sh->ulBucketBytes);
+			htFREE(table, sh->pxPages, (sh->ulBucketBytes / sizeof (dlList_t) + htPAGEBUCKETS - 1)
+										/ htPAGEBUCKETS * sizeof (htPage_t));
+		}
+		htFREE(table, sh, sizeof (htShared_t));
+		sh = older;
+	}
+}
+
+// Make sure the bucket a key belongs in can be changed: a table sharing its
+// page copies it first.  0 if there's no memory to do that.
+static int prvWritable (hashtab_t *table, unsigned key, const char *name)
+{
+	unsigned p;
+
+	if (!table->pxExt->ppxPages)
+		return (1);
+	p = prvHashedKey(table, key, name) % table->ulBucketCount / htPAGEBUCKETS;
+	return (htREFS(&table->pxExt->ppxPages[p]->ulRefs) == 1 || prvCopyPage(table, p));
+}
+
+// **************************************************
+// Keyed tables.  Their hash is SipHash with a random seed of their own, so
+// the buckets keys land in can't be predicted.  Should a chain grow past
+// ulMaxChain anyway, at the next add the table picks a new seed and starts
+// moving its entries to a new bucket array, htREHASH_STEP buckets at each
+// add after that.  Until that's done, a key not in its new bucket is looked
+// for in its old one, if that hasn't been moved yet, and new keys go in
+// the new array.  A table reseeds at most once per ulCurEntries adds, so
+// chains that are long whatever the seed (many duplicates in a multimap)
+// can't make it rehash continually.
+// ***************************************************
+
+#define htREHASH_STEP	64		// old buckets moved at each add while rehashing
+#define htMAXCHAIN		32		// default ulMaxChain for keyed tables
+
+// Where key would be in the old buckets, NULL if they've been moved
+static inline dlList_t *prvOldBucket (hashtab_t *table, unsigned key, const char *name)
+{
+	htExt_t *ext = table->pxExt;
+	unsigned b;
+
+	if (!ext->pxOldBuckets)
+		return (NULL);
+	b = prvKeyedHash(ext->aulOldSeed, key, name) % table->ulBucketCount;
+	return (b >= ext->ulRehashNext ? &ext->pxOldBuckets[b] : NULL);
+}
+
+// Pick a new seed, and a new bucket array to move the entries to with it.
+// Tables with both kinds of key can't: an entry doesn't say which it has.
+static int prvReseed (hashtab_t *table)
+{
+	htExt_t *ext = table->pxExt;
+	dlList_t *buckets;
+
+	if ((table->xHasString && table->xHasInt) || ext->pxOldBuckets || ext->pxCompact
+		|| !(buckets = htALLOC(table, table->ulBucketBytes)))
+		return (0);
+	for (unsigned b = 0; b < table->ulBucketCount; b++)
+		LLINKSINIT(&buckets[b]);
+	ext->pxOldBuckets = table->pxBuckets;
+	table->pxBuckets = buckets;
+	ext->aulOldSeed[0] = ext->aulSeed[0];
+	ext->aulOldSeed[1] = ext->aulSeed[1];
+	prvNewSeed(table, ext->aulSeed);
+	ext->ulRehashNext = 0;
+	prvHotFlush(table);		// the hashes it holds are the old seed's
+	ext->xStats.ulReseeds++;
+	return (1);
+}
+
+// Move up to buckets old buckets' entries to the new array, starting a
+// reseed first if a long chain has been seen.  Non-zero while there's more.
+static int prvRehashStep (hashtab_t *table, unsigned buckets)
+{
+	htExt_t *ext = table->pxExt;
+
+	if (!ext->pxOldBuckets) {
+		if (!table->xFlooded || ext->ulQuiet)
+			return (0);
+		table->xFlooded = 0;
+		if (!prvReseed(table))
+			return (0);
+	}
+	for (; buckets && ext->ulRehashNext < table->ulBucketCount; buckets--) {
+		dlList_t *old = &ext->pxOldBuckets[ext->ulRehashNext++], *l;
+
+		while ((l = old->right) != old) {	// in order, so multimap duplicates stay together
+			hashent_t *e = (hashent_t *)l;
+			dlList_t *head = &table->pxBuckets[prvHashedKey(table, e->ulKey, table->xHasString ? e->pcName : NULL)
+											   % table->ulBucketCount];
+
+			lDelete(l);
+			lInsert(head->left, l);
+			ext->xStats.ulRehashed++;
+		}
+	}
+	if (ext->ulRehashNext < table->ulBucketCount)
+		return (1);
+	htFREE(table, ext->pxOldBuckets, table->ulBucketBytes);
+	ext->pxOldBuckets = NULL;
+	ext->ulQuiet = table->ulCurEntries;
+	return (0);
+}
+
+int iHtReseed (hashtab_t *table)
+{
+	return (table->xKeyed && prvReseed(table));
+}
+int iHtRehashStep (hashtab_t *table, unsigned buckets)
+{
+	return (table->xKeyed && prvRehashStep(table, buckets ? buckets : ~0u));
+}
+
+// **************************************************
+// Hot key caches.  Each set holds two recently found entries with their
+// hashes, the most recent first, and a key's set is picked by its hash.  A
+// lookup that finds its key there goes no further; one that finds it in a
+// chain puts it at the front of its set, pushing the other out.  Entries
+// are dropped from their set when removed, or followed when compaction
+// moves them, and the whole cache is emptied when many move at once
+// (reseeding, copying a cloned page, a new direct-address range).  While a
+// keyed table is rehashing, entries aren't where their hash says, so the
+// cache isn't used.
+// ***************************************************
+
+#define htHOTMAX		65536	// most keys a cache holds
+
+typedef struct _htHotSet {
+	unsigned aulHash[2];
+	hashent_t *apxEntry[2];
+} htHotSet_t;
+
+static inline htHotSet_t *prvHotSet (hashtab_t *table, unsigned hash)
+{
+	return (&table->pxExt->pxHot[((hash * 0x9e3779b1u) >> 16) & table->pxExt->ulHotMask]);
+}
+
+static int prvHotAlloc (hashtab_t *table, unsigned keys)
+{
+	unsigned sets = 1;
+
+	if (keys > htHOTMAX)
+		keys = htHOTMAX;
+	while (sets * 2 < keys)
+		sets *= 2;
+	if (!(table->pxExt->pxHot = htALLOC(table, sets * sizeof (htHotSet_t))))
+		return (0);
+	memset(table->pxExt->pxHot, 0, sets * sizeof (htHotSet_t));
+	table->pxExt->ulHotMask = sets - 1;
+	return (1);
+}
+
+static void prvHotFlush (hashtab_t *table)
+{
+	if (table->pxExt->pxHot)
+		memset(table->pxExt->pxHot, 0, (table->pxExt->ulHotMask + 1) * sizeof (htHotSet_t));
+}
+
+// Remember an entry just found, as the most recent of its set
+static inline void prvHotKeep (hashtab_t *table, unsigned hash, hashent_t *e)
+{
+	htHotSet_t *set = prvHotSet(table, hash);
+
+	set->aulHash[1] = set->aulHash[0];
+	set->apxEntry[1] = set->apxEntry[0];
+	set->aulHash[0] = hash;
+	set->apxEntry[0] = e;
+}
+
+// The entry at e is now at to, or gone if to is NULL.  A table with both
+// kinds of key can't tell which e has, so can't find its set.
+static void prvHotMoved (hashtab_t *table, hashent_t *e, hashent_t *to)
+{
+	htHotSet_t *set;
+
+	if (table->xHasString && table->xHasInt) {
+		prvHotFlush(table);
+		return;
+	}
+	set = prvHotSet(table, prvHashedKey(table, e->ulKey, table->xHasString ? e->pcName : NULL));
+	for (int w = 0; w < 2; w++) {
+		if (set->apxEntry[w] == e)
+			set->apxEntry[w] = to;
+	}
+}
+
+// **************************************************
+// Ordered index.  A B+tree of the integer keys, each leaf entry pointing at
+// the key's entry.  Nodes have their keys in the first cache line, the
+// pointers in the next two, so a step down the tree reads the key line and
+// one pointer.  Keys in a node are in ascending order; in an inner node,
+// key i is no more than any key under child i and more than every key
+// under child i - 1 (key 0 is only a lower bound, and isn't kept up to
+// date).  A full node is split in two, and after a delete a node under a
+// quarter full is merged with a neighbour if they fit in one, so the tree
+// only holds empty leaves while it's just a root.  Nodes come from chunks
+// kept until the table is freed; an add first makes sure there are enough
+// spare for a split at every level, so the index can't fail part way
+// through, and adds fail as for a full table if it can't.
+// ***************************************************
+
+#define htBT_KEYS		16		// per node: a cache line of them
+#define htBT_CHUNK		64		// nodes allocated at a time
+#define htBT_MAXHEIGHT	16		// plenty: a tree of 4G keys in nodes a quarter full needs 12
+
+typedef struct _htBtNode {
+	uint32_t aulKeys[htBT_KEYS];
+	void *apvPtr[htBT_KEYS];		// leaves: entries, others: the nodes below
+	struct _htBtNode *pxNext, *pxPrev;	// leaves: the leaves either side, in key order
+	unsigned short ulCount;			// keys in use
+	unsigned char xLeaf;
+} __attribute__((aligned(64))) htBtNode_t;
+
+typedef struct _htBtChunk {
+	struct _htBtChunk *pxNext;
+} htBtChunk_t;
+
+#define htBT_CHUNKBYTES	(sizeof (htBtChunk_t) + 63 + htBT_CHUNK * sizeof (htBtNode_t))
+
+typedef struct _htOrder {
+	htBtNode_t *pxRoot;
+	unsigned ulHeight;		// levels, 1 while the root is a leaf
+	htBtNode_t *pxFirst;	// leaves with the smallest
+	htBtNode_t *pxLast;		//   and largest keys
+	htBtNode_t *pxSpare;	// unused nodes, linked through apvPtr[0]
+	unsigned ulSpare;
+	htBtChunk_t *pxChunks;
+	size_t ulNodes;			// in use
+	size_t ulBytes;
+	unsigned long ulChanges;	// adds and deletes, for range iterators
+} htOrder_t;
+
+// Make sure there are enough spare nodes for an add to split every level
+static int prvOrderReserve (hashtab_t *table)
+{
+	htOrder_t *o = table->pxExt->pxOrder;
+	htBtChunk_t *chunk;
+	htBtNode_t *n;
+
+	if (o->ulSpare > o->ulHeight)
+		return (1);
+	if (o->ulHeight >= htBT_MAXHEIGHT || !(chunk = htALLOC(table, htBT_CHUNKBYTES)))
+		return (0);
+	chunk->pxNext = o->pxChunks;
+	o->pxChunks = chunk;
+	o->ulBytes += htBT_CHUNKBYTES;
+	n = (htBtNode_t *)(((uintptr_t)(chunk + 1) + 63) & ~(uintptr_t)63);
+	for (int i = 0; i < htBT_CHUNK; i++, n++) {
+		n->apvPtr[0] = o->pxSpare;
+		o->pxSpare = n;
+	}
+	o->ulSpare += htBT_CHUNK;
+	return (1);
+}
+
+static htBtNode_t *prvBtNewNode (htOrder_t *o, int leaf)
+{
+	htBtNode_t *n = o->pxSpare;
+
+	o->pxSpare = n->apvPtr[0];
+	o->ulSpare--;
+	o->ulNodes++;
+	n->ulCount = 0;
+	n->xLeaf = leaf;
+	n->pxNext = n->pxPrev = NULL;
+	return (n);
+}
+
+static void prvBtFreeNode (htOrder_t *o, htBtNode_t *n)
+{
+	n->apvPtr[0] = o->pxSpare;
+	o->pxSpare = n;
+	o->ulSpare++;
+	o->ulNodes--;
+}
+
+static int prvOrderAlloc (hashtab_t *table)
+{
+	htExt_t *ext = table->pxExt;
+
+	if (!(ext->pxOrder = htALLOC(table, sizeof (htOrder_t))))
+		return (0);
+	memset(ext->pxOrder, 0, sizeof (htOrder_t));
+	ext->pxOrder->ulHeight = 1;
+	if (!prvOrderReserve(table)) {
+		htFREE(table, ext->pxOrder, sizeof (htOrder_t));
+		ext->pxOrder = NULL;
+		return (0);
+	}
+	ext->pxOrder->pxRoot = ext->pxOrder->pxFirst = ext->pxOrder->pxLast = prvBtNewNode(ext->pxOrder, 1);
+	return (1);
+}
+
+static void prvOrderFree (hashtab_t *table)
+{
+	for (htBtChunk_t *c = table->pxExt->pxOrder->pxChunks, *next; c; c = next) {
+		next = c->pxNext;
+		htFREE(table, c, htBT_CHUNKBYTES);
+	}
+	htFREE(table, table->pxExt->pxOrder, sizeof (htOrder_t));
+	table->pxExt->pxOrder = NULL;
+}
+
+// In an inner node, the child key would be under
+static inline unsigned prvBtChild (htBtNode_t *n, unsigned key)
+{
+	unsigned i = 1;
+
+	while (i < n->ulCount && n->aulKeys[i] <= key)
+		i++;
+	return (i - 1);
+}
+
+// In a leaf, the place of the first key not below key (ulCount if none)
+static inline unsigned prvBtLower (htBtNode_t *n, unsigned key)
+{
+	unsigned i = 0;
+
+	while (i < n->ulCount && n->aulKeys[i] < key)
+		i++;
+	return (i);
+}
+
+// The leaf key belongs in, noting the nodes and children taken on the way
+// if path isn't NULL
+static htBtNode_t *prvBtDescend (htOrder_t *o, unsigned key, htBtNode_t **path, unsigned *children)
+{
+	htBtNode_t *n = o->pxRoot;
+
+	for (unsigned level = 0; !n->xLeaf; level++) {
+		unsigned i = prvBtChild(n, key);
+
+		if (path) {
+			path[level] = n;
+			children[level] = i;
+		}
+		n = n->apvPtr[i];
+	}
+	return (n);
+}
+
+static inline void prvBtPut (htBtNode_t *n, unsigned i, unsigned key, void *ptr)
+{
+	memmove(&n->aulKeys[i + 1], &n->aulKeys[i], (n->ulCount - i) * sizeof n->aulKeys[0]);
+	memmove(&n->apvPtr[i + 1], &n->apvPtr[i], (n->ulCount - i) * sizeof n->apvPtr[0]);
+	n->aulKeys[i] = key;
+	n->apvPtr[i] = ptr;
+	n->ulCount++;
+}
+
+static inline void prvBtTake (htBtNode_t *n, unsigned i)
+{
+	n->ulCount--;
+	memmove(&n->aulKeys[i], &n->aulKeys[i + 1], (n->ulCount - i) * sizeof n->aulKeys[0]);
+	memmove(&n->apvPtr[i], &n->apvPtr[i + 1], (n->ulCount - i) * sizeof n->apvPtr[0]);
+}
+
+// Add a key the table has just added (prvOrderReserve has been called)
+static void prvOrderInsert (hashtab_t *table, unsigned key, hashent_t *e)
+{
+	htOrder_t *o = table->pxExt->pxOrder;
+	htBtNode_t *path[htBT_MAXHEIGHT], *n, *right;
+	unsigned children[htBT_MAXHEIGHT], level = o->ulHeight - 1, i;
+	void *ptr = e;
+
+	o->ulChanges++;
+	n = prvBtDescend(o, key, path, children);
+	i = prvBtLower(n, key);
+	// put key and ptr in n at i, splitting nodes up the tree while they're full
+	while (n->ulCount == htBT_KEYS) {
+		unsigned half = htBT_KEYS / 2;
+
+		right = prvBtNewNode(o, n->xLeaf);
+		memcpy(right->aulKeys, &n->aulKeys[half], half * sizeof n->aulKeys[0]);
+		memcpy(right->apvPtr, &n->apvPtr[half], half * sizeof n->apvPtr[0]);
+		right->ulCount = n->ulCount = half;
+		if (i <= half)
+			prvBtPut(n, i, key, ptr);
+		else
+			prvBtPut(right, i - half, key, ptr);
+		if (n->xLeaf) {
+			right->pxPrev = n;
+			right->pxNext = n->pxNext;
+			if (n->pxNext)
+				n->pxNext->pxPrev = right;
+			else
+				o->pxLast = right;
+			n->pxNext = right;
+		}
+		key = right->aulKeys[0];		// which goes in the parent, after n
+		ptr = right;
+		if (level == 0) {				// n was the root: a new one over the two
+			htBtNode_t *root = prvBtNewNode(o, 0);
+
+			root->aulKeys[0] = n->aulKeys[0];
+			root->apvPtr[0] = n;
+			root->aulKeys[1] = key;
+			root->apvPtr[1] = right;
+			root->ulCount = 2;
+			o->pxRoot = root;
+			o->ulHeight++;
+			return;
+		}
+		level--;
+		n = path[level];
+		i = children[level] + 1;
+	}
+	prvBtPut(n, i, key, ptr);
+}
+
+// Take out a key the table is removing
+static void prvOrderDelete (hashtab_t *table, unsigned key)
+{
+	htOrder_t *o = table->pxExt->pxOrder;
+	htBtNode_t *path[htBT_MAXHEIGHT], *n;
+	unsigned children[htBT_MAXHEIGHT], i;
+
+	n = prvBtDescend(o, key, path, children);
+	i = prvBtLower(n, key);
+	if (i == n->ulCount || n->aulKeys[i] != key)
+		return;
+	o->ulChanges++;
+	prvBtTake(n, i);
+	// merge underfull nodes into a neighbour, up the tree while that leaves
+	// the parent underfull
+	for (unsigned level = o->ulHeight - 1; level > 0 && n->ulCount < htBT_KEYS / 4; level--) {
+		htBtNode_t *parent = path[level - 1], *left, *right;
+		unsigned c = children[level - 1], r;
+
+		if (parent->ulCount < 2)
+			break;
+		r = c ? c : 1;				// right one of the pair, which goes
+		left = parent->apvPtr[r - 1];
+		right = parent->apvPtr[r];
+		if (left->ulCount + right->ulCount > htBT_KEYS)
+			break;
+		memcpy(&left->aulKeys[left->ulCount], right->aulKeys, right->ulCount * sizeof right->aulKeys[0]);
+		memcpy(&left->apvPtr[left->ulCount], right->apvPtr, right->ulCount * sizeof right->apvPtr[0]);
+		left->ulCount += right->ulCount;
+		if (right->xLeaf) {
+			left->pxNext = right->pxNext;
+			if (right->pxNext)
+				right->pxNext->pxPrev = left;
+			else
+				o->pxLast = left;
+		}
+		prvBtFreeNode(o, right);
+		prvBtTake(parent, r);
+		n = parent;
+	}
+	while (!o->pxRoot->xLeaf && o->pxRoot->ulCount == 1) {	// a root over one node gives way to it
+		htBtNode_t *root = o->pxRoot;
+
+		o->pxRoot = root->apvPtr[0];
+		o->ulHeight--;
+		prvBtFreeNode(o, root);
+	}
+}
+
+// Compaction moved the entry for key to e
+static void prvOrderMoved (hashtab_t *table, unsigned key, hashent_t *e)
+{
+	htBtNode_t *n = prvBtDescend(table->pxExt->pxOrder, key, NULL, NULL);
+	unsigned i = prvBtLower(n, key);
+
+	if (i < n->ulCount && n->aulKeys[i] == key)
+		n->apvPtr[i] = e;
+}
+
+// Point the iterator at the first key from it->ulFrom on
+static void prvRangeFind (htRangeIterator_t *it)
+{
+	htOrder_t *o = it->pxTable->pxExt->pxOrder;
+	htBtNode_t *n = prvBtDescend(o, it->ulFrom, NULL, NULL);
+	unsigned i = prvBtLower(n, it->ulFrom);
+
+	if (i == n->ulCount) {		// all below it: the next leaf's first, if there is one
+		n = n->pxNext;
+		i = 0;
+	}
+	it->pvLeaf = n && n->ulCount ? n : NULL;
+	it->ulPos = i;
+	it->ulChanges = o->ulChanges;
+}
+
+hashent_t *pxHtRangeNext (htRangeIterator_t *it)
+{
+	htBtNode_t *n;
+	unsigned key;
+	hashent_t *e;
+
+	if (it->xDone)
+		return (NULL);
+	if (it->ulChanges != it->pxTable->pxExt->pxOrder->ulChanges)
+		prvRangeFind(it);		// the leaf may have changed, or gone
+	if (!(n = it->pvLeaf) || (key = n->aulKeys[it->ulPos]) > it->ulLast) {
+		it->xDone = 1;
+		return (NULL);
+	}
+	e = n->apvPtr[it->ulPos];
+	if (key == it->ulLast) {	// so ulFrom can't wrap round
+		it->xDone = 1;
+		return (e);
+	}
+	it->ulFrom = key + 1;
+	if (++it->ulPos == n->ulCount) {
+		it->pvLeaf = n->pxNext;
+		it->ulPos = 0;
+	}
+	return (e);
+}
+
+hashent_t *pxHtIRangeFirst (htRangeIterator_t *it, hashtab_t *table, unsigned first, unsigned last)
+{
+	it->pxTable = table;
+	it->ulFrom = first;
+	it->ulLast = last;
+	it->xDone = !table->pxExt->pxOrder || first > last;
+	if (!it->xDone)
+		prvRangeFind(it);
+	return (pxHtRangeNext(it));
+}
+
+hashent_t *pxHtIMin (hashtab_t *table)
+{
+	htBtNode_t *n = table->pxExt->pxOrder ? table->pxExt->pxOrder->pxFirst : NULL;
+
+	return (n && n->ulCount ? n->apvPtr[0] : NULL);
+}
+hashent_t *pxHtIMax (hashtab_t *table)
+{
+	htBtNode_t *n = table->pxExt->pxOrder ? table->pxExt->pxOrder->pxLast : NULL;
+
+	return (n && n->ulCount ? n->apvPtr[n->ulCount - 1] : NULL);
+}
+hashent_t *pxHtILowerBound (hashtab_t *table, unsigned key)
+{
+	htRangeIterator_t it;
+
+	return (pxHtIRangeFirst(&it, table, key, ~0u));
+}
+
+// **************************************************
+// Direct-address tables hold integer keys in their range in an array of
+// entries, so finding one is a bit test and a load.  Those entries are never
+// linked into a chain; prvHashLookupCom, prvInsertNew and prvRemoveEntry
+// check for the range before anything else.
+// ***************************************************
+
+static int prvDirectAlloc (hashtab_t *table, unsigned base, unsigned count)
+{
+	size_t words = ((size_t)count + 63) / 64;
+	size_t arraybytes = (size_t)count * table->ulEntrySize;
+	size_t bytes = arraybytes + words * sizeof (uint64_t);
+	char *mem;
+
+	if (count == 0 || base + (count - 1) < base || !prvOwnExt(table) || !(mem = htALLOC(table, bytes)))
+		return (0);
+	table->pxExt->pcDirect = mem;
+	table->pxExt->pxDirectBits = (uint64_t *)(mem + arraybytes);	// entries keep their alignment
+	memset(table->pxExt->pxDirectBits, 0, words * sizeof (uint64_t));
+	table->pxExt->ulDirectBase = base;
+	table->pxExt->ulDirectCount = count;
+	table->pxExt->ulDirectUsed = 0;
+	table->pxExt->ulDirectBytes = bytes;
+	return (1);
+}
+
+int iHtISetDirect (hashtab_t *table, unsigned base, unsigned count)
+{
+	if (table->pxExt->ulDirectCount || table->xMultimap || table->xCache || table->xCuckoo
+		|| table->pxExt->ppxPages || table->xHasString || table->ulKeyInline || table->ulSmallMax || table->xStatic || table->pxExt->pxCompact || table->pxExt->pxOldBuckets || table->pxExt->pxOrder) {
+		DEBUGPRINTF(TAG,"hashtable \"%s\" can't have a direct-address range", table->pcTablename);
+		return (0);
+	}
+	if (!count) {				// from the keys there, if they're dense enough
+		unsigned lo = ~0u, hi = 0;
+
+		htFOREACH(it, e, table) {
+			if (e->ulKey < lo)
+				lo = e->ulKey;
+			if (e->ulKey > hi)
+				hi = e->ulKey;
+		}
+		if (!table->ulCurEntries || (uint64_t)(hi - lo) + 1 > 4 * (uint64_t)table->ulCurEntries)
+			return (0);
+		base = lo;
+		count = hi - lo + 1;
+	}
+	if (!prvDirectAlloc(table, base, count))
+		return (0);
+	for (unsigned b = 0; b < table->ulBucketCount; b++) {
+		dlList_t *listhead = prvBucket(table, b), *next;
+
+		for (dlList_t *l = listhead->right; l != listhead; l = next) {
+			hashent_t *e = (hashent_t *)l;
+			unsigned i = e->ulKey - base;
+
+			next = l->right;
+			if (i >= count)
+				continue;
+			lDelete(l);
+			memcpy(htDIRENT(table, i), e, table->ulEntrySize);
+			htDIRENT(table, i)->xLinks.pxNext = htDIRENT(table, i)->xLinks.pxPrev = NULL;
+			table->pxExt->pxDirectBits[i >> 6] |= 1ULL << (i & 63);
+			table->pxExt->ulDirectUsed++;
+			e->pxFreelist = table->pxFreelist;
+			table->pxFreelist = e;
+		}
+	}
+	prvHotFlush(table);
+	return (1);
+}
+
+// Look for a key in a chain, dropping expired cache entries on the way.
+// Keyed tables note chains longer than they should ever be.
+static inline hashent_t *prvWalkChain (hashtab_t *table, dlList_t *listhead, unsigned key, const char *name,
+									   const uint64_t *words, size_t len)
+{
+	hashent_t *e = (hashent_t *)listhead->right;
+	unsigned steps = 0;
+
+	for (hashent_t *next; (dlList_t *)e != listhead; e = next) {
+		next = (hashent_t *)e->xLinks.right;
+		steps++;
+		if (name && table->ulKeyInline ? !prvInlineKeyMatch(table, e, words, name, len)
+			: !prvKeyMatch(e, key, name))
+			continue;
+		if (table->xCache && prvExpired(table, e)) {	// expire it now we've seen it
+			table->pxExt->xStats.ulExpired++;
+			prvDropEntry(table, e);
+			continue;
+		}
+		break;
+	}
+	if (table->pxExt->ulMaxChain && steps > table->pxExt->ulMaxChain)
+		table->xFlooded = 1;		// reseed at the next add
+	return ((dlList_t *)e != listhead ? e : NULL);
+}
+
+// Hash table lookup common routine.  Used to find the correct listhead, and if
+// the entry is present, the correct hash entry.  Returns non-zero if the entry
+// was found.  The listhead arg is where we return the list it should have been in.
+// if name is NULL, the key is used to determine a match. If not, strcmp is used
+static int prvHashLookupCom (hashtab_t *table, unsigned key, const char *name,
+				   dlList_t **listheadp, hashent_t **entry)
+{
+	htExt_t *ext = table->pxExt;
+	dlList_t *listhead;		// correct list for this name
+	hashent_t *e;			// the roamer through the list off the head
+	uint64_t words[3];		// inline key tables: the start of name, as entries hold it
+	size_t len = 0;
+	unsigned hash;
+	int bucketno;
+	
+	if (!name && key - ext->ulDirectBase < ext->ulDirectCount) {	// never, if there's no range
+		*listheadp = NULL;
+		return ((*entry = prvDirectFind(table, key)) != NULL);
+	}
+	if (table->pxSmall) {
+		*listheadp = NULL;
+		return ((*entry = prvSmallFind(table, key, name)) != NULL);
+	}
+	if (table->xCuckoo) {
+		*listheadp = NULL;
+		return ((*entry = prvCkLookup(table, key, name)) != NULL);
+	}
+	if (name && table->ulKeyInline)
+		len = prvKeyWords(table, name, words);
+	if (table->xKeyed)
+		hash = prvKeyedHash(ext->aulSeed, key, name);
+	else if (name && table->ulKeyInline)
+		hash = prvHashedWords(table, words, name, len);
+	else
+		hash = name ? prvHashedName (name) : prvHashedInt(key);
+	bucketno = hash % table->ulBucketCount;
+	*listheadp = listhead = prvBucket(table, bucketno);
+	if (ext->pxHot && !ext->pxOldBuckets) {
+		htHotSet_t *set = prvHotSet(table, hash);
+
+		ext->xStats.ulHotLookups++;
+		for (int w = 0; w < 2; w++) {
+			e = set->apxEntry[w];
+			if (!e || set->aulHash[w] != hash || !e->xLinks.right)	// vHtEDelete unlinks without telling us
+				continue;
+			if (name && table->ulKeyInline ? !prvInlineKeyMatch(table, e, words, name, len)
+				: !prvKeyMatch(e, key, name))
+				continue;
+			if (table->xCache && prvExpired(table, e))
+				break;		// the chain walk will drop it
+			if (w)
+				prvHotKeep(table, hash, e);		// now the most recent
+			ext->xStats.ulHotHits++;
+			*entry = e;
+			return (1);
+		}
+	}
+	if (ext->pxBloom && !prvBloomMayHave(table, hash)) {
+		ext->xStats.ulBloomSkips++;	// certainly not there, don't look
+		*entry = NULL;
+		return (0);
+	}
+	if ((e = prvWalkChain(table, listhead, key, name, words, len))) {
+		if (ext->pxHot && !ext->pxOldBuckets)
+			prvHotKeep(table, hash, e);
+		*entry = e;
+		return (1);
+	}
+	if ((listhead = prvOldBucket(table, key, name)) && (e = prvWalkChain(table, listhead, key, name, words, len))) {
+		*listheadp = listhead;		// not moved yet
+		*entry = e;
+		return (1);
+	}
+	if (ext->pxBloom)
+		ext->xStats.ulBloomFalsePositives++;
+	*entry = NULL;
+	return (0);
+}
+
+// In a multimap, entries with the same key are kept next to each other in
+// the chain.  Return the last of the run that starts at e.
+static hashent_t *prvLastDup (dlList_t *listhead, hashent_t *e, unsigned key, const char *name)
+{
+	hashent_t *n;
+
+	for (; (dlList_t *)(n = (hashent_t *)e->xLinks.right) != listhead; e = n) {
+		if (!prvKeyMatch(n, key, name))
+			break;
+	}
+	return (e);
+}
+hashent_t * pxHtIFindEntry (hashtab_t *table, unsigned key)
+{
+	dlList_t *listhead;
+	hashent_t *e;
+	
+	(void) prvHashLookupCom(table, key, NULL, &listhead, &e);
+	if (table->xCache)
+		prvCacheLookup(table, e);
+	return (e);
+}
+hashent_t * pxHtSFindEntry (hashtab_t *table, const char *name)
+{
+	dlList_t *listhead;
+	hashent_t *e;
+	
+	(void) prvHashLookupCom(table, 0, name, &listhead, &e);
+	if (table->xCache)
+		prvCacheLookup(table, e);
+	return (e);
+}
+
+// Values are either the pxValue union or ulValSize bytes stored in the entry
+static inline void *prvGetVal (hashtab_t *table, hashent_t *e)
+{
+	if (!e)
+		return (NULL);
+	return (table->ulValSize ? htVALPTR(table, e) : e->pxValue);
+}
+static inline void prvStoreVal (hashtab_t *table, hashent_t *e, void *value)
+{
+	if (!table->ulValSize)
+		e->pxValue = value;
+	else if (value)
+		memcpy(htVALPTR(table, e), value, table->ulValSize);
+	else
+		memset(htVALPTR(table, e), 0, table->ulValSize);
+	if (table->xCache)
+		prvCacheSet(table, e);
+}
+
+// Hash lookup general lookup routines.  Pass a name, get back a value, or not.
+void *pvHtSGetVal (hashtab_t *table, const char *name)
+{
+	dlList_t *listhead;		// dumping ground - don't need this
+	hashent_t *e;
+	
+	(void) prvHashLookupCom(table, 0, name, &listhead, &e);
+	if (table->xCache)
+		prvCacheLookup(table, e);
+	return (prvGetVal(table, e));
+}
+void *pvHtIGetVal (hashtab_t *table, unsigned key)
+{
+	dlList_t *listhead;		// dumping ground - don't need this
+	hashent_t *e;
+	
+	(void) prvHashLookupCom(table, key, NULL, &listhead, &e);
+	if (table->xCache)
+		prvCacheLookup(table, e);
+	return (prvGetVal(table, e));
+}
+
+// Same, but return where the value is kept in the entry
+void *pvHtIFindValPtr (hashtab_t *table, unsigned key)
+{
+	hashent_t *e = prvWritable(table, key, NULL) ? pxHtIFindEntry(table, key) : NULL;
+
+	return (e ? htVALPTR(table, e) : NULL);
+}
+void *pvHtSFindValPtr (hashtab_t *table, const char *name)
+{
+	hashent_t *e = prvWritable(table, 0, name) ? pxHtSFindEntry(table, name) : NULL;
+
+	return (e ? htVALPTR(table, e) : NULL);
+}
+
+// Take a free entry, give it the key and link it at the front of its bucket
+// (or after listhead, if that is an entry).  NULL if there's no room.
+static hashent_t *prvInsertNew (hashtab_t *table, dlList_t *listhead, unsigned key, const char *name)
+{
+	htExt_t *ext = table->pxExt;
+	hashent_t *e;
+	const char *given = name;
+	size_t len = 0;
+	
+	if (!name && table->ulKeyInline)
+		return (NULL);		// string keys only
+	if (ext->pxOrder && (name || !prvOrderReserve(table)))
+		return (NULL);		// integer keys only, with room in the index
+	if (!name && key - ext->ulDirectBase < ext->ulDirectCount) {
+		unsigned i = key - ext->ulDirectBase;
+
+		if (table->ulMaxEntries && table->ulCurEntries >= table->ulMaxEntries)
+			return (NULL);
+		e = htDIRENT(table, i);
+		memset(e, 0, table->ulEntrySize);	// not linked, so vHtEDelete leaves it alone
+		e->ulKey = key;
+		ext->pxDirectBits[i >> 6] |= 1ULL << (i & 63);
+		ext->ulDirectUsed++;
+		table->ulCurEntries++;
+		table->xHasInt = 1;
+		if (ext->pxOrder)
+			prvOrderInsert(table, key, e);
+		return (e);
+	}
+	if (table->ulSmallMax) {
+		if (!prvSmallFit(table))
+			return (NULL);
+		if (!table->pxSmall && !listhead)	// it just moved to chains
+			listhead = prvBucket(table, prvHashedKey(table, key, name) % table->ulBucketCount);
+	}
+	if (name && (table->xCopyKeys || table->ulKeyInline)
+		&& (len = strlen(name) + 1) <= table->ulKeyInline) {
+		len = 0;			// fits in the entry, nothing to allocate
+	} else if (len) {		// the table keeps its own copy of the key
+		char *copy;
+
+		if (!(copy = htALLOC(table, len)))
+			return (NULL);
+		name = memcpy(copy, name, len);
+	}
+	if (table->xCuckoo)
+		e = prvCkInsert(table, key, name);
+	else if (table->pxSmall)
+		e = prvSmallInsert(table, key, name);
+	else
+		e = prvNewhashent(table, (hashent_t *)listhead);
+	if (!e) {
+		if (len)
+			htFREE(table, (void *)name, len);
+		return (NULL);
+	}
+	if (len)
+		ext->ulKeyBytes += len;
+	if (name && table->ulKeyInline) {
+		uint64_t *k = htINLINEKEY(e);
+
+		k[0] = k[1] = 0;
+		if (table->ulKeyInline > 16)
+			k[2] = 0;
+		memcpy(k, given, len ? table->ulKeyInline : strlen(given) + 1);
+		if (!len)
+			name = (const char *)k;
+	}
+	if (name) {
+		e->pcName = name;
+		table->xHasString = 1;
+	} else {
+		e->ulKey = key;
+		table->xHasInt = 1;
+	}
+	if (table->xCuckoo || table->pxSmall)
+		return (e);
+	if (ext->pxBloom) {
+		if (table->ulCurEntries > 2 * ext->ulBloomKeys)
+			prvBloomRebuild(table);		// getting too full to be useful
+		prvBloomAdd(table, prvHashedKey(table, key, name));
+	}
+//	DEBUGPRINTF(TAG,"entry %p, head %p (%p, %p): ", e, listhead, listhead->pxNext, listhead->pxPrev);
+	lInsert(listhead, (dlList_t *) e);
+//	DEBUGPRINTF(TAG,"now: entry (%p, %p), head (%p, %p)", ((dlList_t *)e)->pxNext, ((dlList_t *)e)->pxPrev,listhead->pxNext, listhead->pxPrev);
+	if (ext->pxOrder)
+		prvOrderInsert(table, key, e);
+	if (table->xKeyed) {		// after linking it, since this may free the old buckets
+		if (ext->ulQuiet)
+			ext->ulQuiet--;
+		if (table->xFlooded || ext->pxOldBuckets)
+			prvRehashStep(table, htREHASH_STEP);
+	}
+	return (e);
+}
+
+// Finds an entry, selectively rewrites its value if found, adds it if not
+static int prvHtISAddVal (hashtab_t *table, int overwrite, unsigned key, const char *name, void *value)
+{
+	dlList_t *listhead;
+	hashent_t *e;
+	
+	if (!prvWritable(table, key, name))
+		return (0);
+	if (prvHashLookupCom(table, key, name, &listhead, &e)) {
+		if (overwrite == htOVERWRITE) {
+			prvStoreVal(table, e, value);
+			htCHANGED(table, e, 0);
+			return (1);
+		}
+		else if (!table->xMultimap)
+			return (0);					//   already there, we don't touch it
+		listhead = (dlList_t *)prvLastDup(listhead, e, key, name);	// add after the others
+	}
+	e = prvInsertNew(table, listhead, key, name);	// new entry, create and fill it
+	if (!e)
+		return (0);
+	prvStoreVal(table, e, value);
+	htCHANGED(table, e, 0);
+	return (1);
+}
+
+// Add a zero-valued entry and hand back its value storage to be filled in
+static void *prvHtISAddValPtr (hashtab_t *table, unsigned key, const char *name)
+{
+	dlList_t *listhead;
+	hashent_t *e;
+
+	if (!prvWritable(table, key, name) || prvHashLookupCom(table, key, name, &listhead, &e))
+		return (NULL);
+	if (!(e = prvInsertNew(table, listhead, key, name)))
+		return (NULL);
+	prvStoreVal(table, e, NULL);
+	htCHANGED(table, e, 0);
+	return (htVALPTR(table, e));
+}
+void *pvHtIAddValPtr (hashtab_t *table, unsigned key)
+{
+	return (prvHtISAddValPtr(table, key, NULL));
+}
+void *pvHtSAddValPtr (hashtab_t *table, const char *name)
+{
+	return (prvHtISAddValPtr(table, 0, name));
+}
+// Single-probe lookups that add the key if it's missing
+static hashent_t *prvHtISGetOrAdd (hashtab_t *table, unsigned key, const char *name, int *inserted)
+{
+	dlList_t *listhead;
+	hashent_t *e;
+	int found;
+
+	if (!prvWritable(table, key, name)) {
+		if (inserted)
+			*inserted = 0;
+		return (NULL);
+	}
+	found = prvHashLookupCom(table, key, name, &listhead, &e);
+	if (table->xCache)
+		prvCacheLookup(table, e);
+	if (!found && (e = prvInsertNew(table, listhead, key, name)))
+		prvStoreVal(table, e, NULL);
+	if (inserted)
+		*inserted = !found && e;
+	return (e);
+}
+static hashent_t *prvHtISGetOrAddChanged (hashtab_t *table, unsigned key, const char *name, int *inserted)
+{
+	int added;
+	hashent_t *e = prvHtISGetOrAdd(table, key, name, &added);
+
+	if (added)
+		htCHANGED(table, e, 0);
+	if (inserted)
+		*inserted = added;
+	return (e);
+}
+hashent_t *pxHtIGetOrAdd (hashtab_t *table, unsigned key, int *inserted)
+{
+	return (prvHtISGetOrAddChanged(table, key, NULL, inserted));
+}
+hashent_t *pxHtSGetOrAdd (hashtab_t *table, const char *name, int *inserted)
+{
+	return (prvHtISGetOrAddChanged(table, 0, name, inserted));
+}
+
+static void *prvHtISExchangeVal (hashtab_t *table, unsigned key, const char *name, void *value)
+{
+	int inserted;
+	hashent_t *e = prvHtISGetOrAdd(table, key, name, &inserted);
+	void *old;
+
+	if (!e)
+		return (NULL);
+	if (table->ulValSize) {				// swap the bytes through the caller's buffer
+		unsigned char *a = value, *b = htVALPTR(table, e);
+
+		for (unsigned i = 0; i < table->ulValSize; i++) {
+			unsigned char c = a[i];
+
+			a[i] = b[i];
+			b[i] = c;
+		}
+		if (table->xCache)
+			prvCacheSet(table, e);
+		htCHANGED(table, e, 0);
+		return (inserted ? NULL : value);
+	}
+	old = e->pxValue;
+	prvStoreVal(table, e, value);
+	htCHANGED(table, e, 0);
+	return (old);
+}
+void *pvHtIExchangeVal (hashtab_t *table, unsigned key, void *value)
+{
+	return (prvHtISExchangeVal(table, key, NULL, value));
+}
+void *pvHtSExchangeVal (hashtab_t *table, const char *name, void *value)
+{
+	return (prvHtISExchangeVal(table, 0, name, value));
+}
+
+static int prvAddTo (int *counter, int delta)
+{
+#ifdef __GNUC__
+	return (__atomic_add_fetch(counter, delta, __ATOMIC_RELAXED));
+#else
+	return (*counter += delta);
+#endif
+}
+int lHtEAddToVal (hashent_t *entry, int delta)
+{
+	return (prvAddTo(&entry->lValue, delta));
+}
+static int prvHtISAddToVal (hashtab_t *table, unsigned key, const char *name, int delta)
+{
+	hashent_t *e;
+	int value;
+
+	if (table->ulValSize && table->ulValSize < sizeof (int)) {
+		DEBUGPRINTF(TAG,"hashtable \"%s\" values are too small to add to", table->pcTablename);
+		return (0);
+	}
+	if (!(e = prvHtISGetOrAdd(table, key, name, NULL)))
+		return (0);
+	// an inline value needn't be where lValue is (inline keys come first)
+	value = prvAddTo(table->ulValSize ? htVALPTR(table, e) : &e->lValue, delta);
+	htCHANGED(table, e, 0);
+	return (value);
+}
+int lHtIAddToVal (hashtab_t *table, unsigned key, int delta)
+{
+	return (prvHtISAddToVal(table, key, NULL, delta));
+}
+int lHtSAddToVal (hashtab_t *table, const char *name, int delta)
+{
+	return (prvHtISAddToVal(table, 0, name, delta));
+}
+
+int iHtIAddVal (hashtab_t *table, unsigned key, void *value)
+{
+	return prvHtISAddVal (table, htNOOVERWRITE, key, NULL, value);
+}
+int iHtSAddVal (hashtab_t *table, const char *name, void *value)
+{
+	return prvHtISAddVal(table, htNOOVERWRITE, 0, name, value);
+}
+int iHtISetVal (hashtab_t *table, unsigned key, void *value)
+{
+	return prvHtISAddVal(table, htOVERWRITE, key, NULL, value);
+}
+int iHtSSetVal (hashtab_t *table, const char *name, void *value)
+{
+	return prvHtISAddVal(table, htOVERWRITE, 0, name, value);
+}
+
+// delete an entry from the hash table, if found. returns # freed, 0 or 1
+int iHtISDelete (hashtab_t *table, unsigned key, const char *name)
+{
+	dlList_t *listhead;
+	hashent_t *e;
+
+	if (prvWritable(table, key, name) && prvHashLookupCom(table, key, name, &listhead, &e)) {
+		prvRemoveEntry (table, e);
+		return (1);
+	}
+	return (0);
+}
+int iHtSDelete (hashtab_t *table, const char *name)
+{
+	return (iHtISDelete (table, 0, name));
+}
+int iHtIDelete (hashtab_t *table, unsigned key)
+{
+	return (iHtISDelete (table, key, NULL));
+}
+void vHtEDelete (hashent_t *entry)
+{
+	lDelete ((dlList_t *)entry);
+}
+
+int iHtSetChangeCallback (hashtab_t *table, htChangeCallback_t callback, void *ctx)
+{
+	if (!callback && table->pxExt == htNOEXT)
+		return (1);				// it has none
+	if (!prvOwnExt(table))
+		return (0);
+	table->pxExt->pxChangeCallback = callback;
+	table->pxExt->pvChangeCtx = ctx;
+	return (1);
+}
+void vHtSetChangeCallback (hashtab_t *table, htChangeCallback_t callback, void *ctx)
+{
+	(void) iHtSetChangeCallback(table, callback, ctx);
+}
+void vHtETouch (hashtab_t *table, hashent_t *entry)
+{
+	htCHANGED(table, entry, 0);
+}
+
+// Multimap routines.  The run of entries with one key is found with a
+// single lookup and then walked (or counted, or deleted) in place.
+static void prvNextDup (htDupIterator_t *it)
+{
+	hashent_t *n;
+
+	if (it->pxTable->xCuckoo || it->pxTable->pxSmall) {		// no duplicates, and no chain to follow
+		it->pxNext = NULL;
+		return;
+	}
+	n = (hashent_t *)it->pxNext->xLinks.right;
+	if ((dlList_t *)n == it->pxHead || !prvKeyMatch(n, it->ulKey, it->pcName))
+		n = NULL;
+	it->pxNext = n;
+}
+static hashent_t *prvFindFirst (htDupIterator_t *it, hashtab_t *table, unsigned key, const char *name)
+{
+	it->pxTable = table;
+	it->ulKey = key;
+	it->pcName = name;
+	(void) prvHashLookupCom(table, key, name, &it->pxHead, &it->pxNext);
+	return (pxHtFindNext(it));
+}
+hashent_t *pxHtIFindFirst (htDupIterator_t *it, hashtab_t *table, unsigned key)
+{
+	return (prvFindFirst(it, table, key, NULL));
+}
+hashent_t *pxHtSFindFirst (htDupIterator_t *it, hashtab_t *table, const char *name)
+{
+	return (prvFindFirst(it, table, 0, name));
+}
+hashent_t *pxHtFindNext (htDupIterator_t *it)
+{
+	hashent_t *retval = it->pxNext;
+
+	if (retval)
+		prvNextDup(it);
+	return (retval);
+}
+
+static unsigned prvHtISCount (hashtab_t *table, unsigned key, const char *name)
+{
+	htDupIterator_t it;
+	unsigned count = 0;
+
+	for (hashent_t *e = prvFindFirst(&it, table, key, name); e; e = pxHtFindNext(&it))
+		count++;
+	return (count);
+}
+unsigned ulHtICount (hashtab_t *table, unsigned key)
+{
+	return (prvHtISCount(table, key, NULL));
+}
+unsigned ulHtSCount (hashtab_t *table, const char *name)
+{
+	return (prvHtISCount(table, 0, name));
+}
+
+// delete the entries for a key, all of them or only those holding value
+static int prvHtISDeleteDups (hashtab_t *table, unsigned key, const char *name, int all, void *value)
+{
+	htDupIterator_t it;
+	int deleted = 0;
+
+	if (!prvWritable(table, key, name))
+		return (0);
+	for (hashent_t *e = prvFindFirst(&it, table, key, name); e; e = pxHtFindNext(&it)) {
+		if (!all && (table->ulValSize ? memcmp(htVALPTR(table, e), value, table->ulValSize) != 0
+										: e->pxValue != value))
+			continue;
+		prvRemoveEntry (table, e);
+		deleted++;
+		if (!all)
+			break;
+	}
+	return (deleted);
+}
+int iHtIDeleteAll (hashtab_t *table, unsigned key)
+{
+	return (prvHtISDeleteDups(table, key, NULL, 1, NULL));
+}
+int iHtSDeleteAll (hashtab_t *table, const char *name)
+{
+	return (prvHtISDeleteDups(table, 0, name, 1, NULL));
+}
+int iHtIDeleteVal (hashtab_t *table, unsigned key, void *value)
+{
+	return (prvHtISDeleteDups(table, key, NULL, 0, value));
+}
+int iHtSDeleteVal (hashtab_t *table, const char *name, void *value)
+{
+	return (prvHtISDeleteDups(table, 0, name, 0, value));
+}
+
+static inline unsigned prvIterBuckets (hashtab_t *table)
+{
+	return (table->pxExt->pxOldBuckets ? 2 * table->ulBucketCount : table->ulBucketCount);
+}
+static inline dlList_t *prvIterBucket (hashtab_t *table, unsigned b)
+{
+	return (b < table->ulBucketCount ? prvBucket(table, b) : &table->pxExt->pxOldBuckets[b - table->ulBucketCount]);
+}
+
+static void prvNextentry (htIterator_t *it) {
+	hashtab_t *table = it->pxTable;
+
+	// the direct-address array comes first, then the chains from the first
+	if (table->pxExt->ulDirectCount && it->ulDirect != ~0u) {
+		while (it->ulDirect < table->pxExt->ulDirectCount) {
+			unsigned i = it->ulDirect++;
+
+			if (!(i & 63) && !table->pxExt->pxDirectBits[i >> 6])
+				it->ulDirect = i + 64;		// none in this word
+			else if (htDIRBIT(table, i)) {
+				it->pxNext = htDIRENT(table, i);
+				return;
+			}
+		}
+		it->ulDirect = ~0u;			// done with it
+		it->pxNext = (hashent_t *)it->pxHead;
+	}
+	if (it->pxTable->xCuckoo) {
+		prvCkNextentry(it);
+		return;
+	}
+	if (table->pxSmall) {			// from the end, so deletes only move entries already seen
+		it->pxNext = it->ulBucket ? htSMALLENT(table, table->pxSmall, --it->ulBucket) : NULL;
+		return;
+	}
+	// step through the buckets, and for each, step through the chain
+	// (following the chain to the head it started from, which in a table
+	// sharing pages is the clone's if the page was copied meanwhile)
+	// (and in a keyed table being rehashed, the old buckets after the new)
+	while (it->ulBucket < prvIterBuckets(table)) {
+		if((it->pxNext = (hashent_t *)((dlList_t *)it->pxNext)->right) != (hashent_t *)it->pxHead) {
+			return;
+		}
+		if (++it->ulBucket < prvIterBuckets(table))
+			it->pxNext = (hashent_t *)(it->pxHead = prvIterBucket(table, it->ulBucket));
+	}
+	it->pxNext = NULL;
+}
+void vHtInitIterator (htIterator_t *it, hashtab_t *table)
+{
+	it->pxTable = table;
+	it->ulBucket = table->pxSmall ? table->pxSmall->ulCount : 0;
+	it->ulStash = table->xCuckoo ? table->pxCuckoo->ulStashCount : 0;
+	it->ulDirect = 0;
+	it->pxHead = table->xCuckoo || table->pxSmall ? NULL : prvBucket(table, 0);
+	it->pxNext = (hashent_t *)it->pxHead;
+	it->pxCur = NULL;
+	// find the next/first entry, if there are any
+	prvNextentry(it);
+}
+hashent_t *pxHtIteratorNext (htIterator_t *it)
+{
+	hashent_t *retval = it->pxNext;
+	
+	it->pxCur = retval;
+	prvNextentry(it);
+	return (retval);
+}
+
+// **************************************************
+// We are making hash tables into a rsrc resource.  We can in the future,
+// once we keep track of hash table mallocs, make it possible to free them
+// up.  For now, we create a pool of hash tables -- once -- and then allocate
+// new ones from that pool when they are created.  Hash entry blocks could also
+// be allocated using rsrc, which might make sense, but we don't for now.
+// ***************************************************
+
+rsrcPoolP_t xHashTablePool;	// allocated once, when first needed
+
+// The "long" print routine for hash table resources calls this
+static void prvPrintStatWrapper (rsrcPoolP_t pool, void *body)
+{
+	vHtPrintStats ((hashtab_t *)body);
+}
+void static inline initHashtabPool ()
+{
+	if (xHashTablePool)
+		return;
 	xHashTablePool = pxRsrcNewDynPool("HashTables", sizeof (hashtab_t), 0);
 	if (!xHashTablePool) {
 		logPrintf(TAG,"Can't allocate HASHTables rsrc pool, aborting now%s", "");
 		abort();
 	}
-	vRsrcSetPrintHelper(xHashTablePool, prvPrintStatWrapper);
+	vRsrcSetPrintHelper(xHashTablePool, prvPrintStatWrapper);
+}
+
+// Allocate and initialize a hash table
+hashtab_t *pxHtNewHashTable (const char *tablename, size_t initentries, size_t maxentries, unsigned entryincrement, unsigned numbuckets)
+{
+	return (pxHtNewHashTableEx(tablename, initentries, maxentries, entryincrement, numbuckets, NULL));
+}
+// Lay out an entry for a table with config: an inline value starts where the
+// union does, moved up if it needs more alignment, and entries are spaced to
+// keep it aligned.  0 if config asks for something impossible.
+static int prvLayout (const htConfig_t *config, unsigned *valoffsetp, unsigned *entrysizep, unsigned *entryoffsetp)
+{
+	unsigned align, valoffset, entrysize, entryoffset;
+
+	align = config->ulValAlign ? config->ulValAlign : sizeof (void *);
+	if (align > htMAX_VALALIGN || (align & (align - 1))) {
+		DEBUGPRINTF(TAG,"bad value alignment %u for hashtable", align);
+		return (0);
+	}
+	if (align < sizeof (void *))
+		align = sizeof (void *);
+	if (config->ulInlineKeys && config->ulInlineKeys != 16 && config->ulInlineKeys != 24) {
+		DEBUGPRINTF(TAG,"inline keys must be 16 or 24 bytes, not %u", config->ulInlineKeys);
+		return (0);
+	}
+	// inline keys go after the hashent_t, and an inline value after them
+	valoffset = offsetof(hashent_t, pxValue);
+	if (config->ulInlineKeys && config->ulValSize)
+		valoffset = sizeof (hashent_t) + config->ulInlineKeys;
+	valoffset = (valoffset + align - 1) & ~(align - 1);
+	entrysize = sizeof (hashent_t) + config->ulInlineKeys;
+	if (valoffset + config->ulValSize > entrysize)
+		entrysize = valoffset + config->ulValSize;
+	entrysize = (entrysize + align - 1) & ~(align - 1);
+	// cache tables have their CLOCK and expiry information just before the entry
+	entryoffset = 0;
+	if (config->xCache)
+		entryoffset = (sizeof (htCacheMeta_t) + align - 1) & ~(align - 1);
+	entrysize += entryoffset;
+	*valoffsetp = valoffset;
+	*entrysizep = entrysize;
+	*entryoffsetp = entryoffset;
+	return (1);
+}
+
+size_t ulHtEntrySize (const htConfig_t *config)
+{
+	static const htConfig_t defaults;
+	unsigned valoffset, entrysize, entryoffset;
+
+	return (prvLayout(config ? config : &defaults, &valoffset, &entrysize, &entryoffset) ? entrysize : 0);
+}
+
+// Whether a table made with config needs its own htExt_t from the start
+static int prvNeedsExt (const htConfig_t *config)
+{
+	return (config->xCache || config->xBloom || config->xCopyKeys || config->ulInlineKeys
+			|| config->ulDirectKeys || config->xKeyedHash || config->ulHotKeys || config->xOrdered);
+}
+
+// Set up the fields every kind of table has from its settings.  The buckets
+// or other store, the allocator, pxExt and ulEntrySize are set by the
+// caller; the rest of a new htExt_t starts zeroed.
+static void prvInitTable (hashtab_t *tab, const char *tablename, size_t maxentries, unsigned entryincrement,
+						  unsigned valoffset, unsigned entryoffset, const htConfig_t *config)
+{
+	htExt_t *ext = tab->pxExt;
+
+	tab->pcTablename = tablename;
+	tab->ulEntryOffset = entryoffset;
+	tab->ulValOffset = valoffset;
+	tab->ulValSize = config->ulValSize;
+	tab->xMultimap = config->xMultimap;
+	tab->xCopyKeys = config->xCopyKeys;
+	tab->ulKeyInline = config->ulInlineKeys;
+	tab->xHasString = tab->xHasInt = 0;
+	tab->xStatic = 0;
+	tab->pxSlabs = NULL;
+	tab->xKeyed = config->xKeyedHash;
+	tab->xFlooded = 0;
+	if (tab->xKeyed) {
+		ext->ulMaxChain = config->ulMaxChain ? config->ulMaxChain : htMAXCHAIN;
+		prvNewSeed(tab, ext->aulSeed);
+	}
+	tab->ulSlabBytes = 0;
+	tab->xCache = config->xCache;
+	if (tab->xCache) {
+		ext->ulTtl = config->ulTtl;
+		ext->pxEvictCallback = config->pxEvictCallback;
+		ext->pvEvictCtx = config->pvEvictCtx;
+	}
+	tab->ulMaxEntries = maxentries;
+	tab->ulCurEntries = 0;
+	tab->ulAllocSize = entryincrement;
+	tab->ulAllocMax = config->ulAllocMax > entryincrement ? config->ulAllocMax : 0;
+	tab->pxFreelist = NULL;
+	tab->ulSmallMax = 0;
+	if (config->ulSmallKeys) {
+		unsigned max = config->ulSmallKeys < htSMALLLIMIT ? config->ulSmallKeys : htSMALLLIMIT;
+
+		tab->ulSmallMax = (max + 7) & ~7;
+	}
+}
+
+hashtab_t *pxHtNewHashTableEx (const char *tablename, size_t initentries, size_t maxentries, unsigned entryincrement, unsigned numbuckets, const htConfig_t *config)
+{
+	static const htConfig_t defaults;
+	hashtab_t *tab;
+	dlList_t *listheads;
+	unsigned valoffset, entrysize, entryoffset;
+	int i;
+	
+	initHashtabPool();
+	
+	if (!config)
+		config = &defaults;
+	if (entryincrement > htMAX_ALLOCSIZE) {
+		entryincrement = htMAX_ALLOCSIZE;
+	}
+	if (!prvLayout(config, &valoffset, &entrysize, &entryoffset))
+		return (NULL);
+	if (config->xCuckoo && (config->xMultimap || config->xCache || config->xBloom || config->ulInlineKeys)) {
+		DEBUGPRINTF(TAG,"cuckoo hashtables can't be multimaps, caches, or have Bloom filters or inline keys%s", "");
+		return (NULL);
+	}
+	if (config->ulDirectKeys && (config->xCuckoo || config->xMultimap || config->xCache || config->ulInlineKeys)) {
+		DEBUGPRINTF(TAG,"direct-address hashtables can't be cuckoo tables, multimaps, caches, or have inline keys%s", "");
+		return (NULL);
+	}
+	if (config->ulSmallKeys && (config->xCuckoo || config->xMultimap || config->xCache || config->xBloom
+								|| config->ulInlineKeys || config->ulDirectKeys)) {
+		DEBUGPRINTF(TAG,"small hashtables can't be cuckoo tables, multimaps, caches, or have Bloom filters, inline keys or direct-address ranges%s", "");
+		return (NULL);
+	}
+	if (config->xKeyedHash && (config->xCuckoo || config->xBloom || config->ulSmallKeys)) {
+		DEBUGPRINTF(TAG,"keyed hashtables can't be cuckoo or small tables, or have Bloom filters%s", "");
+		return (NULL);
+	}
+	if (config->ulHotKeys && (config->xCuckoo || config->ulSmallKeys)) {
+		DEBUGPRINTF(TAG,"cuckoo and small hashtables can't have hot key caches%s", "");
+		return (NULL);
+	}
+	if (config->xOrdered && (config->xCuckoo || config->ulSmallKeys || config->xMultimap || config->ulInlineKeys)) {
+		DEBUGPRINTF(TAG,"ordered hashtables can't be cuckoo or small tables, multimaps, or have inline keys%s", "");
+		return (NULL);
+	}
+	tab = pxRsrcAlloc(xHashTablePool, tablename);
+	numbuckets |= 1;	// avoid degenerate case of even bucket count
+	if (tab) {
+		tab->pxAlloc = config->pxAlloc ? config->pxAlloc : prvDefaultAlloc;
+		tab->pxFree = config->pxFree ? config->pxFree : prvDefaultFree;
+		tab->pvAllocCtx = config->pvAllocCtx;
+		tab->pxExt = htNOEXT;
+		if (prvNeedsExt(config) && !prvOwnExt(tab)) {
+			vRsrcFree(tab);
+			tab = NULL;
+		}
+	}
+	if (tab) {
+		tab->ulEntrySize = entrysize;
+		tab->xCuckoo = config->xCuckoo;
+		tab->pxSmall = NULL;
+		listheads = NULL;
+	}
+	if (tab == NULL
+		|| (config->xCuckoo ? !prvCkCreate(tab, numbuckets, initentries)
+			: config->ulSmallKeys ? !(tab->pxSmall = prvSmallAlloc(tab, htSMALLFIRST))	// buckets come later
+			: (listheads = (dlList_t *)htALLOC(tab, sizeof (dlList_t) * numbuckets)) == NULL)) {
+		DEBUGPRINTF(TAG,"unable to allocate buckets/entries for hashtable%s", "");
+		if (tab)
+			prvFreeTable(tab);	// safe to delete, no other storage will be lost
+		return (NULL);
+	}
+	if (!tab->xCuckoo) {
+		for (i = 0; listheads && i < numbuckets; i++) {
+			LLINKSINIT(&listheads[i]);
+		}
+		tab->pxCuckoo = NULL;
+		tab->ulBucketCount = numbuckets;
+		tab->ulBucketBytes = listheads ? sizeof (dlList_t) * numbuckets : 0;
+	}
+	tab->pxBuckets = listheads;
+	prvInitTable(tab, tablename, maxentries, entryincrement, valoffset, entryoffset, config);
+	if (config->xBloom && !prvBloomAlloc(tab, config->ulBloomKeys ? config->ulBloomKeys
+											 : initentries ? initentries : numbuckets)) {
+		DEBUGPRINTF(TAG,"unable to allocate Bloom filter for hashtable%s", "");
+		htFREE(tab, listheads, tab->ulBucketBytes);
+		prvFreeTable(tab);
+		return (NULL);
+	}
+	if ((config->ulDirectKeys && !prvDirectAlloc(tab, config->ulDirectBase, config->ulDirectKeys))
+		|| (config->ulHotKeys && !prvHotAlloc(tab, config->ulHotKeys))
+		|| (config->xOrdered && !prvOrderAlloc(tab))) {
+		DEBUGPRINTF(TAG,"unable to allocate direct-address array, hot key cache or ordered index for hashtable%s", "");
+		if (tab->pxExt->pxHot)
+			htFREE(tab, tab->pxExt->pxHot, (tab->pxExt->ulHotMask + 1) * sizeof (htHotSet_t));
+		if (tab->pxExt->pcDirect)
+			htFREE(tab, tab->pxExt->pcDirect, tab->pxExt->ulDirectBytes);
+		if (tab->pxExt->pvBloomMem)
+			htFREE(tab, tab->pxExt->pvBloomMem, tab->pxExt->ulBloomBytes);
+		htFREE(tab, listheads, tab->ulBucketBytes);
+		prvFreeTable(tab);
+		return (NULL);
+	}
+	if (!tab->xCuckoo && !tab->pxSmall)
+		prvMorefree(tab, initentries);
+	return (tab);
+}
+
+// Static tables never allocate: anything that would gets nothing
+static void *prvNoAlloc (size_t size, void *ctx)
+{
+	return (NULL);
+}
+static void prvNoFree (void *ptr, size_t size, void *ctx)
+{
+}
+
+hashtab_t *pxHtNewStaticTable (hashtab_t *tab, const char *tablename, Link_t *buckets, unsigned numbuckets,
+							   void *entries, size_t entrybytes, const htConfig_t *config)
+{
+	static const htConfig_t defaults;
+	unsigned valoffset, entrysize, entryoffset;
+	uintptr_t start;
+	size_t count;
+	char *slot;
+
+	if (!config)
+		config = &defaults;
+	if (!prvLayout(config, &valoffset, &entrysize, &entryoffset))
+		return (NULL);
+	if (config->xCuckoo || config->xBloom || config->ulDirectKeys || config->ulSmallKeys
+		|| config->xCopyKeys || config->ulAllocMax || config->ulHotKeys || config->xOrdered) {
+		DEBUGPRINTF(TAG,"static hashtables can't be cuckoo, small or ordered tables, copy keys, grow, or have Bloom filters, direct-address ranges or hot key caches%s", "");
+		return (NULL);
+	}
+	if (numbuckets > 1 && !(numbuckets & 1))
+		numbuckets--;		// avoid degenerate case of even bucket count
+	// the table's htExt_t comes first, then the entries
+	start = ((uintptr_t)entries + htMAX_VALALIGN - 1) & ~(uintptr_t)(htMAX_VALALIGN - 1);
+	count = entrybytes > start - (uintptr_t)entries + htSTATIC_EXTBYTES
+		? (entrybytes - (start - (uintptr_t)entries) - htSTATIC_EXTBYTES) / entrysize : 0;
+	if (!tab || !buckets || !numbuckets || !count) {
+		DEBUGPRINTF(TAG,"no room for buckets/entries for static hashtable \"%s\"", tablename);
+		return (NULL);
+	}
+	tab->pxAlloc = prvNoAlloc;
+	tab->pxFree = prvNoFree;
+	tab->pvAllocCtx = NULL;
+	tab->pxExt = (htExt_t *)start;
+	prvInitExt(tab->pxExt);
+	start += htSTATIC_EXTBYTES;
+	tab->ulEntrySize = entrysize;
+	tab->xCuckoo = 0;
+	tab->pxCuckoo = NULL;
+	tab->pxSmall = NULL;
+	for (unsigned i = 0; i < numbuckets; i++)
+		LLINKSINIT(&buckets[i]);
+	tab->pxBuckets = buckets;
+	tab->ulBucketCount = numbuckets;
+	tab->ulBucketBytes = sizeof (dlList_t) * numbuckets;
+	prvInitTable(tab, tablename, count, 0, valoffset, entryoffset, config);
+	tab->xStatic = 1;
+	tab->ulSlabBytes = count * entrysize;
+	slot = (char *)start;
+	for (size_t i = 0; i < count; i++, slot += entrysize) {
+		hashent_t *e = (hashent_t *)(slot + entryoffset);
+
+		e->pxFreelist = tab->pxFreelist;
+		tab->pxFreelist = e;
+	}
+	return (tab);
+}
+
+static void prvCompactDone (hashtab_t *table);
+
+// Give back everything a table holds.  Tables in an arena just give back the
+// table, since their memory is all released when the arena is deleted.
+void vHtFreeHashTable (hashtab_t *table)
+{
+	htExt_t *ext = table->pxExt;
+
+	if (table->xStatic)
+		return;			// all the caller's
+	if (table->pxFree != vHtArenaFree) {
+		if (ext->ppxPages) {		// cloned: only what no other table still uses
+			for (unsigned p = 0; p < htNPAGES(table); p++)
+				prvReleasePage(table, ext->ppxPages[p], prvPageBuckets(table, p));
+			htFREE(table, ext->ppxPages, htNPAGES(table) * sizeof (htPage_t *));
+			prvReleaseShared(table, ext->pxShared);
+		} else if ((table->xCopyKeys || table->ulKeyInline) && table->xHasString) {
+			htFOREACH(it, e, table) {
+				if (prvOwnsKey(table, e))
+					htFREE(table, (void *)e->pcName, strlen(e->pcName) + 1);
+			}
+		}
+		if (ext->pxCompact)
+			prvCompactDone(table);
+		if (ext->pxOldBuckets)
+			htFREE(table, ext->pxOldBuckets, table->ulBucketBytes);
+		prvFreeSlabs(table);
+		if (table->xCuckoo)
+			prvCkFree(table);
+		else if (table->pxSmall)
+			htFREE(table, table->pxSmall, htSMALLBYTES(table, table->pxSmall->ulCap));
+		else if (!ext->ppxPages)
+			htFREE(table, table->pxBuckets, table->ulBucketBytes);
+		if (ext->pvBloomMem)
+			htFREE(table, ext->pvBloomMem, ext->ulBloomBytes);
+		if (ext->pcDirect)
+			htFREE(table, ext->pcDirect, ext->ulDirectBytes);
+		if (ext->pxHot)
+			htFREE(table, ext->pxHot, (ext->ulHotMask + 1) * sizeof (htHotSet_t));
+		if (ext->pxOrder)
+			prvOrderFree(table);
+	}
+	prvFreeTable(table);
 }
 
-// Allocate and initialize a hash table
-hashtab_t *pxHtNewHashTable (const char *tablename, unsigned initentries, unsigned maxentries, unsigned entryincrement, unsigned numbuckets)
+// **************************************************
+// Set operations.  Both tables are walked by key only; the smaller one is
+// gathered into an array and its keys looked up in the larger, in batches
+// whose buckets are prefetched together so their cache misses overlap.
+// Those probes change nothing in the table probed (no expiry, no
+// statistics), so big batches can be split between threads.  The result
+// table is then built from the probe results on the calling thread.
+// ***************************************************
+
+#define htPROBEBATCH	16			// lookups whose buckets are fetched together
+#define htPARALLELMIN	65536		// fewer probes than this aren't worth threads
+#define htMAXTHREADS	64
+
+enum { htUNION, htINTERSECTION, htDIFFERENCE };
+
+// Find a key in table without touching anything in it
+static hashent_t *prvPeek (hashtab_t *table, hashent_t *k, unsigned hash, int isname)
 {
-	hashtab_t *tab;
-	dlList_t *listheads;
-	int i;
-	
-	initHashtabPool();
-	
-	if (entryincrement > htMAX_ALLOCSIZE) {
-		entryincrement = htMAX_ALLOCSIZE;
+	const char *name = isname ? k->pcName : NULL;
+	dlList_t *listhead;
+
+	if (!name && k->ulKey - table->pxExt->ulDirectBase < table->pxExt->ulDirectCount)
+		return (prvDirectFind(table, k->ulKey));
+	if (table->xCuckoo)
+		return (prvCkLookup(table, k->ulKey, name));
+	if (table->pxSmall)
+		return (prvSmallFind(table, k->ulKey, name));
+	if (table->pxExt->pxBloom && !prvBloomMayHave(table, hash))
+		return (NULL);
+	listhead = prvBucket(table, hash % table->ulBucketCount);
+	for (dlList_t *l = listhead->right; l != listhead; l = l->right) {
+		if (prvKeyMatch((hashent_t *)l, k->ulKey, name))
+			return ((hashent_t *)l);
 	}
-	tab = pxRsrcAlloc(xHashTablePool, tablename);
-	numbuckets |= 1;	// avoid degenerate case of even bucket count
-	if (tab == NULL
-		|| (listheads = (dlList_t *)malloc(sizeof (dlList_t) * numbuckets)) == NULL) {
-		DEBUGPRINTF(TAG,"unable to allocate buckets/entries for hashtable%s", "");
-		if (tab)
-			vRsrcFree(tab);	// safe to delete, no storage will be lost
+	if ((listhead = prvOldBucket(table, k->ulKey, name))) {		// not moved yet
+		for (dlList_t *l = listhead->right; l != listhead; l = l->right) {
+			if (prvKeyMatch((hashent_t *)l, k->ulKey, name))
+				return ((hashent_t *)l);
+		}
+	}
+	return (NULL);
+}
+
+// Look up the keys of n entries in table, setting found[i] to the matching
+// entry or NULL
+static void prvProbeBatch (hashtab_t *table, hashent_t **keys, hashent_t **found, size_t n, int isname)
+{
+	unsigned hashes[htPROBEBATCH];
+
+	for (size_t i = 0; i < n; i += htPROBEBATCH) {
+		unsigned m = n - i < htPROBEBATCH ? n - i : htPROBEBATCH;
+
+		// ask for the buckets, then the first entry of each chain, then look
+		for (unsigned j = 0; j < m; j++) {
+			hashent_t *k = keys[i + j];
+
+			hashes[j] = prvHashedKey(table, k->ulKey, isname ? k->pcName : NULL);
+			if (!table->xCuckoo && !table->pxSmall)
+				__builtin_prefetch(prvBucket(table, hashes[j] % table->ulBucketCount));
+		}
+		for (unsigned j = 0; !table->xCuckoo && !table->pxSmall && j < m; j++)
+			__builtin_prefetch(prvBucket(table, hashes[j] % table->ulBucketCount)->right);
+		for (unsigned j = 0; j < m; j++)
+			found[i + j] = prvPeek(table, keys[i + j], hashes[j], isname);
+	}
+}
+
+#ifdef htTHREADS
+typedef struct {
+	hashtab_t *pxTable;
+	hashent_t **ppxKeys;
+	hashent_t **ppxFound;
+	size_t ulCount;
+	int xIsName;
+} htProbeJob_t;
+
+static void *prvProbeThread (void *arg)
+{
+	htProbeJob_t *job = arg;
+
+	prvProbeBatch(job->pxTable, job->ppxKeys, job->ppxFound, job->ulCount, job->xIsName);
+	return (NULL);
+}
+#endif
+
+// Probe for all n keys, on up to threads threads if there are enough of them
+static void prvProbeAll (hashtab_t *table, hashent_t **keys, hashent_t **found,
+						 size_t n, int isname, unsigned threads)
+{
+#ifdef htTHREADS
+	if (threads > htMAXTHREADS)
+		threads = htMAXTHREADS;
+	if (threads > 1 && n >= htPARALLELMIN) {
+		pthread_t tids[htMAXTHREADS];
+		htProbeJob_t jobs[htMAXTHREADS];
+		int started[htMAXTHREADS];
+		size_t slice = (n + threads - 1) / threads;
+
+		for (unsigned t = 0; t < threads; t++) {
+			size_t first = t * slice;
+
+			jobs[t] = (htProbeJob_t){ table, keys + first, found + first,
+									  first >= n ? 0 : (n - first < slice ? n - first : slice), isname };
+			// the last slice is done here, as is any a thread couldn't be started for
+			started[t] = t + 1 < threads && pthread_create(&tids[t], NULL, prvProbeThread, &jobs[t]) == 0;
+			if (!started[t])
+				prvProbeThread(&jobs[t]);
+		}
+		for (unsigned t = 0; t < threads; t++) {
+			if (started[t])
+				pthread_join(tids[t], NULL);
+		}
+		return;
+	}
+#endif
+	prvProbeBatch(table, keys, found, n, isname);
+}
+
+// Add e's key and value from src to the result table, or just its value if
+// the key is there already and overwrite is set
+static int prvAddFrom (hashtab_t *res, hashtab_t *src, hashent_t *e, int isname, int overwrite)
+{
+	int inserted;
+	hashent_t *n = isname ? pxHtSGetOrAdd(res, e->pcName, &inserted) : pxHtIGetOrAdd(res, e->ulKey, &inserted);
+
+	if (!n)
+		return (0);
+	if (inserted || overwrite) {
+		if (res->ulValSize)
+			memcpy(htVALPTR(res, n), htVALPTR(src, e), res->ulValSize);
+		else
+			n->pxValue = e->pxValue;
+	}
+	return (1);
+}
+
+static hashtab_t *prvSetOp (const char *tablename, hashtab_t *a, hashtab_t *b, int op, unsigned threads)
+{
+	int isname = a->xHasString || b->xHasString;
+	hashtab_t *small = a->ulCurEntries <= b->ulCurEntries ? a : b;
+	hashtab_t *large = small == a ? b : a;
+	hashent_t **keys = NULL, **found = NULL;
+	size_t n = small->ulCurEntries, nfound = 0, estimate, i = 0;
+	unsigned align;
+	hashtab_t *res = NULL;
+	int ok = 1;
+
+	if ((a->xHasString && a->xHasInt) || (b->xHasString && b->xHasInt)
+		|| (a->xHasString && b->xHasInt) || (a->xHasInt && b->xHasString)) {
+		DEBUGPRINTF(TAG,"tables \"%s\" and \"%s\" don't have the same kind of keys", a->pcTablename, b->pcTablename);
 		return (NULL);
 	}
-	for (i = 0; i < numbuckets; i++) {
-		LLINKSINIT(&listheads[i]);
+	if (a->ulValSize != b->ulValSize) {
+		DEBUGPRINTF(TAG,"tables \"%s\" and \"%s\" have different inline value sizes", a->pcTablename, b->pcTablename);
+		return (NULL);
 	}
-	tab->pcTablename = tablename;
-	tab->ulMaxEntries = maxentries;
-	tab->ulCurEntries = 0;
-	tab->ulAllocSize = entryincrement;
-	tab->ulBucketCount = numbuckets;
-	tab->pxBuckets = listheads;
-	tab->pxFreelist = NULL;
-	prvMorefree(tab, initentries);
-	return (tab);
+	if (n && (!(keys = malloc(sizeof (hashent_t *) * n)) || !(found = malloc(sizeof (hashent_t *) * n)))) {
+		free(keys);
+		return (NULL);
+	}
+	{
+		htFOREACH(it, e, small) {
+			keys[i++] = e;
+		}
+	}
+	prvProbeAll(large, keys, found, n, isname, threads);
+	for (i = 0; i < n; i++)
+		nfound += found[i] != NULL;
+
+	if (op == htINTERSECTION)
+		estimate = nfound;
+	else if (op == htUNION)
+		estimate = large->ulCurEntries + n - nfound;
+	else
+		estimate = small == a ? n - nfound : a->ulCurEntries - nfound;
+	// the largest power of 2 the source entries are spaced by is at least
+	// the alignment their inline values asked for
+	align = a->ulEntrySize & -a->ulEntrySize;
+	res = pxHtNewHashTableEx (tablename, estimate, 0, 64, estimate > UINT_MAX ? UINT_MAX : (unsigned)estimate,
+							  &(htConfig_t){ .ulValSize = a->ulValSize,
+											 .ulValAlign = align > htMAX_VALALIGN ? htMAX_VALALIGN : align,
+											 .xCopyKeys = isname && !a->ulKeyInline,
+											 .ulInlineKeys = isname ? a->ulKeyInline : 0 });
+	if (res) {
+		switch (op) {
+		case htINTERSECTION:	// values come from a
+			for (i = 0; ok && i < n; i++) {
+				if (found[i])
+					ok = prvAddFrom(res, a, small == a ? keys[i] : found[i], isname, 0);
+			}
+			break;
+		case htUNION: {			// everything in the larger, then the rest; a's values win
+			htFOREACH(it, e, large) {
+				ok = ok && prvAddFrom(res, large, e, isname, 0);
+			}
+			for (i = 0; ok && i < n; i++) {
+				if (!found[i] || small == a)
+					ok = prvAddFrom(res, small, keys[i], isname, small == a);
+			}
+			break;
+		}
+		case htDIFFERENCE:		// keys of a that aren't in b
+			if (small == a) {
+				for (i = 0; ok && i < n; i++) {
+					if (!found[i])
+						ok = prvAddFrom(res, a, keys[i], isname, 0);
+				}
+			} else {
+				htFOREACH(it, e, a) {
+					ok = ok && prvAddFrom(res, a, e, isname, 0);
+				}
+				for (i = 0; i < n; i++) {
+					if (found[i] && isname)
+						iHtSDelete(res, found[i]->pcName);
+					else if (found[i])
+						iHtIDelete(res, found[i]->ulKey);
+				}
+			}
+			break;
+		}
+	}
+	if (res && !ok) {
+		DEBUGPRINTF(TAG,"no room for the result of a set operation in \"%s\"", tablename);
+		vHtFreeHashTable(res);
+		res = NULL;
+	}
+	free(keys);
+	free(found);
+	return (res);
+}
+
+hashtab_t *pxHtUnion (const char *tablename, hashtab_t *a, hashtab_t *b, unsigned threads)
+{
+	return (prvSetOp(tablename, a, b, htUNION, threads));
+}
+hashtab_t *pxHtIntersection (const char *tablename, hashtab_t *a, hashtab_t *b, unsigned threads)
+{
+	return (prvSetOp(tablename, a, b, htINTERSECTION, threads));
+}
+hashtab_t *pxHtDifference (const char *tablename, hashtab_t *a, hashtab_t *b, unsigned threads)
+{
+	return (prvSetOp(tablename, a, b, htDIFFERENCE, threads));
+}
+
+// **************************************************
+// Removing entries the caller already has, without looking them up again.
+// RemoveIf is one pass of the iterator, removing each entry to go as it's
+// returned.  With threads, each thread takes a share of the buckets, asks
+// the predicate about the entries in its chains and moves the ones to go
+// onto a list of its own (only it touches those chains), and the calling
+// thread removes everything on the lists after, since that changes the
+// free list, the counts and whatever else the table keeps.
+// ***************************************************
+
+// An entry in a page shared with a clone is the other table's too: the page
+// is copied, and the table's own copy of the entry, found by its key and
+// value, is the one removed.
+int iHtDeleteEntry (hashtab_t *table, hashent_t *entry)
+{
+	if (!entry)
+		return (0);
+	if (table->pxExt->ppxPages) {
+		if (table->xHasString && table->xHasInt)
+			return (0);		// no telling which kind of key it has
+		return (prvHtISDeleteDups(table, entry->ulKey, table->xHasString ? entry->pcName : NULL, 0,
+								  table->ulValSize ? htVALPTR(table, entry) : entry->pxValue));
+	}
+	prvRemoveEntry(table, entry);
+	return (1);
+}
+
+int iHtIteratorDelete (htIterator_t *it)
+{
+	hashent_t *e = it->pxCur;
+
+	it->pxCur = NULL;
+	return (iHtDeleteEntry(it->pxTable, e));
+}
+
+#ifdef htTHREADS
+typedef struct {
+	hashtab_t *pxTable;
+	htPredicate_t pxPred;
+	void *pvCtx;
+	unsigned ulFirst, ulLast;	// buckets to look at, numbered as prvIterBucket does
+	dlList_t xGoing;			// entries unlinked from them, to be removed
+} htRemoveJob_t;
+
+static void *prvRemoveThread (void *arg)
+{
+	htRemoveJob_t *job = arg;
+
+	for (unsigned b = job->ulFirst; b < job->ulLast; b++) {
+		dlList_t *listhead = prvIterBucket(job->pxTable, b), *next;
+
+		for (dlList_t *l = listhead->right; l != listhead; l = next) {
+			next = l->right;
+			if (job->pxPred(job->pxTable, (hashent_t *)l, job->pvCtx)) {
+				lDelete(l);
+				lInsert(job->xGoing.left, l);
+			}
+		}
+	}
+	return (NULL);
+}
+#endif
+
+size_t ulHtRemoveIf (hashtab_t *table, htPredicate_t pred, void *ctx, unsigned threads)
+{
+	size_t removed = 0;
+
+#ifdef htTHREADS
+	if (threads > htMAXTHREADS)
+		threads = htMAXTHREADS;
+	if (threads > 1 && table->ulCurEntries >= htPARALLELMIN
+		&& !table->xCuckoo && !table->pxSmall && !table->pxExt->ppxPages) {
+		pthread_t tids[htMAXTHREADS];
+		htRemoveJob_t jobs[htMAXTHREADS];
+		int started[htMAXTHREADS];
+		unsigned buckets = prvIterBuckets(table), slice = (buckets + threads - 1) / threads;
+
+		for (unsigned i = 0; i < table->pxExt->ulDirectCount; i++) {	// the direct-address array here
+			if (htDIRBIT(table, i) && pred(table, htDIRENT(table, i), ctx)) {
+				prvRemoveEntry(table, htDIRENT(table, i));
+				removed++;
+			}
+		}
+		for (unsigned t = 0; t < threads; t++) {
+			unsigned first = t * slice < buckets ? t * slice : buckets;
+
+			jobs[t] = (htRemoveJob_t){ table, pred, ctx, first, buckets - first > slice ? first + slice : buckets };
+			LLINKSINIT(&jobs[t].xGoing);
+			// the last share is done here, as is any a thread couldn't be started for
+			started[t] = t + 1 < threads && pthread_create(&tids[t], NULL, prvRemoveThread, &jobs[t]) == 0;
+			if (!started[t])
+				prvRemoveThread(&jobs[t]);
+		}
+		for (unsigned t = 0; t < threads; t++) {
+			dlList_t *l;
+
+			if (started[t])
+				pthread_join(tids[t], NULL);
+			while ((l = jobs[t].xGoing.right) != &jobs[t].xGoing) {
+				prvRemoveEntry(table, (hashent_t *)l);		// takes it off the list
+				removed++;
+			}
+		}
+		return (removed);
+	}
+#endif
+	htFOREACH(it, e, table) {
+		if (pred(table, e, ctx))
+			removed += iHtIteratorDelete(&it);
+	}
+	return (removed);
+}
+
+// **************************************************
+// Clones share their original's buckets and entries, a page of buckets at a
+// time (see prvWritable), so cloning takes a directory of pages and a count
+// on each page.  The original's blocks of entries so far become shared too,
+// since the clone's view is in them; entries on its freelist aren't in that
+// view, so it goes on using them.
+// ***************************************************
+
+// The first time a table is cloned, its bucket array is divided into pages,
+// listed in dir.  The array and the pages go in sh, to be freed with it.
+static int prvMakePages (hashtab_t *table, htShared_t *sh, htPage_t **dir)
+{
+	unsigned n = htNPAGES(table);
+	htPage_t *pages = htALLOC(table, n * sizeof (htPage_t));
+
+	if (!pages)
+		return (0);
+	for (unsigned p = 0; p < n; p++) {
+		pages[p].ulRefs = 1;
+		pages[p].xOwnMem = 0;
+		pages[p].pxBuckets = table->pxBuckets + p * htPAGEBUCKETS;
+		dir[p] = &pages[p];
+	}
+	sh->pxBuckets = table->pxBuckets;
+	sh->ulBucketBytes = table->ulBucketBytes;
+	sh->pxPages = pages;
+	table->pxBuckets = NULL;
+	table->pxExt->ppxPages = dir;
+	table->ulBucketBytes = n * sizeof (htPage_t *);
+	return (1);
+}
+
+hashtab_t *pxHtClone (const char *tablename, hashtab_t *table)
+{
+	unsigned n = htNPAGES(table);
+	size_t dirbytes = n * sizeof (htPage_t *);
+	int first = !table->pxExt->ppxPages;
+	hashtab_t *clone = NULL;
+	htExt_t *ext = NULL;
+	htShared_t *sh = NULL;
+	htPage_t **dir = NULL, **tabledir = NULL;
+	char *bloom = NULL;
+	htHotSet_t *hot = NULL;
+	size_t hotbytes = table->pxExt->pxHot ? (table->pxExt->ulHotMask + 1) * sizeof (htHotSet_t) : 0;
+
+	if (table->xCuckoo || table->xCache || table->pxExt->ulDirectCount || table->ulSmallMax || table->xStatic
+		|| table->pxExt->pxCompact || table->xKeyed || table->pxExt->pxOrder) {
+		DEBUGPRINTF(TAG,"cuckoo, cache, direct-address, small, static, keyed, ordered and compacting hashtables can't be cloned%s", "");
+		return (NULL);
+	}
+	// both tables change their directories and shared memory, so both need
+	// their own htExt_t
+	if (!(clone = pxRsrcAlloc(xHashTablePool, tablename))
+		|| !prvOwnExt(table)
+		|| !(ext = htALLOC(table, sizeof (htExt_t)))
+		|| !(sh = htALLOC(table, sizeof (htShared_t)))
+		|| !(dir = htALLOC(table, dirbytes))
+		|| (first && !(tabledir = htALLOC(table, dirbytes)))
+		|| (table->pxExt->pvBloomMem && !(bloom = htALLOC(table, table->pxExt->ulBloomBytes)))
+		|| (hotbytes && !(hot = htALLOC(table, hotbytes)))
+		|| (first && !prvMakePages(table, sh, tabledir))) {
+		DEBUGPRINTF(TAG,"unable to allocate memory to clone hashtable \"%s\"", table->pcTablename);
+		if (hot)
+			htFREE(table, hot, hotbytes);
+		if (bloom)
+			htFREE(table, bloom, table->pxExt->ulBloomBytes);
+		if (tabledir)
+			htFREE(table, tabledir, dirbytes);
+		if (dir)
+			htFREE(table, dir, dirbytes);
+		if (sh)
+			htFREE(table, sh, sizeof (htShared_t));
+		if (ext)
+			htFREE(table, ext, sizeof (htExt_t));
+		if (clone)
+			vRsrcFree(clone);
+		return (NULL);
+	}
+	if (!first) {
+		sh->pxBuckets = NULL;
+		sh->ulBucketBytes = 0;
+		sh->pxPages = NULL;
+	}
+	sh->ulRefs = 2;
+	sh->pxSlabs = table->pxSlabs;
+	sh->pxOlder = table->pxExt->pxShared;
+	table->pxSlabs = NULL;
+	table->ulSlabBytes = 0;
+	table->pxExt->pxShared = sh;
+	for (unsigned p = 0; p < n; p++) {
+		htREFINC(&table->pxExt->ppxPages[p]->ulRefs);
+		dir[p] = table->pxExt->ppxPages[p];
+	}
+	*clone = *table;
+	*ext = *table->pxExt;
+	clone->pxExt = ext;
+	clone->pcTablename = tablename;
+	clone->pxExt->ppxPages = dir;
+	clone->ulBucketBytes = dirbytes;
+	clone->pxFreelist = NULL;
+	clone->pxExt->pxChangeCallback = NULL;
+	clone->pxExt->pvChangeCtx = NULL;
+	memset(&clone->pxExt->xStats, 0, sizeof clone->pxExt->xStats);
+	LLINKSINIT(&clone->pxExt->xClockRing);
+	clone->pxExt->pxClockHand = &clone->pxExt->xClockRing;
+	if (bloom) {
+		clone->pxExt->pvBloomMem = bloom;
+		clone->pxExt->pxBloom = (uint64_t *)(((uintptr_t)bloom + htBLOOM_BLOCK - 1) & ~(uintptr_t)(htBLOOM_BLOCK - 1));
+		memcpy(clone->pxExt->pxBloom, table->pxExt->pxBloom, (size_t)table->pxExt->ulBloomBlocks * htBLOOM_BLOCK);
+	}
+	if (hot) {
+		clone->pxExt->pxHot = hot;
+		memcpy(hot, table->pxExt->pxHot, hotbytes);	// the same entries, until one of them copies a page
+	}
+	return (clone);
+}
+
+// Buckets, entries in their chains, and keys, by whether the page holding
+// them is shared
+void vHtCloneBytes (hashtab_t *table, size_t *shared, size_t *own)
+{
+	htExt_t *ext = table->pxExt;
+
+	*shared = 0;
+	*own = ext->pvBloomMem ? ext->ulBloomBytes : 0;
+	if (table->xCuckoo) {
+		*own += table->ulBucketBytes + ext->ulKeyBytes;
+		return;
+	}
+	if (table->pxSmall) {
+		*own += htSMALLBYTES(table, table->pxSmall->ulCap) + ext->ulKeyBytes;
+		return;
+	}
+	if (ext->ppxPages)
+		*own += htNPAGES(table) * sizeof (htPage_t *);
+	for (unsigned p = 0; p < htNPAGES(table); p++) {
+		unsigned first = p * htPAGEBUCKETS, n = prvPageBuckets(table, p);
+		size_t bytes = (size_t)n * sizeof (dlList_t);
+
+		for (unsigned b = first; b < first + n; b++) {
+			dlList_t *listhead = prvBucket(table, b);
+
+			for (dlList_t *l = listhead->right; l != listhead; l = l->right) {
+				bytes += table->ulEntrySize;
+				if (prvOwnsKey(table, (hashent_t *)l))
+					bytes += strlen(((hashent_t *)l)->pcName) + 1;
+			}
+		}
+		if (ext->ppxPages && htREFS(&ext->ppxPages[p]->ulRefs) > 1)
+			*shared += bytes;
+		else
+			*own += bytes;
+	}
+}
+
+// **************************************************
+// Compaction.  A pass starts by putting the table's blocks of entries aside
+// as old, with a new block big enough for every entry, and the free list
+// made from that alone.  Chains are then walked in bucket order, a few per
+// call, and each entry found in an old block is copied to the next free
+// entry, so the entries of neighbouring chains end up next to each other.
+// Adds meanwhile come from the new block like any other, and entries
+// deleted from old blocks aren't reused.  Once every bucket has been
+// walked, nothing is left in the old blocks and they're freed.
+// ***************************************************
+
+typedef struct _htCompact {
+	htSlab_t **ppxOld;		// old blocks, sorted by address
+	unsigned ulOld;			// how many
+	unsigned ulBucket;		// next bucket to walk
+	htMoveCallback_t pxMoved;
+	void *pvMovedCtx;
+} htCompact_t;
+
+static int prvSlabOrder (const void *a, const void *b)
+{
+	uintptr_t x = (uintptr_t)*(htSlab_t * const *)a, y = (uintptr_t)*(htSlab_t * const *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+// True if e is in one of the blocks being emptied
+static int prvInOldSlab (hashtab_t *table, hashent_t *e)
+{
+	htCompact_t *c = table->pxExt->pxCompact;
+	unsigned lo = 0, hi = c->ulOld;
+
+	while (lo < hi) {		// the last block starting at or below e
+		unsigned mid = (lo + hi) / 2;
+
+		if ((uintptr_t)c->ppxOld[mid] <= (uintptr_t)e)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo && (uintptr_t)e < (uintptr_t)c->ppxOld[lo - 1] + c->ppxOld[lo - 1]->ulBytes);
+}
+
+// Give back the old blocks, and with them the pass
+static void prvCompactDone (hashtab_t *table)
+{
+	htCompact_t *c = table->pxExt->pxCompact;
+
+	for (unsigned i = 0; i < c->ulOld; i++) {
+		table->ulSlabBytes -= c->ppxOld[i]->ulBytes;
+		htFREE(table, c->ppxOld[i], c->ppxOld[i]->ulBytes);
+	}
+	if (c->ulOld)
+		htFREE(table, c->ppxOld, c->ulOld * sizeof (htSlab_t *));
+	htFREE(table, c, sizeof (htCompact_t));
+	table->pxExt->pxCompact = NULL;
+	table->pxExt->xStats.ulCompactions++;
+}
+
+static int prvCompactStart (hashtab_t *table, htMoveCallback_t moved, void *ctx)
+{
+	htCompact_t *c;
+	htSlab_t *s;
+	hashent_t *freelist;
+	unsigned n = 0;
+	size_t room;
+
+	for (s = table->pxSlabs; s; s = s->pxNext)
+		n++;
+	if (!prvOwnExt(table) || !(c = htALLOC(table, sizeof (htCompact_t))))
+		return (0);
+	c->ppxOld = NULL;
+	if (n && !(c->ppxOld = htALLOC(table, n * sizeof (htSlab_t *)))) {
+		htFREE(table, c, sizeof (htCompact_t));
+		return (0);
+	}
+	c->ulOld = 0;
+	for (s = table->pxSlabs; s; s = s->pxNext)
+		c->ppxOld[c->ulOld++] = s;
+	if (n)
+		qsort(c->ppxOld, n, sizeof (htSlab_t *), prvSlabOrder);
+	c->ulBucket = 0;
+	c->pxMoved = moved;
+	c->pvMovedCtx = ctx;
+	// every entry in one block, with the usual room to grow, from now on
+	room = table->ulCurEntries - table->pxExt->ulDirectUsed + table->ulAllocSize;
+	if (table->ulMaxEntries && room > table->ulMaxEntries)
+		room = table->ulMaxEntries;
+	s = table->pxSlabs;
+	freelist = table->pxFreelist;
+	table->pxSlabs = NULL;
+	table->pxFreelist = NULL;
+	if (!prvAddSlab(table, room) && table->ulCurEntries > table->pxExt->ulDirectUsed) {
+		table->pxSlabs = s;			// can't: put things back as they were
+		table->pxFreelist = freelist;
+		if (n)
+			htFREE(table, c->ppxOld, n * sizeof (htSlab_t *));
+		htFREE(table, c, sizeof (htCompact_t));
+		return (0);
+	}
+	table->pxExt->pxCompact = c;
+	return (1);
+}
+
+// Copy an entry in an old block to a free one, and link the copy in its place
+static hashent_t *prvMoveEntry (hashtab_t *table, hashent_t *e)
+{
+	htExt_t *ext = table->pxExt;
+	hashent_t *to = table->pxFreelist;
+	htCompact_t *c = ext->pxCompact;
+
+	if (!to && prvAddSlab(table, table->ulAllocSize ? table->ulAllocSize : 1))
+		to = table->pxFreelist;
+	if (!to)
+		return (NULL);
+	table->pxFreelist = to->pxFreelist;
+	memcpy((char *)to - table->ulEntryOffset, (char *)e - table->ulEntryOffset, table->ulEntrySize);
+	((dlList_t *)to)->left->right = (dlList_t *)to;
+	((dlList_t *)to)->right->left = (dlList_t *)to;
+	if (table->xCache) {
+		htCacheMeta_t *m = htMETA(table, to);
+
+		m->xRing.left->right = &m->xRing;
+		m->xRing.right->left = &m->xRing;
+		if (ext->pxClockHand == &htMETA(table, e)->xRing)
+			ext->pxClockHand = &m->xRing;
+	}
+	if (table->ulKeyInline && e->pcName == (char *)htINLINEKEY(e))
+		to->pcName = (char *)htINLINEKEY(to);
+	if (ext->pxHot)
+		prvHotMoved(table, e, to);
+	if (ext->pxOrder)
+		prvOrderMoved(table, to->ulKey, to);
+	ext->xStats.ulMoved++;
+	if (c->pxMoved)
+		c->pxMoved(table, e, to, c->pvMovedCtx);
+	return (to);
+}
+
+int iHtCompact (hashtab_t *table, unsigned budget, htMoveCallback_t moved, void *ctx)
+{
+	htCompact_t *c;
+
+	if (table->xCuckoo || table->ulSmallMax || table->pxExt->ppxPages || table->xStatic) {
+		DEBUGPRINTF(TAG,"cuckoo, small, cloned and static hashtables can't be compacted%s", "");
+		return (0);
+	}
+	if (table->pxExt->pxOldBuckets) {		// finish rehashing first, it moves entries between arrays
+		prvRehashStep(table, budget ? budget : ~0u);
+		return (1);
+	}
+	if (!table->pxExt->pxCompact && !prvCompactStart(table, moved, ctx))
+		return (0);
+	c = table->pxExt->pxCompact;
+	if (!budget)
+		budget = ~0u;
+	while (c->ulBucket < table->ulBucketCount && budget) {
+		dlList_t *head = &table->pxBuckets[c->ulBucket];
+
+		budget--;		// looking at a bucket costs something too
+		for (dlList_t *l = head->right, *next; l != head; l = next) {
+			next = l->right;
+			if (!prvInOldSlab(table, (hashent_t *)l))
+				continue;
+			if (!prvMoveEntry(table, (hashent_t *)l))
+				return (1);		// no memory: try again later
+			budget -= budget > 0;
+		}
+		c->ulBucket++;
+	}
+	if (c->ulBucket < table->ulBucketCount)
+		return (1);
+	prvCompactDone(table);
+	return (0);
+}
+
+// **************************************************
+// Arenas hand out memory by bumping a pointer through large chunks, and
+// free nothing until the whole arena is deleted.  A table whose allocator is
+// an arena can therefore be discarded, entries, keys and all, in one step.
+// ***************************************************
+
+typedef struct _htArenaChunk {
+	struct _htArenaChunk *pxNext;
+	size_t ulBytes;				// including this header
+	unsigned xMapped:1;			// from prvMapChunk rather than malloc
+} htArenaChunk_t;
+
+struct _htArena {
+	htArenaChunk_t *pxChunks;	// everything allocated, newest first
+	char *pcNext;				// free space in the newest chunk
+	char *pcEnd;
+	size_t ulChunkSize;			// usual size of a chunk
+	size_t ulBytes;				// total held in chunks
+	size_t ulMappedBytes;		//   of which, mapped with huge page/NUMA options
+	unsigned ulFlags;			// htARENA_ options
+	unsigned long ulNodemask;	// NUMA nodes for the htARENA_NUMA options
+};
+#define htARENAHDR	((sizeof (htArenaChunk_t) + htMAX_VALALIGN - 1) & ~(htMAX_VALALIGN - 1))
+
+htArena_t *pxHtNewArena (size_t chunksize)
+{
+	return (pxHtNewArenaEx(chunksize, 0, 0));
+}
+htArena_t *pxHtNewArenaEx (size_t chunksize, unsigned flags, unsigned long nodemask)
+{
+	htArena_t *arena = malloc(sizeof (htArena_t));
+
+	if (arena) {
+		arena->pxChunks = NULL;
+		arena->pcNext = arena->pcEnd = NULL;
+		arena->ulChunkSize = chunksize ? chunksize : 64 * 1024;
+		arena->ulBytes = arena->ulMappedBytes = 0;
+		arena->ulFlags = flags;
+		arena->ulNodemask = nodemask;
+	}
+	return (arena);
+}
+void *pvHtArenaAlloc (size_t size, void *ctx)
+{
+	htArena_t *arena = ctx;
+	char *p;
+
+	size = (size + htMAX_VALALIGN - 1) & ~(htMAX_VALALIGN - 1);
+	if (size > arena->pcEnd - arena->pcNext) {
+		size_t bytes = htARENAHDR + (size > arena->ulChunkSize ? size : arena->ulChunkSize);
+		htArenaChunk_t *c = NULL;
+
+		if (arena->ulFlags) {		// whole huge pages, or it's not worth mapping
+			bytes = (bytes + htHUGEPAGE - 1) & ~(size_t)(htHUGEPAGE - 1);
+			if ((c = prvMapChunk(bytes, arena->ulFlags, arena->ulNodemask))) {
+				c->xMapped = 1;
+				arena->ulMappedBytes += bytes;
+			}
+		}
+		if (!c) {
+			if (!(c = malloc(bytes)))
+				return (NULL);
+			c->xMapped = 0;
+		}
+		c->pxNext = arena->pxChunks;
+		c->ulBytes = bytes;
+		arena->pxChunks = c;
+		arena->ulBytes += bytes;
+		arena->pcNext = (char *)c + htARENAHDR;
+		arena->pcEnd = (char *)c + bytes;
+	}
+	p = arena->pcNext;
+	arena->pcNext += size;
+	return (p);
+}
+void vHtArenaFree (void *ptr, size_t size, void *ctx)
+{
+	// nothing to do, the arena is freed all at once
+}
+size_t ulHtArenaBytes (htArena_t *arena)
+{
+	return (arena->ulBytes);
+}
+size_t ulHtArenaMappedBytes (htArena_t *arena)
+{
+	return (arena->ulMappedBytes);
+}
+void vHtDeleteArena (htArena_t *arena)
+{
+	while (arena->pxChunks) {
+		htArenaChunk_t *c = arena->pxChunks;
+
+		arena->pxChunks = c->pxNext;
+		if (c->xMapped) {
+			prvUnmapChunk(c, c->ulBytes);
+		} else {
+			free(c);
+		}
+	}
+	free(arena);
 }
 
 #ifdef htPRINTSTATS
@@ -338,19 +3873,47 @@ static int prvListLength (dlList_t *list)
 	}
 	return (len);
 }
+static void prvCkPrintStats (hashtab_t *table)
+{
+	htCuckoo_t *ck = table->pxCuckoo;
+
+	logPrintf(TAG,"\nTABLE \"%s\" (cuckoo)", table->pcTablename);
+	logPrintf(TAG,"BUCKETS: %u x %d WAYS, MAX_ENTRIES %lu, CUR_ENTRIES %lu, LOAD %.1f%%",
+			  ck->ulBuckets, htCK_WAYS, (unsigned long)table->ulMaxEntries, (unsigned long)table->ulCurEntries,
+			  100.0 * table->ulCurEntries / (ck->ulBuckets * htCK_WAYS));
+	logPrintf(TAG,"DISPLACEMENTS %lu, LONGEST PATH %u, STASHED %lu, IN STASH %u, REHASHES %u",
+			  ck->ulDisplacements, ck->ulLongestPath, ck->ulStashed, ck->ulStashCount, ck->ulRehashes);
+	logPrintf(TAG,"MEMORY: BUCKETS %lu, KEYS %lu",
+			  (unsigned long)table->ulBucketBytes, (unsigned long)table->pxExt->ulKeyBytes);
+}
 void vHtPrintStats(hashtab_t *table)
 {
+	htExt_t *ext = table->pxExt;
 	int chainlengths[MAXCHAINLEN]; // number chains with each length
 	int overmax = 0;		// length over the most we're istogramming
-	float idealchainlen = (float) table->ulCurEntries / (float) table->ulBucketCount;
+	size_t chained = table->ulCurEntries - ext->ulDirectUsed;	// direct entries aren't in buckets
+	float idealchainlen = (float) chained / (float) table->ulBucketCount;
 	int longest = 0;
 	
+	if (table->xCuckoo) {
+		prvCkPrintStats(table);
+		return;
+	}
+	if (table->pxSmall) {
+		logPrintf(TAG,"\nTABLE \"%s\" (small)", table->pcTablename);
+		logPrintf(TAG,"SLOTS: %u IN USE OF %u, UP TO %u BEFORE MOVING TO %u BUCKETS, MAX_ENTRIES %lu",
+				  table->pxSmall->ulCount, table->pxSmall->ulCap, table->ulSmallMax,
+				  table->ulBucketCount, (unsigned long)table->ulMaxEntries);
+		logPrintf(TAG,"MEMORY: SLOTS %lu, KEYS %lu",
+				  (unsigned long)htSMALLBYTES(table, table->pxSmall->ulCap), (unsigned long)ext->ulKeyBytes);
+		return;
+	}
 	memset(chainlengths, 0, sizeof chainlengths);
 	// loop through buckets, create histogram of chain lengths
 	// The ideal is that chain actual lengths should cluster closely around
 	// the ideal -- which is the number of entries divided by nmber of buckets
 	for (int i = 0; i < table->ulBucketCount; i++) {
-		int len = prvListLength(&table->pxBuckets[i]);
+		int len = prvListLength(prvBucket(table, i));
 
 		if (len > longest)
 			longest = len;
@@ -363,7 +3926,59 @@ void vHtPrintStats(hashtab_t *table)
 	
 	// summarize findings
 	logPrintf(TAG,"\nTABLE \"%s\"", table->pcTablename);
-	logPrintf(TAG,"BUCKETS: %d, MAX_ENTRIES %d, CUR_ENTRIES %d, INCREMENT %d", table->ulBucketCount, table->ulMaxEntries, table->ulCurEntries, table->ulAllocSize);
+	logPrintf(TAG,"BUCKETS: %u, MAX_ENTRIES %lu, CUR_ENTRIES %lu, INCREMENT %u", table->ulBucketCount,
+			  (unsigned long)table->ulMaxEntries, (unsigned long)table->ulCurEntries, table->ulAllocSize);
+	if (table->ulAllocMax)
+		logPrintf(TAG,"INCREMENT DOUBLING UP TO %u", table->ulAllocMax);
+	logPrintf(TAG,"MEMORY: BUCKETS %lu, ENTRY BLOCKS %lu, KEYS %lu",
+			  (unsigned long)table->ulBucketBytes, (unsigned long)table->ulSlabBytes, (unsigned long)ext->ulKeyBytes);
+	if (table->xMultimap)
+		logPrintf(TAG,"MULTIMAP (chain lengths count every value)%s", "");
+	if (table->xCache) {
+		logPrintf(TAG,"CACHE LOOKUPS %lu, HITS %lu (%.1f%%), EVICTIONS %lu, EXPIRED %lu",
+				  ext->xStats.ulLookups, ext->xStats.ulHits,
+				  ext->xStats.ulLookups ? 100.0 * ext->xStats.ulHits / ext->xStats.ulLookups : 0.0,
+				  ext->xStats.ulEvictions, ext->xStats.ulExpired);
+	}
+	if (table->ulValSize)
+		logPrintf(TAG,"INLINE VALUE BYTES: %d, ENTRY SIZE %d", table->ulValSize, table->ulEntrySize);
+	if (table->ulKeyInline)
+		logPrintf(TAG,"INLINE KEY BYTES: %d, ENTRY SIZE %d", table->ulKeyInline, table->ulEntrySize);
+	if (ext->pxBloom)
+		logPrintf(TAG,"BLOOM FILTER BYTES %lu, CHAIN WALKS AVOIDED %lu, FALSE POSITIVES %lu, REBUILDS %lu",
+				  (unsigned long)ext->ulBloomBytes, ext->xStats.ulBloomSkips,
+				  ext->xStats.ulBloomFalsePositives, ext->xStats.ulBloomRebuilds);
+	if (ext->ulDirectCount)
+		logPrintf(TAG,"DIRECT KEYS %u TO %u, IN USE %u, BYTES %lu, ENTRIES IN CHAINS %lu", ext->ulDirectBase,
+				  ext->ulDirectBase + ext->ulDirectCount - 1, ext->ulDirectUsed,
+				  (unsigned long)ext->ulDirectBytes, (unsigned long)chained);
+	if (ext->ppxPages) {
+		unsigned sharedpages = 0;
+		size_t shared, own;
+
+		for (unsigned p = 0; p < htNPAGES(table); p++)
+			sharedpages += htREFS(&ext->ppxPages[p]->ulRefs) > 1;
+		vHtCloneBytes(table, &shared, &own);
+		logPrintf(TAG,"CLONED: BUCKET PAGES %u, SHARED %u, BYTES SHARED %lu, OWN %lu",
+				  htNPAGES(table), sharedpages, (unsigned long)shared, (unsigned long)own);
+	}
+	if (table->ulSmallMax)
+		logPrintf(TAG,"SMALL TABLE, IN CHAINS SINCE IT HAS OVER %u ENTRIES", table->ulSmallMax);
+	if (table->xKeyed)
+		logPrintf(TAG,"KEYED HASH, CHAINS OVER %u RESEED: RESEEDS %lu, ENTRIES REHASHED %lu%s", ext->ulMaxChain,
+				  ext->xStats.ulReseeds, ext->xStats.ulRehashed, ext->pxOldBuckets ? ", REHASH UNDER WAY" : "");
+	if (ext->pxHot)
+		logPrintf(TAG,"HOT KEY CACHE %u KEYS: LOOKUPS %lu, HITS %lu (%.1f%%)", 2 * (ext->ulHotMask + 1),
+				  ext->xStats.ulHotLookups, ext->xStats.ulHotHits,
+				  ext->xStats.ulHotLookups ? 100.0 * ext->xStats.ulHotHits / ext->xStats.ulHotLookups : 0.0);
+	if (ext->pxOrder)
+		logPrintf(TAG,"ORDERED INDEX: NODES %lu, HEIGHT %u, BYTES %lu", (unsigned long)ext->pxOrder->ulNodes,
+				  ext->pxOrder->ulHeight, (unsigned long)ext->pxOrder->ulBytes);
+	if (ext->xStats.ulMoved || ext->pxCompact)
+		logPrintf(TAG,"COMPACTION PASSES %lu, ENTRIES MOVED %lu%s", ext->xStats.ulCompactions,
+				  ext->xStats.ulMoved, ext->pxCompact ? ", PASS UNDER WAY" : "");
+	if (ext->ulDirectCount && !chained)
+		return;		// nothing in the buckets to analyse
 	logPrintf(TAG,"CHAIN  CHAIN%s", "");
 	logPrintf(TAG,"LENGTH COUNT%s", "");
 	for (int i = 0; i < MAXCHAINLEN; i++) {
@@ -7,12 +7,14 @@
 #ifndef _HASHTAB_H_
 #define _HASHTAB_H_
 
+#include <stdint.h>
 #include "iot_doubly_linked_list.h"
 // #define dlList_t Link_t
 // #include "listutils.h"	// compatible calling sequence, different names
 
 #define LL_LOG_HASHTAB		"hashtab"
-#define htMAX_ALLOCSIZE		0xffff	// max that'll fit in the field in hashtab_t
+#define htMAX_ALLOCSIZE		0xffffffffu	// max that'll fit in the field in hashtab_t
+#define htMAX_VALALIGN		16		// most alignment an inline value can ask for
 
 #define htFORLOOP(walker,iterator) for(hashent_t *walker; (walker = pxHtIteratorNext (&iterator));)
 #define htFOREACH(it,w,tab) htIterator_t it; vHtInitIterator(&it,tab); htFORLOOP(w,it)
@@ -23,6 +25,9 @@ typedef struct _htHashent {
 		Link_t xLinks;		// link to next/prev in this bucket
 //		dlList_t xLinks;	// link to next/prev in this bucket
 		struct _htHashent *pxFreelist;	// freelist link if entry is not in use
+		struct {
+			unsigned ulHash1, ulHash2;	// cuckoo tables: the key's two hashes
+		} xHashes;
 	};
 	union {					// SI functions decide which to use, we don't care
 		const char	*pcName;	// string key associated with this entry
@@ -33,27 +38,208 @@ typedef struct _htHashent {
 		unsigned ulValue;	// alternative access to reduce casting
 		int 	lValue;
 	};
+	// if the table has inline values, they start here (or at the next
+	// multiple of their alignment) and run past the end of the struct
 } hashent_t;
 
+// pointer to the value stored in an entry: the union above for ordinary
+// tables, the inline value for tables created with a value size
+#define htVALPTR(table,entry)	((void *)((char *)(entry) + (table)->ulValOffset))
+
+// Counters kept by tables using optional features, shown by vHtPrintStats
 typedef struct {
+	unsigned long ulLookups;	// cache tables: lookups by Find and Get
+	unsigned long ulHits;		// of those, the ones that found the key
+	unsigned long ulEvictions;	// entries evicted to make room for new ones
+	unsigned long ulExpired;	// entries dropped when their time to live ran out
+	unsigned long ulBloomSkips;	// Bloom filter tables: chain walks avoided,
+	unsigned long ulBloomFalsePositives;	// chains walked for a key not there,
+	unsigned long ulBloomRebuilds;	// and times the filter was rebuilt
+	unsigned long ulMoved;		// entries moved by compaction,
+	unsigned long ulCompactions;	// and compaction passes finished
+	unsigned long ulReseeds;	// keyed tables: new seeds picked after a long chain,
+	unsigned long ulRehashed;	// and entries moved to new buckets for them
+	unsigned long ulHotLookups;	// hot key caches: lookups (adds' too) that looked in the cache,
+	unsigned long ulHotHits;	// and the ones it answered
+} htStats_t;
+
+struct _htHashtab;
+// Allocator for the memory a table uses: buckets, blocks of entries and copied
+// keys.  free is told the size that was asked for when the memory was allocated.
+typedef void *(*htAllocFn_t) (size_t size, void *ctx);
+typedef void (*htFreeFn_t) (void *ptr, size_t size, void *ctx);
+
+// Called when a cache table drops an entry, before it is unlinked, so the
+// caller can release whatever the value refers to.
+typedef void (*htEvictCallback_t) (struct _htHashtab *table, hashent_t *entry, void *ctx);
+
+// Called after each change to an entry made through the table's calls, or
+// with deleted set just before an entry is removed (deleted, evicted or
+// expired).  Used by change logs, see htlog.h.
+typedef void (*htChangeCallback_t) (struct _htHashtab *table, hashent_t *entry, int deleted, void *ctx);
+
+// Called when compaction moves an entry, with the entry's old place (still
+// readable until the pass ends) and its new one.
+typedef void (*htMoveCallback_t) (struct _htHashtab *table, hashent_t *from, hashent_t *to, void *ctx);
+
+// Decides, for ulHtRemoveIf, whether an entry goes: non-zero to remove it
+typedef int (*htPredicate_t) (struct _htHashtab *table, hashent_t *entry, void *ctx);
+
+// What a table needs only for the optional features it was given: cache,
+// Bloom filter, clone, direct-address, compaction, keyed hash, hot key cache
+// and ordered index state, change callback and statistics.  A table using
+// none of it shares one read-only htExt_t, so a plain or small table is its
+// header and its buckets or packed block, whatever its allocator; any other
+// gets its own, and keeps it.  The fields looked at on every lookup come
+// first.
+typedef struct _htExt {
+	struct _htPage **ppxPages;	// cloned tables: directory of bucket pages, else NULL
+	char *pcDirect;			// direct-address tables: an entry per key in the range,
+	unsigned ulDirectBase;	//   the first key in the range,
+	unsigned ulDirectCount;	//   and keys in it, 0 if the table has none
+	uint64_t *pxBloom;		// Bloom filter, 64-byte aligned blocks, or NULL
+	unsigned ulBloomBlocks;	// blocks in the filter
+	unsigned ulHotMask;		// sets in the hot key cache, less one
+	struct _htHotSet *pxHot;	// hot key cache: sets of recently found entries, else NULL
+	Link_t *pxOldBuckets;	// keyed tables, while rehashing: buckets filled with the old seed, else NULL
+	htChangeCallback_t pxChangeCallback;
+	void *pvChangeCtx;		// passed to pxChangeCallback
+	size_t ulKeyBytes;		// memory held for copies of keys
+	Link_t xClockRing;		// cache tables: every entry, in CLOCK order
+	Link_t *pxClockHand;	// next place in xClockRing to look for a victim
+	unsigned ulTtl;			// cache tables: default time to live, ms
+	htEvictCallback_t pxEvictCallback;
+	void *pvEvictCtx;		// passed to pxEvictCallback
+	void *pvBloomMem;		// where pxBloom was allocated
+	size_t ulBloomBytes;	// and how much
+	size_t ulBloomKeys;		// keys the filter was sized for
+	size_t ulBloomDeletes;	// deletes since it was built
+	struct _htShared *pxShared;	// memory shared with clones, see pxHtClone
+	uint64_t *pxDirectBits;	// direct-address tables: a bit per key saying if it's in use,
+	unsigned ulDirectUsed;	//   entries in use,
+	size_t ulDirectBytes;	//   and memory held for the array and bits
+	struct _htCompact *pxCompact;	// state of a compaction pass under way, else NULL
+	uint64_t aulSeed[2];	// keyed tables: the key for SipHash,
+	uint64_t aulOldSeed[2];	//   and the one before, while rehashing
+	unsigned ulRehashNext;	//   the first old bucket not yet moved to pxBuckets,
+	unsigned ulMaxChain;	//   reseed when a chain is longer than this,
+	size_t ulQuiet;			//   and adds to go before another reseed is allowed
+	struct _htOrder *pxOrder;	// ordered tables: B+tree of the keys, else NULL
+	htStats_t xStats;
+} htExt_t;
+
+typedef struct _htHashtab {
 	Link_t *pxBuckets;		// The buckets -- an array of list heads
 //	dlList_t *pxBuckets;		// The buckets -- an array of list heads
 	hashent_t *pxFreelist; 	// freelist of allocated but not in use entries
+	struct _htSlab *pxSlabs;	// blocks of entries, for freeing the table
+	struct _htCuckoo *pxCuckoo;	// cuckoo tables: buckets, stash and statistics
+	struct _htSmall *pxSmall;	// small tables, while small: packed keys and entries, else NULL
+	htExt_t *pxExt;			// state for optional features, see above; never NULL
 	const char *pcTablename;	// name of this table, for logging/stats purposes
 	unsigned ulBucketCount;	// size of buckets array at 'buckets'
 							// if ==1, it's a serial search, hashing does nothing
-	unsigned ulMaxEntries;	// max # entries allowed (absolute cap)
-	unsigned ulCurEntries;	// count of current entries
-	unsigned ulAllocSize:16;	// entries added if needed in blocks of this many
+	unsigned ulEntrySize;	// bytes per entry in an allocated block
+	size_t ulMaxEntries;	// max # entries allowed (absolute cap)
+	size_t ulCurEntries;	// count of current entries
+	unsigned ulEntryOffset;	// where the hashent_t starts in those bytes
+	unsigned ulValOffset;	// offset of value in entry, see htVALPTR
+	unsigned ulValSize;		// bytes of inline value, 0 if value is the union
+	unsigned ulKeyInline;	// bytes of string key kept in each entry, 0 if none
+	unsigned ulAllocSize;	// entries added if needed in blocks of this many
+	unsigned ulAllocMax;	// if more than ulAllocSize, each block is twice the last, up to this
+	unsigned ulSmallMax;	// most entries a small table keeps packed, 0 if not a small table
 	unsigned xHasString:1;	// set if a string key has been added to the hash
 	unsigned xHasInt:1;		// set if an integer key has been added to the hash
-	unsigned _unused:14;	// RFU
+	unsigned xMultimap:1;	// set if a key may have several entries
+	unsigned xCache:1;		// set if entries are evicted when the table is full
+	unsigned xCopyKeys:1;	// set if the table keeps its own copy of string keys
+	unsigned xCuckoo:1;		// set if the table uses cuckoo hashing, not chaining
+	unsigned xStatic:1;		// set if the table's memory is the caller's, see pxHtNewStaticTable
+	unsigned xKeyed:1;		// set if keys are hashed with SipHash and aulSeed
+	unsigned xFlooded:1;	// keyed tables: a chain longer than ulMaxChain was seen
+	unsigned _unused:23;	// RFU
+	size_t ulBucketBytes;	// memory held for buckets,
+	size_t ulSlabBytes;		//   and for blocks of entries
+	htAllocFn_t pxAlloc;	// where the table gets its memory
+	htFreeFn_t pxFree;
+	void *pvAllocCtx;		// passed to pxAlloc and pxFree
 } hashtab_t;
 
-// allocate and initialize a new hash table, returns a pointer to it
-hashtab_t *pxHtNewHashTable (const char *tablename, unsigned initentries,
-						   unsigned maxentries, unsigned entryincrement,
+// Optional settings for a new hash table.  A zeroed htConfig_t gives the same
+// table as pxHtNewHashTable.
+typedef struct {
+	unsigned ulValSize;		// if non-zero, each entry holds this many bytes of value
+	unsigned ulValAlign;	// alignment of the inline value, a power of 2 up to
+							// htMAX_VALALIGN; 0 means pointer alignment
+	unsigned xMultimap:1;	// allow several entries with the same key, see below
+	unsigned xCache:1;		// evict entries rather than fail when maxentries is reached
+	unsigned ulTtl;			// cache tables: entries expire this many ms after being set
+	htEvictCallback_t pxEvictCallback;	// cache tables: called for each entry dropped
+	void *pvEvictCtx;
+	htAllocFn_t pxAlloc;	// allocator for table memory, NULL for malloc()
+	htFreeFn_t pxFree;
+	void *pvAllocCtx;		// passed to pxAlloc and pxFree
+	unsigned xCopyKeys:1;	// copy string keys into table memory when added
+	unsigned xCuckoo:1;		// cuckoo hashing, see below
+	unsigned xBloom:1;		// keep a Bloom filter in front of lookups, see below
+	unsigned ulBloomKeys;	// keys to size the filter for, 0 to use initentries
+	unsigned ulInlineKeys;	// 16 or 24: keep string keys shorter than this in entries
+	unsigned ulDirectBase;	// integer keys from here...
+	unsigned ulDirectKeys;	// ...for this many are kept in an array, see below
+	unsigned ulSmallKeys;	// keep up to this many entries (at most 64) packed, see below
+	unsigned ulAllocMax;	// double the blocks of entries, from entryincrement up to this many
+	unsigned xKeyedHash:1;	// hash with SipHash and a random seed, see below
+	unsigned ulMaxChain;	// keyed tables: reseed if a chain gets longer than this, 0 for 32
+	unsigned ulHotKeys;		// remember this many recently found entries, see below
+	unsigned xOrdered:1;	// keep the integer keys in order as well, see below
+} htConfig_t;
+
+// allocate and initialize a new hash table, returns a pointer to it.
+// Entries beyond initentries are allocated entryincrement at a time.  For
+// very large tables, set ulAllocMax in htConfig_t: each block is then twice
+// the size of the last, up to ulAllocMax entries, so filling a table takes a
+// number of allocations that grows with the log of its size.
+hashtab_t *pxHtNewHashTable (const char *tablename, size_t initentries,
+						   size_t maxentries, unsigned entryincrement,
 						   unsigned numbuckets);
+hashtab_t *pxHtNewHashTableEx (const char *tablename, size_t initentries,
+						   size_t maxentries, unsigned entryincrement,
+						   unsigned numbuckets, const htConfig_t *config);
+
+// Static tables, for code that can't have the heap touched once it's
+// running (latency-critical paths, small embedded targets).  The caller
+// provides the hashtab_t, the bucket array and a pool of entries, and the
+// table never allocates or frees memory: an add takes an entry from the
+// pool or fails, as for a full table (a cache table evicts), so every call
+// has a fixed worst case.  Size the memory with the macros, for up to 100
+// entries with 8 bytes of inline value:
+//
+//		static hashtab_t ports;
+//		static Link_t portbuckets[49];
+//		static char portentries[htSTATIC_ENTRYBYTES(100, 8)];
+//		htConfig_t cfg = { .ulValSize = 8 };
+//		pxHtNewStaticTable (&ports, "ports", portbuckets, 49, portentries, sizeof portentries, &cfg);
+//
+// The table holds as many entries as fit in entrybytes, after its htExt_t.
+// An even numbuckets uses one less bucket.  The macros cover tables without
+// inline keys or caching; for those, allow ulHtEntrySize (config) bytes per
+// entry, plus htSTATIC_EXTBYTES and htMAX_VALALIGN.  Inline keys too long
+// for the entry can't be added.  Not for cuckoo, small, Bloom filter,
+// direct-address or copy-key tables, and static tables can't be cloned.
+// vHtFreeHashTable does nothing to them.
+// Returns table, or NULL if config isn't possible or there's no room for
+// a bucket and an entry.
+#define htSTATIC_ENTRYSIZE(valsize)	\
+	(((sizeof (hashent_t) + (valsize) + htMAX_VALALIGN - 1) / htMAX_VALALIGN) * htMAX_VALALIGN)
+#define htSTATIC_EXTBYTES	\
+	(((sizeof (htExt_t) + htMAX_VALALIGN - 1) / htMAX_VALALIGN) * htMAX_VALALIGN)
+#define htSTATIC_ENTRYBYTES(maxentries,valsize)	\
+	((size_t)(maxentries) * htSTATIC_ENTRYSIZE(valsize) + htSTATIC_EXTBYTES + htMAX_VALALIGN)
+
+hashtab_t *pxHtNewStaticTable (hashtab_t *table, const char *tablename, Link_t *buckets, unsigned numbuckets,
+							   void *entries, size_t entrybytes, const htConfig_t *config);
+size_t ulHtEntrySize (const htConfig_t *config);	// bytes per entry, 0 if config isn't possible
 
 // Create an entry in the hash table.  It is an error to add an entry with
 // an existing key, a zero will be returned.  Success is a non-zero return.
@@ -66,6 +252,28 @@ int iHtSAddVal (hashtab_t *table, const char *name, void *value);
 int iHtISetVal (hashtab_t *table, unsigned key, void *value);
 int iHtSSetVal (hashtab_t *table, const char *name, void *value);
 
+// Find the entry for a key, adding it if it isn't there, in one lookup.  If
+// inserted isn't NULL, *inserted is set non-zero when the entry is new, in which
+// case its value is NULL (or zeroes).  NULL is returned if there's no room.
+hashent_t *pxHtIGetOrAdd (hashtab_t *table, unsigned key, int *inserted);
+hashent_t *pxHtSGetOrAdd (hashtab_t *table, const char *name, int *inserted);
+
+// Set the value for a key, adding it if needed, and return the value it replaced
+// (NULL if the key is new).  With inline values, the bytes value points at are
+// exchanged with those in the table, and value is returned unless the key is new.
+void *pvHtIExchangeVal (hashtab_t *table, unsigned key, void *value);
+void *pvHtSExchangeVal (hashtab_t *table, const char *name, void *value);
+
+// Add delta to the lValue of the entry for a key, adding it with a value of 0
+// if needed, and return the sum.  With inline values, delta is added to the
+// int at the start of the value (0 is returned if values are any smaller).
+// The EAddToVal form works on an entry already found (its lValue, so not for
+// inline values), and is atomic, so threads may share a counter entry without
+// locking (adding and deleting entries still needs mutual exclusion).
+int lHtIAddToVal (hashtab_t *table, unsigned key, int delta);
+int lHtSAddToVal (hashtab_t *table, const char *name, int delta);
+int lHtEAddToVal (hashent_t *entry, int delta);
+
 // low-level routines that find list entries as hashent_t
 hashent_t * pxHtIFindEntry (hashtab_t *table, unsigned key);
 hashent_t * pxHtSFindEntry (hashtab_t *table, const char *name);
@@ -74,11 +282,315 @@ hashent_t * pxHtSFindEntry (hashtab_t *table, const char *name);
 void *pvHtSGetVal (hashtab_t *table, const char *name);
 void *pvHtIGetVal (hashtab_t *table, unsigned key);
 
+// Tables with inline values: the value argument of the Add/Set routines points
+// at ulValSize bytes to copy into the entry (NULL stores zeroes), and GetVal
+// returns a pointer to the value inside the table rather than the value itself.
+// The routines below work on any table and return a pointer to the value in
+// the entry (for ordinary tables, a pointer to the pxValue union).
+// AddValPtr adds a zero-filled entry, returning NULL if the key is already
+// present or there is no room; the caller fills in the value in place.
+void *pvHtIFindValPtr (hashtab_t *table, unsigned key);
+void *pvHtSFindValPtr (hashtab_t *table, const char *name);
+void *pvHtIAddValPtr (hashtab_t *table, unsigned key);
+void *pvHtSAddValPtr (hashtab_t *table, const char *name);
+
 // delete an entry from the hash table -- caller responsible for objects pointed to.
 // I,S cases return number of deleted items, 0 or 1. EDelete assumes valid hashent_t.
+// EDelete only unlinks the entry: without the table it can't be freed or
+// uncounted, so it's lost until the table is freed.  DeleteEntry removes an
+// entry found by FindEntry or an iterator properly, without looking it up
+// again, returning 1 (0 if it's in a page shared with a clone which can't be
+// copied, or the table holds both kinds of key and so can't tell its key).
 int iHtSDelete (hashtab_t *table, const char *name);
 int iHtIDelete (hashtab_t *table, unsigned key);
 void vHtEDelete (hashent_t *entry);
+int iHtDeleteEntry (hashtab_t *table, hashent_t *entry);
+
+// Remove every entry for which pred returns non-zero, in one pass over the
+// table, returning how many went.  Values are the caller's, as for Delete;
+// pred can release them as it decides.  For big tables the buckets are
+// shared between up to threads threads (0 or 1 for none), each calling pred
+// on its own entries and unlinking the ones to go, which the calling thread
+// then frees; pred must then be safe to call from several threads, and not
+// change the table.  Cuckoo, small and cloned tables, and direct-address
+// ranges, are done on the calling thread.
+size_t ulHtRemoveIf (hashtab_t *table, htPredicate_t pred, void *ctx, unsigned threads);
+
+// Have callback told about every add, change and removal of an entry (NULL
+// to stop).  Changes the table can't see -- values written through pointers
+// from AddValPtr, FindValPtr or an entry, or lHtEAddToVal and vHtEDelete,
+// which aren't given the table -- are reported by calling vHtETouch after.
+// Returns 0 if there's no memory to keep the callback in.
+int iHtSetChangeCallback (hashtab_t *table, htChangeCallback_t callback, void *ctx);
+void vHtSetChangeCallback (hashtab_t *table, htChangeCallback_t callback, void *ctx);	// the same, unchecked
+void vHtETouch (hashtab_t *table, hashent_t *entry);
+
+// Multimap tables (xMultimap in htConfig_t).  AddVal always adds an entry,
+// placing it after any others with the same key so that they stay adjacent
+// in the chain.  FindEntry, GetVal, SetVal and Delete act on the first entry
+// for the key.  All the entries for a key are visited with one lookup by:
+//
+//		htDupIterator_t it;
+//		for (hashent_t *e = pxHtIFindFirst (&it, table, key); e; e = pxHtFindNext (&it)) {
+//			use e->pxValue etc.
+//		}
+//
+// As with the table iterator, deleting the entry just returned is safe.
+typedef struct {
+	hashtab_t	*pxTable;
+	Link_t		*pxHead;	// bucket the key is in
+	hashent_t	*pxNext;	// next entry with the key, NULL at end
+	unsigned	ulKey;		// the key, integer or name
+	const char	*pcName;
+} htDupIterator_t;
+
+hashent_t *pxHtIFindFirst (htDupIterator_t *it, hashtab_t *table, unsigned key);
+hashent_t *pxHtSFindFirst (htDupIterator_t *it, hashtab_t *table, const char *name);
+hashent_t *pxHtFindNext (htDupIterator_t *it);
+
+// number of entries with the key (0 or 1 except in multimaps)
+unsigned ulHtICount (hashtab_t *table, unsigned key);
+unsigned ulHtSCount (hashtab_t *table, const char *name);
+
+// DeleteAll removes every entry with the key, DeleteVal the first entry with
+// the key whose value is value (for inline values, whose value bytes match
+// those value points to).  Both return the number of entries deleted.
+int iHtIDeleteAll (hashtab_t *table, unsigned key);
+int iHtSDeleteAll (hashtab_t *table, const char *name);
+int iHtIDeleteVal (hashtab_t *table, unsigned key, void *value);
+int iHtSDeleteVal (hashtab_t *table, const char *name, void *value);
+
+// Cache tables (xCache in htConfig_t).  When the table holds maxentries
+// entries, adding a new key evicts one chosen by the CLOCK algorithm: entries
+// found by Find or Get since the clock hand last passed them are spared once.
+// Entries that have outlived their time to live are dropped when a lookup
+// comes across them, or preferentially when a victim is needed.  Either way
+// pxEvictCallback sees the entry first.  vHtPrintStats shows the hit ratio.
+// SetTtl gives one entry its own time to live (ms from now, 0 for never).
+void vHtESetTtl (hashtab_t *table, hashent_t *entry, unsigned ttl);
+
+// Cuckoo tables (xCuckoo in htConfig_t) are used through the same calls as
+// chained ones, but store entries in 4-way buckets, each key having a place in
+// one of two buckets, so a lookup never reads more than two buckets and a
+// table can be over 90% full.  numbuckets is the number of 4-entry buckets
+// (raised if initentries needs more); the table grows when inserts can't be
+// placed.  An add that still can't be placed (only likely when many keys
+// collide in both hashes) fails and leaves the table as it was.  Differences
+// from chained tables: entries move during inserts and deletes, so hashent_t
+// pointers are only good until the next change to the table; vHtEDelete
+// can't be used; and multimap and cache modes aren't available.
+// vHtPrintStats shows the load and how many entries had to move.
+
+// Tables with xBloom in htConfig_t keep a blocked Bloom filter of their keys,
+// checked before a chain is walked, so looking up or adding a key that isn't
+// there usually touches one cache line of the filter and no entries.  Worth
+// having when most lookups miss.  The filter takes about 10 bits per key,
+// sized for ulBloomKeys (or initentries) and doubled as the table grows; it
+// is rebuilt after deletes, since they leave stale bits behind.  A table
+// holding both integer and string keys drops its filter at the first
+// rebuild.  Not available with cuckoo tables.  vHtPrintStats shows how many
+// chain walks it saved and how many it let through for absent keys.
+
+// Tables with ulInlineKeys in htConfig_t store string keys shorter than that
+// many bytes (16 or 24, counting the terminator) in the entry, and compare
+// them a word at a time instead of by strcmp through pcName.  Longer keys
+// are copied into table memory, as with xCopyKeys.  Either way pcName still
+// points at the key, and the caller's string isn't needed after the add.
+// These tables take string keys only; integer adds fail.  Not available
+// with cuckoo tables.
+
+// Direct-address tables (ulDirectKeys in htConfig_t) keep integer keys from
+// ulDirectBase to ulDirectBase + ulDirectKeys - 1 in an array of entries,
+// indexed by the key, with a bitmap of which are in use.  Looking one of
+// those keys up is a range check, a bit test and a load; no hashing and no
+// chain.  Keys outside the range go in the buckets as usual.  Suits keys
+// that are nearly dense in a known range (ports, small ids).  The array
+// takes a whole entry per key in the range, used or not.  Entries in it
+// aren't in any chain, so vHtEDelete can't remove them.
+//
+// SetDirect gives an existing table a range, moving the entries with keys
+// in it out of their chains (so pointers to those entries are no longer
+// valid).  With count 0 it picks the range itself, from the smallest to the
+// largest key in the table, if at least a quarter of the keys in that range
+// are present.  Returns non-zero if the table now has a range.  Not for
+// multimaps, caches, cuckoo tables, clones, or tables with string keys.
+int iHtISetDirect (hashtab_t *table, unsigned base, unsigned count);
+
+// Small tables (ulSmallKeys in htConfig_t), for the many tables that only
+// ever hold a few entries, where hashing and following a chain cost more
+// than looking at every key.  Up to ulSmallKeys entries (rounded up to a
+// multiple of 8, at most 64) are kept in one block: the keys packed together
+// (string keys as their hash), compared with SIMD instructions where the
+// compiler has them, then the entries.  There are no buckets and no blocks
+// of entries until the table outgrows that, when it moves to numbuckets
+// buckets and blocks of entryincrement entries (0 stops it growing).  At the
+// first add after it has shrunk to half of ulSmallKeys it moves back, and
+// gives the buckets and blocks up.  initentries is not used.
+//
+// As in cuckoo tables, entries move, on adds and deletes, so hashent_t
+// pointers are only good until the next change to the table, vHtEDelete
+// can't be used, and an add while iterating may free what the iterator is
+// walking.  Deleting the entry just returned is still safe.  Not for
+// multimaps, caches, cuckoo, Bloom filter, inline key or direct-address
+// tables, and small tables can't be cloned.
+
+// Compaction.  After many adds and deletes, a table's entries are spread
+// thinly over its blocks, in no particular order, so walking a chain touches
+// a cache line (and often a page) per entry.  iHtCompact moves the entries
+// into one new block, in bucket order, so the entries of each chain and its
+// neighbours are together, and frees the old blocks.  It does a bounded
+// amount of work per call -- about budget entries and buckets (0 for no
+// limit) -- so it can be called from an idle loop, and the table can be used
+// and changed between calls.  Returns non-zero while the pass has more to
+// do; the next call after it returns 0 starts another.
+//
+// Moving an entry invalidates pointers to it, so moved (if not NULL) is
+// called for each entry moved, to let the caller update any it keeps;
+// iterators shouldn't be kept across a call.  The callback given when a
+// pass starts is used for the whole pass.  Not for cuckoo, small, static
+// or cloned tables; clones and direct-address ranges can't be made while a
+// pass is under way.  vHtPrintStats counts entries moved and passes done.
+int iHtCompact (hashtab_t *table, unsigned budget, htMoveCallback_t moved, void *ctx);
+
+// Keyed tables (xKeyedHash in htConfig_t), for keys that come from people
+// who might choose them to all land in one bucket.  Keys are hashed with
+// SipHash-1-3 keyed by a random seed the table picks when created, so
+// which bucket a key goes in can't be worked out without it.  If a chain
+// still grows past ulMaxChain, the table picks a new seed at the next add
+// and moves its entries to a new bucket array a few buckets per add after
+// that (looking keys up in both meanwhile), at most once per ulCurEntries
+// adds.  Reseed starts that at once, and RehashStep moves up to buckets
+// buckets' entries (0 for all), returning non-zero while there are more.
+// Costs a slower hash, and a bucket array's worth of memory while
+// rehashing.  Tables holding both integer and string keys don't reseed.
+// As with small tables, an add while iterating may free what the iterator
+// is walking.  Not for cuckoo, small or Bloom filter tables, and keyed
+// tables can't be cloned.  vHtPrintStats counts reseeds.
+int iHtReseed (hashtab_t *table);
+int iHtRehashStep (hashtab_t *table, unsigned buckets);
+
+// Hot key caches (ulHotKeys in htConfig_t), for tables where a few hundred
+// keys among many get most of the lookups.  The table remembers the entries
+// it found most recently in a small 2-way set-associative array, indexed by
+// the key's hash, and looks there before the buckets, so a hot key is found
+// without reading its bucket head or walking its chain.  Each set holds two
+// hashes and two entry pointers; ulHotKeys is rounded up to a power of 2 (at
+// most 65536) and takes 12 bytes a key, so a few hundred keys stay in L1 or
+// L2.  Entries leave the cache when they're deleted, evicted or moved;
+// changing a value leaves the entry where it is, so it stays.  Costs an
+// extra hash on each delete, and a miss costs a look at one set.  Not for
+// cuckoo, small or static tables.  vHtPrintStats shows the hit ratio.
+
+// Ordered tables (xOrdered in htConfig_t) keep an index of their integer
+// keys in order, alongside the buckets, for asking about ranges of keys
+// without walking the whole table.  The index is a B+tree whose nodes keep
+// their 16 keys in one cache line, and the entries for them (in leaves) or
+// the nodes below (in the others) in the next two.  Finding, adding and
+// deleting keys goes through the buckets as usual; adds and deletes also
+// change the index, at the cost of a walk down it (bench.c measures it).
+//
+//		htRangeIterator_t it;
+//		for (hashent_t *e = pxHtIRangeFirst (&it, table, 1000, 1999); e; e = pxHtRangeNext (&it)) {
+//			keys 1000 to 1999 that are in the table, in order
+//		}
+//
+// The table may change while a range is being walked: entries added behind
+// the iterator aren't seen, and those added ahead of it are.  Min and Max
+// return the entries with the smallest and largest keys, LowerBound the one
+// with the smallest key not below key; all NULL if there's none.  Integer
+// keys only (string adds fail).  Not for multimaps, or cuckoo, small, inline
+// key or static tables; ordered tables can't be cloned or given a
+// direct-address range later (one set when the table is created is fine).
+// vHtPrintStats shows the index's size and height.
+typedef struct {
+	hashtab_t	*pxTable;
+	void		*pvLeaf;	// leaf of the index holding the next entry, NULL past the end
+	unsigned	ulPos;		// its place in the leaf
+	unsigned	ulFrom;		// the next key to look for, if the index has changed
+	unsigned	ulLast;		// the last key of the range
+	unsigned long ulChanges;	// count of changes to the index when pvLeaf was found
+	int			xDone;
+} htRangeIterator_t;
+
+hashent_t *pxHtIRangeFirst (htRangeIterator_t *it, hashtab_t *table, unsigned first, unsigned last);
+hashent_t *pxHtRangeNext (htRangeIterator_t *it);
+hashent_t *pxHtIMin (hashtab_t *table);
+hashent_t *pxHtIMax (hashtab_t *table);
+hashent_t *pxHtILowerBound (hashtab_t *table, unsigned key);
+
+// Release a table and all the memory it holds.  Values (other than inline
+// ones) remain the caller's responsibility.
+void vHtFreeHashTable (hashtab_t *table);
+
+// Set operations.  Each returns a new table holding the union, intersection
+// or difference (keys of a not in b) of the keys of two tables, or NULL if
+// the tables hold different kinds of key or inline values of different
+// sizes, or there's no memory.  Where a key is in both, the value comes from
+// a.  String keys are copied into the new table.  The keys of the smaller
+// table are looked up in the larger, and for big tables those lookups are
+// shared between up to threads threads (0 or 1 for none).  The tables must
+// not change while this runs.  A multimap contributes one value per key.
+hashtab_t *pxHtUnion (const char *tablename, hashtab_t *a, hashtab_t *b, unsigned threads);
+hashtab_t *pxHtIntersection (const char *tablename, hashtab_t *a, hashtab_t *b, unsigned threads);
+hashtab_t *pxHtDifference (const char *tablename, hashtab_t *a, hashtab_t *b, unsigned threads);
+
+// Copy-on-write clones.  pxHtClone returns a new table with the same
+// contents as table, sharing its buckets and entries rather than copying
+// them, so it costs a small directory per 256 buckets however many entries
+// there are.  Whichever table next changes something in a page of 256
+// buckets first copies that page and the entries in its chains, and from
+// then on has its own.  Neither table writes memory the other can see, so a
+// clone taken (under whatever lock the writers use) can be read by other
+// threads, as a consistent snapshot, while the original goes on changing.
+// Both tables must still be freed, in any order; memory they share goes
+// when the last of them does.
+//
+// Entries returned by FindEntry, GetVal or the iterators of a table sharing
+// pages may belong to a clone too, so are only for reading: change values
+// through the table's calls (Set, GetOrAdd, ExchangeVal, AddToVal,
+// FindValPtr), which take a private copy first, and don't use vHtEDelete.
+// A change that needs a page copied fails, as for a full table, if there's
+// no memory for it.  Not available for cuckoo or cache tables.
+//
+// CloneBytes reports the memory a table's buckets, entries and keys take
+// in pages it shares with other tables, and in pages only it uses.
+hashtab_t *pxHtClone (const char *tablename, hashtab_t *table);
+void vHtCloneBytes (hashtab_t *table, size_t *shared, size_t *own);
+
+// Arenas.  Giving a table an arena as its allocator:
+//
+//		htArena_t *arena = pxHtNewArena (0);
+//		htConfig_t cfg = { .pxAlloc = pvHtArenaAlloc, .pxFree = vHtArenaFree,
+//						   .pvAllocCtx = arena, .xCopyKeys = 1 };
+//
+// puts its buckets, entries and keys in the arena, and they are all released
+// together by vHtFreeHashTable (table); vHtDeleteArena (arena);
+// Several tables can share an arena.  chunksize 0 uses 64KB chunks.
+typedef struct _htArena htArena_t;
+
+htArena_t *pxHtNewArena (size_t chunksize);
+void vHtDeleteArena (htArena_t *arena);
+void *pvHtArenaAlloc (size_t size, void *arena);
+void vHtArenaFree (void *ptr, size_t size, void *arena);
+size_t ulHtArenaBytes (htArena_t *arena);	// memory the arena has taken from the system
+
+// Arenas for very large tables, where TLB misses on the bucket array and the
+// blocks of entries are a large part of lookup time.  With these flags the
+// arena maps its chunks (rounded up to whole huge pages) directly:
+//	htARENA_HUGEPAGES			on huge pages: reserved ones if available, else
+//								transparent huge pages if the kernel allows
+//	htARENA_NUMA_BIND			only on the NUMA nodes in nodemask (bit n = node n)
+//	htARENA_NUMA_INTERLEAVE		spread page by page across the nodes in nodemask
+// Where an option isn't supported (or on FreeRTOS) chunks come from malloc as
+// usual.  Give the arena a large chunksize, so the buckets and many blocks of
+// entries share each huge page.  MappedBytes is how much was mapped this way.
+#define htHUGEPAGE				(2 * 1024 * 1024)
+#define htARENA_HUGEPAGES		0x1
+#define htARENA_NUMA_BIND		0x2
+#define htARENA_NUMA_INTERLEAVE	0x4
+
+htArena_t *pxHtNewArenaEx (size_t chunksize, unsigned flags, unsigned long nodemask);
+size_t ulHtArenaMappedBytes (htArena_t *arena);
 
 // if compiled-in, print statistics of hash table
 void vHtPrintStats (hashtab_t *table);
@@ -88,6 +600,10 @@ typedef struct  {
 	hashtab_t	*pxTable;
 	hashent_t	*pxNext;	// next to be returned on call to htIteratorNext
 	unsigned	ulBucket;	// index of bucket that holds *next
+	unsigned	ulStash;	// cuckoo tables: stash entries not yet visited
+	Link_t		*pxHead;	// head of the chain being walked
+	unsigned	ulDirect;	// direct-address tables: next slot of the array to look at, ~0 when done
+	hashent_t	*pxCur;		// last returned, for iHtIteratorDelete
 } htIterator_t;
 
 // Iterator.  Note that since hash tables are sparse, a function call is needed to find next.
@@ -114,4 +630,12 @@ typedef struct  {
 void vHtInitIterator (htIterator_t *it, hashtab_t *table);
 hashent_t *pxHtIteratorNext (htIterator_t *it);
 
+// Delete the entry the iterator last returned, as iHtDeleteEntry does:
+//
+//		htFOREACH(it,ht,hashtable) {
+//			if (stale (ht))
+//				iHtIteratorDelete (&it);
+//		}
+int iHtIteratorDelete (htIterator_t *it);
+
 #endif
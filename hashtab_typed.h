@@ -0,0 +1,265 @@
+/*
+ *  hashtab_typed.h
+ *
+ *  Copyright 2010,2022 TRIA Network Systems. See LICENSE file for details.
+ */
+
+#ifndef _HASHTAB_TYPED_H_
+#define _HASHTAB_TYPED_H_
+
+// Type-specialized hash tables.  htDEFINE generates a complete table for one
+// key type and one value type, with every operation a static inline function
+// calling the supplied hash and compare functions directly.  The compiler can
+// then inline the whole lookup, and there is no run-time test of which kind of
+// key is in use the way prvHashLookupCom has to do for the generic hashtab_t.
+//
+// The algorithm is the same as hashtab.c: buckets with chaining, entries taken
+// from a freelist that is refilled in blocks of entryincrement.  Chains are
+// singly linked, since a typed table never has to delete an entry it was not
+// already walking the chain to find.
+//
+// Usage, for a table named Port with unsigned keys and int values:
+//
+//		htDEFINE(Port, unsigned, int, ulHtHashUnsigned, xHtEqUnsigned)
+//
+//		htPort_t *t = pxHtPortNew (49, 0, 25);
+//		iHtPortAdd (t, 80, 1);
+//		int *v = pxHtPortGet (t, 80);		// NULL if not present
+//		htTFOREACH(Port, it, w, t) {
+//			use w->xKey, w->xValue
+//		}
+//		vHtPortFree (t);
+//
+// Generated types: htNAME_t (table), htNAMEEnt_t (entry), htNAMEIterator_t.
+// Generated functions: pxHtNAMENew, vHtNAMEFree, pxHtNAMEFind, pxHtNAMEGet,
+// iHtNAMEAdd, iHtNAMESet, iHtNAMEDelete, vHtNAMEInitIterator, pxHtNAMEIteratorNext.
+// Return values follow the generic table: Add returns 0 on an existing key,
+// Set returns the number of entries added, Delete the number deleted.
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef htTMALLOC				// FreeRTOS builds can point these at pvRsMemAlloc/vRsMemFree
+#define htTMALLOC(x)	malloc(x)
+#define htTFREE(x)		free(x)
+#endif
+
+// Ready-made hash and compare functions for the common key types.  They use
+// the same hashing as the generic table, so bucket count advice carries over.
+static inline unsigned ulHtHashUnsigned (unsigned key)
+{
+	return (277 * key + key + 12345);
+}
+static inline int xHtEqUnsigned (unsigned a, unsigned b)
+{
+	return (a == b);
+}
+static inline unsigned ulHtHashString (const char *name)
+{
+	unsigned hash = 0;
+
+	for (; *name; name++)
+		hash = (hash >> 16) + ((hash << 5) ^ (*name));
+	return (hash);
+}
+static inline int xHtEqString (const char *a, const char *b)
+{
+	return (strcmp(a, b) == 0);
+}
+
+#define htTFORLOOP(name,walker,iterator) for(ht##name##Ent_t *walker; (walker = pxHt##name##IteratorNext (&iterator));)
+#define htTFOREACH(name,it,w,tab) ht##name##Iterator_t it; vHt##name##InitIterator(&it,tab); htTFORLOOP(name,w,it)
+
+#define htDEFINE(name, keytype, valtype, hashfn, eqfn)							\
+																				\
+typedef struct _ht##name##Ent {													\
+	struct _ht##name##Ent *pxNext;	/* next in bucket, or freelist link */		\
+	keytype xKey;																\
+	valtype xValue;																\
+} ht##name##Ent_t;																\
+																				\
+typedef struct _ht##name##Slab {												\
+	struct _ht##name##Slab *pxNext;	/* all slabs, so the table can be freed */	\
+} ht##name##Slab_t;																\
+																				\
+typedef struct {																\
+	ht##name##Ent_t **ppxBuckets;	/* array of chain heads */					\
+	ht##name##Ent_t *pxFreelist;	/* allocated but unused entries */			\
+	ht##name##Slab_t *pxSlabs;		/* blocks of entries from htTMALLOC */		\
+	unsigned ulBucketCount;														\
+	unsigned ulMaxEntries;			/* absolute cap, 0 if none */				\
+	unsigned ulCurEntries;														\
+	unsigned ulAllocSize;			/* entries added per refill */				\
+} ht##name##_t;																	\
+																				\
+typedef struct {																\
+	ht##name##_t *pxTable;														\
+	ht##name##Ent_t *pxNext;		/* next to be returned */					\
+	unsigned ulBucket;				/* bucket holding pxNext */					\
+} ht##name##Iterator_t;															\
+																				\
+static inline ht##name##_t *pxHt##name##New (unsigned numbuckets,				\
+						unsigned maxentries, unsigned entryincrement)			\
+{																				\
+	ht##name##_t *tab = (ht##name##_t *) htTMALLOC(sizeof (ht##name##_t));		\
+																				\
+	numbuckets |= 1;	/* avoid degenerate case of even bucket count */		\
+	if (tab == NULL) 															\
+		return (NULL);															\
+	tab->ppxBuckets = (ht##name##Ent_t **) htTMALLOC(sizeof (ht##name##Ent_t *) * numbuckets); \
+	if (tab->ppxBuckets == NULL) {												\
+		htTFREE(tab);															\
+		return (NULL);															\
+	}																			\
+	memset(tab->ppxBuckets, 0, sizeof (ht##name##Ent_t *) * numbuckets);		\
+	tab->pxFreelist = NULL;														\
+	tab->pxSlabs = NULL;														\
+	tab->ulBucketCount = numbuckets;											\
+	tab->ulMaxEntries = maxentries;												\
+	tab->ulCurEntries = 0;														\
+	tab->ulAllocSize = entryincrement ? entryincrement : 1;						\
+	return (tab);																\
+}																				\
+																				\
+static inline void vHt##name##Free (ht##name##_t *tab)							\
+{																				\
+	while (tab->pxSlabs) {														\
+		ht##name##Slab_t *s = tab->pxSlabs;										\
+																				\
+		tab->pxSlabs = s->pxNext;												\
+		htTFREE(s);																\
+	}																			\
+	htTFREE(tab->ppxBuckets);													\
+	htTFREE(tab);																\
+}																				\
+																				\
+/* slab header is padded to entry size so the entries stay aligned */			\
+static inline int prvHt##name##Morefree (ht##name##_t *tab)						\
+{																				\
+	unsigned num2add = tab->ulAllocSize;										\
+	ht##name##Slab_t *s;														\
+	ht##name##Ent_t *e;															\
+																				\
+	if (tab->ulMaxEntries && tab->ulCurEntries + num2add > tab->ulMaxEntries)	\
+		num2add = tab->ulMaxEntries - tab->ulCurEntries;						\
+	if (num2add == 0															\
+		|| !(s = (ht##name##Slab_t *) htTMALLOC(sizeof (ht##name##Ent_t) * (num2add + 1)))) \
+		return (0);																\
+	s->pxNext = tab->pxSlabs;													\
+	tab->pxSlabs = s;															\
+	e = (ht##name##Ent_t *) s + 1;												\
+	for (unsigned i = 0; i < num2add; i++, e++) {								\
+		e->pxNext = tab->pxFreelist;											\
+		tab->pxFreelist = e;													\
+	}																			\
+	return (1);																	\
+}																				\
+																				\
+/* find the chain head a key belongs in, and the entry if it's there */			\
+static inline ht##name##Ent_t **prvHt##name##Lookup (ht##name##_t *tab,		\
+						keytype key, ht##name##Ent_t **entry)					\
+{																				\
+	ht##name##Ent_t **head = &tab->ppxBuckets[(hashfn(key)) % tab->ulBucketCount]; \
+	ht##name##Ent_t *e;															\
+																				\
+	for (e = *head; e; e = e->pxNext) {											\
+		if (eqfn(key, e->xKey))													\
+			break;																\
+	}																			\
+	*entry = e;																	\
+	return (head);																\
+}																				\
+																				\
+static inline ht##name##Ent_t *pxHt##name##Find (ht##name##_t *tab, keytype key) \
+{																				\
+	ht##name##Ent_t *e;															\
+																				\
+	(void) prvHt##name##Lookup(tab, key, &e);									\
+	return (e);																	\
+}																				\
+																				\
+static inline valtype *pxHt##name##Get (ht##name##_t *tab, keytype key)		\
+{																				\
+	ht##name##Ent_t *e = pxHt##name##Find(tab, key);							\
+																				\
+	return (e ? &e->xValue : NULL);												\
+}																				\
+																				\
+static inline int prvHt##name##AddVal (ht##name##_t *tab, int overwrite,		\
+						keytype key, valtype value)								\
+{																				\
+	ht##name##Ent_t *e;															\
+	ht##name##Ent_t **head = prvHt##name##Lookup(tab, key, &e);				\
+																				\
+	if (e) {																	\
+		if (overwrite)															\
+			e->xValue = value;													\
+		return (overwrite ? 1 : 0);												\
+	}																			\
+	if (!tab->pxFreelist && !prvHt##name##Morefree(tab))						\
+		return (0);																\
+	e = tab->pxFreelist;														\
+	tab->pxFreelist = e->pxNext;												\
+	tab->ulCurEntries++;														\
+	e->xKey = key;																\
+	e->xValue = value;															\
+	e->pxNext = *head;															\
+	*head = e;																	\
+	return (1);																	\
+}																				\
+static inline int iHt##name##Add (ht##name##_t *tab, keytype key, valtype value) \
+{																				\
+	return (prvHt##name##AddVal(tab, 0, key, value));							\
+}																				\
+static inline int iHt##name##Set (ht##name##_t *tab, keytype key, valtype value) \
+{																				\
+	return (prvHt##name##AddVal(tab, 1, key, value));							\
+}																				\
+																				\
+static inline int iHt##name##Delete (ht##name##_t *tab, keytype key)			\
+{																				\
+	ht##name##Ent_t **pp = &tab->ppxBuckets[(hashfn(key)) % tab->ulBucketCount]; \
+																				\
+	for (; *pp; pp = &(*pp)->pxNext) {											\
+		ht##name##Ent_t *e = *pp;												\
+																				\
+		if (eqfn(key, e->xKey)) {												\
+			*pp = e->pxNext;													\
+			e->pxNext = tab->pxFreelist;										\
+			tab->pxFreelist = e;												\
+			tab->ulCurEntries--;												\
+			return (1);															\
+		}																		\
+	}																			\
+	return (0);																	\
+}																				\
+																				\
+/* as with the generic iterator, the next entry is found before the current	\
+   one is returned, so deleting the returned entry is safe */					\
+static inline void prvHt##name##Nextentry (ht##name##Iterator_t *it)			\
+{																				\
+	if (it->pxNext && (it->pxNext = it->pxNext->pxNext))						\
+		return;																	\
+	while (++it->ulBucket < it->pxTable->ulBucketCount) {						\
+		if ((it->pxNext = it->pxTable->ppxBuckets[it->ulBucket]))				\
+			return;																\
+	}																			\
+	it->pxNext = NULL;															\
+}																				\
+static inline void vHt##name##InitIterator (ht##name##Iterator_t *it, ht##name##_t *tab) \
+{																				\
+	it->pxTable = tab;															\
+	it->ulBucket = 0;															\
+	if (!(it->pxNext = tab->ppxBuckets[0]))										\
+		prvHt##name##Nextentry(it);												\
+}																				\
+static inline ht##name##Ent_t *pxHt##name##IteratorNext (ht##name##Iterator_t *it) \
+{																				\
+	ht##name##Ent_t *retval = it->pxNext;										\
+																				\
+	if (retval)																	\
+		prvHt##name##Nextentry(it);												\
+	return (retval);															\
+}
+
+#endif
@@ -0,0 +1,235 @@
+/*
+ *  htcombine.c
+ *
+ *  Copyright 2010,2022 TRIA Network Systems. See LICENSE file for details.
+ */
+
+#define _GNU_SOURCE			// for posix_memalign and sched_yield
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include "htcombine.h"
+
+#define DEBUGPRINTF(tag,format,x...)	printf("%s " format "\n",TAG,x)
+
+static const char* TAG = "[htcombine]"; // labels log message origin
+
+#define htCOMB_MAXSLOTS	256
+#define htCOMB_PASSES	4		// passes a combiner makes over the slots while they have work
+#define htCOMB_SPINS	64		// looks at a slot before giving up the CPU
+#define htCACHELINE		64		// each slot has a line to itself
+
+enum { htSLOT_FREE, htSLOT_IDLE, htSLOT_POSTED, htSLOT_DONE };
+enum { htOP_SET, htOP_ADD, htOP_GET };
+
+// A thread's operation, posted for the combiner, and its result
+struct _htCSlot {
+	unsigned ulState;		// one of htSLOT_, changed with __atomic calls
+	unsigned ulOp;
+	unsigned ulKey;
+	int lDelta;				// htOP_ADD: amount to add
+	void *pvValue;			// htOP_SET: value to store; htOP_GET: value found
+	int lResult;
+	htCombiner_t *pxComb;
+};
+
+struct _htCombiner {
+	hashtab_t *pxTable;
+	char *pcSlots;			// ulMaxSlots slots, htCACHELINE bytes apart
+	unsigned ulMaxSlots;
+	unsigned ulUsed;		// slots ever claimed, so the combiner can stop looking
+	unsigned xLock;			// set while a thread is combining
+	htCombinerStats_t xStats;
+};
+
+#define htSLOT(comb,i)	((htCSlot_t *)((comb)->pcSlots + (size_t)(i) * htCACHELINE))
+
+htCombiner_t *pxHtNewCombiner (hashtab_t *table, unsigned maxthreads)
+{
+	htCombiner_t *comb;
+	void *slots;
+
+	if (table->xCache) {
+		DEBUGPRINTF(TAG,"cache table \"%s\" can't be used with a combiner", table->pcTablename);
+		return (NULL);
+	}
+	if (maxthreads == 0 || maxthreads > htCOMB_MAXSLOTS)
+		maxthreads = htCOMB_MAXSLOTS;
+	if (!(comb = calloc(1, sizeof *comb)))
+		return (NULL);
+	if (posix_memalign(&slots, htCACHELINE, (size_t)maxthreads * htCACHELINE) != 0) {
+		free(comb);
+		return (NULL);
+	}
+	memset(slots, 0, (size_t)maxthreads * htCACHELINE);
+	comb->pxTable = table;
+	comb->pcSlots = slots;
+	comb->ulMaxSlots = maxthreads;
+	for (unsigned i = 0; i < maxthreads; i++)
+		htSLOT(comb, i)->pxComb = comb;
+	return (comb);
+}
+
+void vHtFreeCombiner (htCombiner_t *comb)
+{
+	free(comb->pcSlots);
+	free(comb);
+}
+
+htCSlot_t *pxHtCombinerSlot (htCombiner_t *comb)
+{
+	for (unsigned i = 0; i < comb->ulMaxSlots; i++) {
+		htCSlot_t *slot = htSLOT(comb, i);
+		unsigned state = htSLOT_FREE, used;
+
+		if (!__atomic_compare_exchange_n(&slot->ulState, &state, htSLOT_IDLE, 0,
+										 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			continue;
+		used = __atomic_load_n(&comb->ulUsed, __ATOMIC_RELAXED);
+		while (used <= i && !__atomic_compare_exchange_n(&comb->ulUsed, &used, i + 1, 0,
+														 __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+		return (slot);
+	}
+	return (NULL);
+}
+
+void vHtCombinerLeave (htCSlot_t *slot)
+{
+	__atomic_store_n(&slot->ulState, htSLOT_FREE, __ATOMIC_RELEASE);
+}
+
+// Apply the operations in batch with key, in order, from one lookup (two if
+// a read comes before a change to a key that isn't there)
+static void prvApplyKey (htCombiner_t *comb, htCSlot_t **batch, unsigned n, unsigned key)
+{
+	hashtab_t *table = comb->pxTable;
+	hashent_t *e = NULL;
+	int found = 0, writable = 0, changed = 0;
+
+	for (unsigned i = 0; i < n; i++) {
+		htCSlot_t *slot = batch[i];
+
+		if (!slot || slot->ulKey != key)
+			continue;
+		if (slot->ulOp == htOP_GET) {
+			if (!found && !writable) {
+				e = pxHtIFindEntry(table, key);
+				found = 1;
+				comb->xStats.ulProbes++;
+			}
+			slot->pvValue = e ? (table->ulValSize ? htVALPTR(table, e) : e->pxValue) : NULL;
+		} else {
+			// changes need the entry from GetOrAdd: it may have to be added,
+			// or (in a clone) copied before it's written
+			if (!writable) {
+				e = pxHtIGetOrAdd(table, key, NULL);
+				writable = 1;
+				comb->xStats.ulProbes++;
+			}
+			if (!e) {
+				slot->lResult = 0;
+			} else if (slot->ulOp == htOP_ADD) {
+				int *counter = table->ulValSize ? htVALPTR(table, e) : &e->lValue;
+
+				slot->lResult = (*counter += slot->lDelta);
+				changed = 1;
+			} else {
+				if (!table->ulValSize)
+					e->pxValue = slot->pvValue;
+				else if (slot->pvValue)
+					memcpy(htVALPTR(table, e), slot->pvValue, table->ulValSize);
+				else
+					memset(htVALPTR(table, e), 0, table->ulValSize);
+				slot->lResult = 1;	// as iHtISetVal, whether added or replaced
+				changed = 1;
+			}
+		}
+		batch[i] = NULL;
+		comb->xStats.ulOps++;
+		__atomic_store_n(&slot->ulState, htSLOT_DONE, __ATOMIC_RELEASE);
+	}
+	if (changed)
+		vHtETouch(table, e);
+}
+
+// Apply everything posted, looking again while there's more
+static void prvCombine (htCombiner_t *comb)
+{
+	htCSlot_t *batch[htCOMB_MAXSLOTS];
+
+	for (int pass = 0; pass < htCOMB_PASSES; pass++) {
+		unsigned used = __atomic_load_n(&comb->ulUsed, __ATOMIC_ACQUIRE), n = 0;
+
+		for (unsigned i = 0; i < used; i++) {
+			htCSlot_t *slot = htSLOT(comb, i);
+
+			if (__atomic_load_n(&slot->ulState, __ATOMIC_ACQUIRE) == htSLOT_POSTED)
+				batch[n++] = slot;
+		}
+		if (!n)
+			break;
+		comb->xStats.ulPasses++;
+		for (unsigned i = 0; i < n; i++) {
+			if (batch[i])
+				prvApplyKey(comb, batch + i, n - i, batch[i]->ulKey);
+		}
+	}
+}
+
+// Post the slot's operation and wait for it to be done, by this thread if
+// it can become the combiner, or by the thread that is
+static void prvPost (htCSlot_t *slot)
+{
+	htCombiner_t *comb = slot->pxComb;
+
+	__atomic_store_n(&slot->ulState, htSLOT_POSTED, __ATOMIC_RELEASE);
+	for (unsigned spins = 1; __atomic_load_n(&slot->ulState, __ATOMIC_ACQUIRE) != htSLOT_DONE; spins++) {
+		if (!__atomic_load_n(&comb->xLock, __ATOMIC_RELAXED)
+			&& !__atomic_exchange_n(&comb->xLock, 1, __ATOMIC_ACQUIRE)) {
+			prvCombine(comb);
+			__atomic_store_n(&comb->xLock, 0, __ATOMIC_RELEASE);
+		} else if (spins % htCOMB_SPINS == 0) {
+			sched_yield();
+		} else {
+#if defined(__x86_64__) || defined(__i386__)
+			__builtin_ia32_pause();
+#endif
+		}
+	}
+	__atomic_store_n(&slot->ulState, htSLOT_IDLE, __ATOMIC_RELAXED);
+}
+
+int iHtCSetVal (htCSlot_t *slot, unsigned key, void *value)
+{
+	slot->ulOp = htOP_SET;
+	slot->ulKey = key;
+	slot->pvValue = value;
+	prvPost(slot);
+	return (slot->lResult);
+}
+int lHtCAddToVal (htCSlot_t *slot, unsigned key, int delta)
+{
+	hashtab_t *table = slot->pxComb->pxTable;
+
+	if (table->ulValSize && table->ulValSize < sizeof (int))
+		return (0);			// as lHtIAddToVal: nothing to add to
+	slot->ulOp = htOP_ADD;
+	slot->ulKey = key;
+	slot->lDelta = delta;
+	prvPost(slot);
+	return (slot->lResult);
+}
+void *pvHtCGetVal (htCSlot_t *slot, unsigned key)
+{
+	slot->ulOp = htOP_GET;
+	slot->ulKey = key;
+	prvPost(slot);
+	return (slot->pvValue);
+}
+
+const htCombinerStats_t *pxHtCombinerStats (htCombiner_t *comb)
+{
+	return (&comb->xStats);
+}
@@ -0,0 +1,57 @@
+/*
+ *  htcombine.h
+ *
+ *  Copyright 2010,2022 TRIA Network Systems. See LICENSE file for details.
+ */
+
+#ifndef _HTCOMBINE_H_
+#define _HTCOMBINE_H_
+
+#include "hashtab.h"
+
+// Flat combining, for tables that many threads update at once, mostly on a
+// few hot keys.  Rather than each thread taking a lock on the table in turn,
+// a thread posts its operation in its own slot and whichever thread gets
+// the combiner role applies every posted operation in one pass, while the
+// others wait on their slots.  Operations on the same key in a pass share
+// one lookup, and the table stays in the combining thread's cache.
+//
+//		htCombiner_t *comb = pxHtNewCombiner (table, 16);
+//		... in each thread:
+//		htCSlot_t *slot = pxHtCombinerSlot (comb);
+//		lHtCAddToVal (slot, key, 1);
+//		vHtCombinerLeave (slot);		// when the thread is finished with it
+//
+// Each slot belongs to one thread at a time.  While a combiner is in use,
+// every access to the table must go through it.  Operations from different
+// threads on the same key are applied in no particular order; a thread's
+// own are applied in order.  POSIX only.
+
+typedef struct _htCombiner htCombiner_t;
+typedef struct _htCSlot htCSlot_t;
+
+typedef struct {
+	unsigned long ulOps;		// operations applied
+	unsigned long ulPasses;		// passes over the slots that found work
+	unsigned long ulProbes;		// table lookups they needed
+} htCombinerStats_t;
+
+// A combiner for up to maxthreads threads at a time (at most 256).  NULL if
+// there's no memory.  Freeing it leaves the table alone.
+htCombiner_t *pxHtNewCombiner (hashtab_t *table, unsigned maxthreads);
+void vHtFreeCombiner (htCombiner_t *comb);
+
+// Claim a slot for the calling thread, NULL if they're all taken, and give
+// it up again
+htCSlot_t *pxHtCombinerSlot (htCombiner_t *comb);
+void vHtCombinerLeave (htCSlot_t *slot);
+
+// The table calls, made through a slot: same arguments and results as
+// iHtISetVal, lHtIAddToVal and pvHtIGetVal
+int iHtCSetVal (htCSlot_t *slot, unsigned key, void *value);
+int lHtCAddToVal (htCSlot_t *slot, unsigned key, int delta);
+void *pvHtCGetVal (htCSlot_t *slot, unsigned key);
+
+const htCombinerStats_t *pxHtCombinerStats (htCombiner_t *comb);
+
+#endif
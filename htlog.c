@@ -0,0 +1,520 @@
+/*
+ *  htlog.c
+ *
+ *  Copyright 2010,2022 TRIA Network Systems. See LICENSE file for details.
+ */
+
+#define _GNU_SOURCE			// for clock_gettime and fsync
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "htlog.h"
+
+#define DEBUGPRINTF(tag,format,x...)	printf("%s " format "\n",TAG,x)
+
+static const char* TAG = "[htlog]"; // labels log message origin
+
+// Files start with a header naming what they are and the value size of the
+// records in them.  Records follow, each a htRecHdr_t, then the key (4 bytes
+// for an integer, usKeyLen bytes for a string, no terminator), then for
+// htREC_SET the value.  A snapshot ends with a htREC_END record.
+#define htLOG_MAGIC		"HTLOG1"
+#define htSNAP_MAGIC	"HTSNAP1"
+
+typedef struct {
+	char acMagic[8];
+	uint32_t ulValSize;		// bytes of value in each htREC_SET
+	uint32_t ulSpare;
+} htFileHdr_t;
+
+#define htREC_END		0
+#define htREC_SET		1		// the key now has this value
+#define htREC_DEL		2		// the key is gone
+#define htREC_STRING	0x80	// or'ed in when the key is a string
+
+typedef struct {
+	uint32_t ulCheck;		// FNV-1a of the rest of the record, to find torn ones
+	uint8_t ucOp;
+	uint8_t ucSpare;
+	uint16_t usKeyLen;		// string keys only
+} htRecHdr_t;
+
+#define htMAXKEYLEN		0xffff
+#define htDEFBATCHMS	10
+#define htDEFBATCHBYTES	65536
+
+struct _htLog {
+	hashtab_t *pxTable;
+	char *pcLogName;		// p.log, and the others, in one allocation
+	char *pcOldName;
+	char *pcSnapName;
+	char *pcTmpName;
+	int iFd;				// the log, for appending
+	htLogConfig_t xConfig;
+	unsigned ulValSize;		// bytes of value in each record
+	char *pcBatch;			// changes not yet written
+	size_t ulBatchUsed;
+	size_t ulBatchSize;
+	unsigned ulBatchStart;	// ms time of the first change in the batch
+	char *pcSnapBuf;		// buffer for the compacting child, allocated beforehand
+	size_t ulSnapBufSize;
+	pid_t xCompactor;		// child writing a snapshot, 0 if none
+	int xCompactDue;		// the log outgrew ulCompactBytes, compact at the next commit
+	int xFailed;			// set when the log can't be written; changes aren't logged
+	htLogStats_t xStats;
+};
+
+static unsigned prvNowMs (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((unsigned)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000));
+}
+
+static uint32_t prvCheck (const char *p, size_t len)
+{
+	uint32_t h = 2166136261u;
+
+	while (len--)
+		h = (h ^ (unsigned char)*p++) * 16777619u;
+	return (h);
+}
+
+// Largest record a table can produce
+static size_t prvMaxRecord (htLog_t *log)
+{
+	return (sizeof (htRecHdr_t) + htMAXKEYLEN + log->ulValSize);
+}
+
+// Build the record for an entry at buf, returning its length, or 0 if its
+// key is too long to log
+static size_t prvPutRecord (htLog_t *log, char *buf, hashent_t *e, unsigned op)
+{
+	hashtab_t *table = log->pxTable;
+	htRecHdr_t hdr = { 0, op, 0, 0 };
+	char *p = buf + sizeof hdr;
+
+	if (table->xHasString) {
+		size_t len = strlen(e->pcName);
+
+		if (len > htMAXKEYLEN)
+			return (0);
+		hdr.ucOp |= htREC_STRING;
+		hdr.usKeyLen = len;
+		memcpy(p, e->pcName, len);
+		p += len;
+	} else {
+		uint32_t key = e->ulKey;
+
+		memcpy(p, &key, sizeof key);
+		p += sizeof key;
+	}
+	if (op == htREC_SET) {
+		memcpy(p, htVALPTR(table, e), log->ulValSize);
+		p += log->ulValSize;
+	}
+	memcpy(buf, &hdr, sizeof hdr);
+	hdr.ulCheck = prvCheck(buf + sizeof hdr.ulCheck, p - buf - sizeof hdr.ulCheck);
+	memcpy(buf, &hdr.ulCheck, sizeof hdr.ulCheck);
+	return (p - buf);
+}
+
+static int prvWriteAll (int fd, const char *p, size_t len)
+{
+	while (len) {
+		ssize_t n = write(fd, p, len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return (-1);
+		p += n;
+		len -= n;
+	}
+	return (0);
+}
+
+// Make a rename or create in the directory holding path durable
+static void prvSyncDir (const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	char *dir = slash ? strndup(path, slash == path ? 1 : slash - path) : strdup(".");
+	int fd = dir ? open(dir, O_RDONLY) : -1;
+
+	if (fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+	free(dir);
+}
+
+static int prvCreateFile (const char *name, const char *magic, unsigned valsize)
+{
+	htFileHdr_t hdr = { { 0 }, valsize, 0 };
+	int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+
+	memcpy(hdr.acMagic, magic, strlen(magic));
+	if (fd >= 0 && (prvWriteAll(fd, (char *)&hdr, sizeof hdr) < 0 || fsync(fd) < 0)) {
+		close(fd);
+		fd = -1;
+	}
+	return (fd);
+}
+
+// Write the batch out, and sync it unless told not to
+static int prvWriteBatch (htLog_t *log)
+{
+	if (log->xFailed)
+		return (-1);
+	if (!log->ulBatchUsed)
+		return (0);
+	if (prvWriteAll(log->iFd, log->pcBatch, log->ulBatchUsed) < 0
+		|| (log->xConfig.ulSync != htLOG_SYNC_NONE && fsync(log->iFd) < 0)) {
+		DEBUGPRINTF(TAG,"can't write %s, no longer logging changes", log->pcLogName);
+		log->xFailed = 1;
+		return (-1);
+	}
+	log->xStats.ulLogBytes += log->ulBatchUsed;
+	log->xStats.ulBatches++;
+	if (log->xConfig.ulSync != htLOG_SYNC_NONE)
+		log->xStats.ulSyncs++;
+	log->ulBatchUsed = 0;
+	return (0);
+}
+
+// See whether a compaction has finished, waiting for it if wait is set.
+// Once the snapshot is in place the log it covered can go.
+static void prvReap (htLog_t *log, int wait)
+{
+	int status;
+
+	if (!log->xCompactor || waitpid(log->xCompactor, &status, wait ? 0 : WNOHANG) != log->xCompactor)
+		return;
+	log->xCompactor = 0;
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+		unlink(log->pcOldName);
+		prvSyncDir(log->pcOldName);
+		log->xStats.ulCompactions++;
+	} else {
+		DEBUGPRINTF(TAG,"snapshot %s wasn't written, keeping %s", log->pcSnapName, log->pcOldName);
+	}
+}
+
+// The change callback: add a record to the batch, and write the batch if
+// it's time
+static void prvLogChange (hashtab_t *table, hashent_t *e, int deleted, void *ctx)
+{
+	htLog_t *log = ctx;
+	unsigned now = prvNowMs();
+	size_t len;
+
+	if (log->xFailed)
+		return;
+	if (table->xHasString && table->xHasInt) {
+		DEBUGPRINTF(TAG,"table \"%s\" has both kinds of key, no longer logging changes", table->pcTablename);
+		log->xFailed = 1;
+		return;
+	}
+	if (log->ulBatchUsed + prvMaxRecord(log) > log->ulBatchSize && prvWriteBatch(log) < 0)
+		return;
+	if (!log->ulBatchUsed)
+		log->ulBatchStart = now;
+	if (!(len = prvPutRecord(log, log->pcBatch + log->ulBatchUsed, e, deleted ? htREC_DEL : htREC_SET))) {
+		DEBUGPRINTF(TAG,"key too long to log in table \"%s\"", table->pcTablename);
+		return;
+	}
+	log->ulBatchUsed += len;
+	log->xStats.ulRecords++;
+	if (log->xConfig.ulSync == htLOG_SYNC_EACH || log->ulBatchUsed >= log->xConfig.ulBatchBytes
+		|| now - log->ulBatchStart >= log->xConfig.ulBatchMs) {
+		if (prvWriteBatch(log) < 0)
+			return;
+		prvReap(log, 0);
+		// Not compacted from here: a delete is logged before the entry goes,
+		// so a child forked now would put it in the snapshot
+		if (log->xConfig.ulCompactBytes && log->xStats.ulLogBytes > log->xConfig.ulCompactBytes)
+			log->xCompactDue = 1;
+	}
+}
+
+// Apply the records in one file to the table.  Returns the offset just past
+// the last good record, or -1 if the file is unusable.  A missing file is
+// empty.  Snapshots must end with htREC_END; logs may end with a torn record.
+static long prvReplay (htLog_t *log, const char *name, const char *magic)
+{
+	hashtab_t *table = log->pxTable;
+	FILE *f = fopen(name, "rb");
+	htFileHdr_t fhdr;
+	char *buf = NULL, *key = NULL;
+	long good = -1;
+	int ended = 0;
+
+	if (!f)
+		return (errno == ENOENT ? 0 : -1);
+	if (fread(&fhdr, sizeof fhdr, 1, f) != 1 || strncmp(fhdr.acMagic, magic, sizeof fhdr.acMagic) != 0
+		|| fhdr.ulValSize != log->ulValSize) {
+		DEBUGPRINTF(TAG,"%s isn't a log for this table", name);
+		fclose(f);
+		return (-1);
+	}
+	if (!(buf = malloc(prvMaxRecord(log))) || !(key = malloc(htMAXKEYLEN + 1))) {
+		free(buf);
+		fclose(f);
+		return (-1);
+	}
+	good = sizeof fhdr;
+	for (;;) {
+		htRecHdr_t hdr;
+		size_t keylen, len;
+		unsigned op;
+		hashent_t *e;
+		uint32_t ikey;
+
+		if (fread(&hdr, sizeof hdr, 1, f) != 1)
+			break;
+		op = hdr.ucOp & ~htREC_STRING;
+		keylen = (hdr.ucOp & htREC_STRING) ? hdr.usKeyLen : sizeof ikey;
+		len = keylen + (op == htREC_SET ? log->ulValSize : 0);
+		memcpy(buf, &hdr, sizeof hdr);
+		if (op > htREC_DEL || (op != htREC_END && fread(buf + sizeof hdr, len, 1, f) != 1))
+			break;
+		if (op == htREC_END) {
+			len = 0;
+			keylen = 0;
+		}
+		if (prvCheck(buf + sizeof hdr.ulCheck, sizeof hdr - sizeof hdr.ulCheck + (op == htREC_END ? 0 : len)) != hdr.ulCheck)
+			break;
+		if (op == htREC_END) {
+			ended = 1;
+			break;
+		}
+		if (hdr.ucOp & htREC_STRING) {
+			if (!table->xCopyKeys && !table->ulKeyInline) {
+				DEBUGPRINTF(TAG,"table \"%s\" must copy its string keys to be recovered", table->pcTablename);
+				good = -1;
+				break;
+			}
+			memcpy(key, buf + sizeof hdr, keylen);
+			key[keylen] = '\0';
+		} else {
+			memcpy(&ikey, buf + sizeof hdr, sizeof ikey);
+		}
+		if (op == htREC_DEL) {
+			if (hdr.ucOp & htREC_STRING)
+				iHtSDelete(table, key);
+			else
+				iHtIDelete(table, ikey);
+		} else {
+			e = (hdr.ucOp & htREC_STRING) ? pxHtSGetOrAdd(table, key, NULL) : pxHtIGetOrAdd(table, ikey, NULL);
+			if (!e) {
+				DEBUGPRINTF(TAG,"no room in table \"%s\" to recover it", table->pcTablename);
+				good = -1;
+				break;
+			}
+			memcpy(htVALPTR(table, e), buf + sizeof hdr + keylen, log->ulValSize);
+		}
+		log->xStats.ulReplayed++;
+		good = ftell(f);
+	}
+	if (good >= 0 && !ended && strcmp(magic, htSNAP_MAGIC) == 0) {
+		DEBUGPRINTF(TAG,"snapshot %s is incomplete", name);
+		good = -1;
+	}
+	free(buf);
+	free(key);
+	fclose(f);
+	return (good);
+}
+
+htLog_t *pxHtLogOpen (hashtab_t *table, const char *path, const htLogConfig_t *config)
+{
+	static const htLogConfig_t defaults;
+	size_t plen = strlen(path) + 6;		// room for the longest suffix
+	htLog_t *log;
+	long good;
+
+	if (table->xMultimap || table->ulCurEntries) {
+		DEBUGPRINTF(TAG,"table \"%s\" must be empty, and not a multimap, to be logged", table->pcTablename);
+		return (NULL);
+	}
+	if (!(log = calloc(1, sizeof *log)) || !(log->pcLogName = malloc(4 * plen))) {
+		free(log);
+		return (NULL);
+	}
+	log->pcOldName = log->pcLogName + plen;
+	log->pcSnapName = log->pcOldName + plen;
+	log->pcTmpName = log->pcSnapName + plen;
+	snprintf(log->pcLogName, plen, "%s.log", path);
+	snprintf(log->pcOldName, plen, "%s.old", path);
+	snprintf(log->pcSnapName, plen, "%s.snap", path);
+	snprintf(log->pcTmpName, plen, "%s.tmp", path);
+	log->pxTable = table;
+	log->xConfig = config ? *config : defaults;
+	if (!log->xConfig.ulBatchMs)
+		log->xConfig.ulBatchMs = htDEFBATCHMS;
+	if (!log->xConfig.ulBatchBytes)
+		log->xConfig.ulBatchBytes = htDEFBATCHBYTES;
+	log->ulValSize = table->ulValSize ? table->ulValSize : sizeof (void *);
+	log->ulBatchSize = log->xConfig.ulBatchBytes + prvMaxRecord(log);
+	log->iFd = -1;
+
+	// the snapshot, then whatever it didn't cover
+	if (!(log->pcBatch = malloc(log->ulBatchSize))
+		|| prvReplay(log, log->pcSnapName, htSNAP_MAGIC) < 0
+		|| prvReplay(log, log->pcOldName, htLOG_MAGIC) < 0
+		|| (good = prvReplay(log, log->pcLogName, htLOG_MAGIC)) < 0)
+		goto fail;
+	if (good) {			// carry on from the last good record
+		if ((log->iFd = open(log->pcLogName, O_WRONLY | O_APPEND)) < 0 || ftruncate(log->iFd, good) < 0)
+			goto fail;
+		log->xStats.ulLogBytes = good;
+	} else {
+		if ((log->iFd = prvCreateFile(log->pcLogName, htLOG_MAGIC, log->ulValSize)) < 0)
+			goto fail;
+		prvSyncDir(log->pcLogName);
+		log->xStats.ulLogBytes = sizeof (htFileHdr_t);
+	}
+	if (!iHtSetChangeCallback(table, prvLogChange, log))
+		goto fail;
+	return (log);
+
+fail:
+	DEBUGPRINTF(TAG,"can't recover or log table \"%s\" at %s", table->pcTablename, path);
+	if (log->iFd >= 0)
+		close(log->iFd);
+	free(log->pcBatch);
+	free(log->pcLogName);
+	free(log);
+	return (NULL);
+}
+
+int iHtLogCommit (htLog_t *log)
+{
+	int ret = prvWriteBatch(log);
+
+	prvReap(log, 0);
+	if (ret == 0 && log->xCompactDue && !log->xCompactor)
+		ret = iHtLogCompact(log);
+	return (ret);
+}
+
+// Put what's in the current log at the end of the old one
+static int prvAppendLog (htLog_t *log)
+{
+	int in = open(log->pcLogName, O_RDONLY), out = open(log->pcOldName, O_WRONLY | O_APPEND);
+	char buf[8192];
+	ssize_t n = -1;
+
+	if (in >= 0 && out >= 0 && lseek(in, sizeof (htFileHdr_t), SEEK_SET) >= 0) {
+		while ((n = read(in, buf, sizeof buf)) > 0 && prvWriteAll(out, buf, n) == 0)
+			;
+		if (n == 0)
+			n = fsync(out);
+	}
+	if (in >= 0)
+		close(in);
+	if (out >= 0)
+		close(out);
+	return (n == 0 ? 0 : -1);
+}
+
+// Runs in the compacting child: write the table out as a snapshot beside
+// the real one, then put it in its place
+static int prvWriteSnapshot (htLog_t *log)
+{
+	int fd = prvCreateFile(log->pcTmpName, htSNAP_MAGIC, log->ulValSize);
+	size_t used = 0;
+	htRecHdr_t end = { 0, htREC_END, 0, 0 };
+
+	if (fd < 0)
+		return (-1);
+	htFOREACH(it, e, log->pxTable) {
+		size_t len = prvPutRecord(log, log->pcSnapBuf + used, e, htREC_SET);
+
+		if (!len)
+			return (-1);
+		used += len;
+		if (used + prvMaxRecord(log) > log->ulSnapBufSize) {
+			if (prvWriteAll(fd, log->pcSnapBuf, used) < 0)
+				return (-1);
+			used = 0;
+		}
+	}
+	end.ulCheck = prvCheck((char *)&end + sizeof end.ulCheck, sizeof end - sizeof end.ulCheck);
+	memcpy(log->pcSnapBuf + used, &end, sizeof end);
+	used += sizeof end;
+	if (prvWriteAll(fd, log->pcSnapBuf, used) < 0 || fsync(fd) < 0 || close(fd) < 0
+		|| rename(log->pcTmpName, log->pcSnapName) < 0)
+		return (-1);
+	prvSyncDir(log->pcSnapName);
+	return (0);
+}
+
+int iHtLogCompact (htLog_t *log)
+{
+	pid_t pid;
+	int ok;
+
+	prvReap(log, 0);
+	if (log->xCompactor)
+		return (0);				// already under way
+	if (prvWriteBatch(log) < 0)
+		return (-1);
+	if (!log->pcSnapBuf) {
+		log->ulSnapBufSize = htDEFBATCHBYTES + 2 * prvMaxRecord(log);
+		if (!(log->pcSnapBuf = malloc(log->ulSnapBufSize)))
+			return (-1);
+	}
+	// Everything logged so far will be in the snapshot.  Set that log aside
+	// (adding it to one left by a compaction that failed) and start another.
+	close(log->iFd);
+	if (access(log->pcOldName, F_OK) == 0)
+		ok = prvAppendLog(log) == 0 && unlink(log->pcLogName) == 0;
+	else
+		ok = rename(log->pcLogName, log->pcOldName) == 0;
+	if (!ok) {
+		log->iFd = open(log->pcLogName, O_WRONLY | O_APPEND);
+		return (-1);
+	}
+	if ((log->iFd = prvCreateFile(log->pcLogName, htLOG_MAGIC, log->ulValSize)) < 0) {
+		DEBUGPRINTF(TAG,"can't create %s, no longer logging changes", log->pcLogName);
+		log->xFailed = 1;
+		return (-1);
+	}
+	prvSyncDir(log->pcLogName);
+	log->xStats.ulLogBytes = sizeof (htFileHdr_t);
+	fflush(stdout);				// or the child writes it out again
+	if ((pid = fork()) == 0)
+		_exit(prvWriteSnapshot(log) == 0 ? 0 : 1);
+	if (pid < 0)
+		return (-1);			// p.old stays until a compaction works
+	log->xCompactor = pid;
+	log->xCompactDue = 0;
+	return (0);
+}
+
+void vHtLogClose (htLog_t *log)
+{
+	(void) prvWriteBatch(log);
+	prvReap(log, 1);
+	(void) iHtSetChangeCallback(log->pxTable, NULL, NULL);
+	if (log->iFd >= 0)
+		close(log->iFd);
+	free(log->pcBatch);
+	free(log->pcSnapBuf);
+	free(log->pcLogName);
+	free(log);
+}
+
+const htLogStats_t *pxHtLogStats (htLog_t *log)
+{
+	return (&log->xStats);
+}
@@ -0,0 +1,82 @@
+/*
+ *  htlog.h
+ *
+ *  Copyright 2010,2022 TRIA Network Systems. See LICENSE file for details.
+ */
+
+#ifndef _HTLOG_H_
+#define _HTLOG_H_
+
+#include "hashtab.h"
+
+// Change logs make a table durable.  Every add, change and delete is
+// appended to a log file as a small binary record holding the key and the
+// entry's value afterwards (the inline value, or the bits of the value union
+// -- pointers mean nothing after a restart, so log tables whose values are
+// numbers or inline).  Records are collected in memory and written, and by
+// default fsync'd, a batch at a time.  Opening a log on an empty table first
+// recovers it: the last snapshot is loaded and the log replayed on top,
+// stopping at any record torn by a crash.
+//
+// Batches are written as changes are made, so a table that goes quiet keeps
+// its last batch in memory until iHtLogCommit is called: call it from a
+// timer or the program's main loop, at least every ulBatchMs.  Compaction
+// also starts there, once the log has grown past ulCompactBytes.
+//
+// Compaction writes a new snapshot from a forked child, so the table stays
+// in use meanwhile, and the log it covers is dropped once the snapshot is
+// safely in place.  Its files, for a log opened with path "p":
+//
+//		p.snap	the last complete snapshot
+//		p.old	changes covered by a snapshot still being written
+//		p.log	changes since
+//
+// Logs are for POSIX systems, and for tables with one value per key (not
+// multimaps) holding either integer or string keys, not both.
+
+#define htLOG_SYNC_BATCH	0	// fsync each batch as it's written (the default)
+#define htLOG_SYNC_EACH		1	// write and fsync every change as it's made
+#define htLOG_SYNC_NONE		2	// write batches, leave flushing them to the OS
+
+// Settings for a log.  A zeroed htLogConfig_t gives the defaults.
+typedef struct {
+	unsigned ulSync;		// one of the htLOG_SYNC_ values above
+	unsigned ulBatchMs;		// write a batch, at the next change, once its oldest change
+							// is this old, 0 for 10ms
+	size_t ulBatchBytes;	// or once it's this big, 0 for 64K
+	size_t ulCompactBytes;	// compact at the next commit once the log grows past this,
+							// 0 for never
+} htLogConfig_t;
+
+typedef struct {
+	unsigned long ulRecords;	// changes logged
+	unsigned long ulBatches;	// batches written
+	unsigned long ulSyncs;		// fsyncs done for them
+	unsigned long ulReplayed;	// records applied when the table was recovered
+	unsigned long ulCompactions;	// snapshots completed
+	size_t ulLogBytes;			// size of the current log file
+} htLogStats_t;
+
+typedef struct _htLog htLog_t;
+
+// Recover table (which should be empty) from the files at path, then log
+// its changes there.  NULL if the files can't be read or created, or don't
+// match the table.  config may be NULL.
+htLog_t *pxHtLogOpen (hashtab_t *table, const char *path, const htLogConfig_t *config);
+
+// Write and sync the current batch now; until then the latest changes can be
+// lost in a crash.  Starts a compaction if one is due.  Returns 0, or -1 if
+// the log couldn't be written (in which case it stops logging) or the
+// compaction couldn't be started.
+int iHtLogCommit (htLog_t *log);
+
+// Start a compaction in the background, unless one is already running.
+// Returns 0, or -1 if it couldn't be started.
+int iHtLogCompact (htLog_t *log);
+
+// Commit, wait for any compaction, and stop logging the table
+void vHtLogClose (htLog_t *log);
+
+const htLogStats_t *pxHtLogStats (htLog_t *log);
+
+#endif
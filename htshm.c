@@ -0,0 +1,441 @@
+/*
+ *  htshm.c
+ *
+ *  Copyright 2010,2022 TRIA Network Systems. See LICENSE file for details.
+ */
+
+#define _GNU_SOURCE			// for shm_open and robust mutexes
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hashtab_typed.h"		// for the hash functions
+#include "htshm.h"
+
+#define DEBUGPRINTF(tag,format,x...)	printf("%s " format "\n",TAG,x)
+
+static const char* TAG = "[htshm]"; // labels log message origin
+
+// The segment: this header, the buckets (each the offset of the first entry
+// in its chain, 0 if empty), then maxentries entries.  An offset is from the
+// start of the segment, so 0 is never an entry.
+#define htSHM_MAGIC		"HTSHM01"	// fills acMagic, with the terminator
+#define htSHM_ALIGN		64		// the buckets and entries start on cache lines
+#define htSHM_SPINS		64		// looks at an odd sequence count before yielding
+#define htSHM_STUCK		4096	// and before checking the writer is still alive
+
+typedef struct {
+	char acMagic[8];		// written last, once the rest is ready
+	uint32_t ulBuckets;
+	uint32_t ulKeyBytes;	// string key room in each entry, 0 for integer keys
+	uint32_t ulValSize;
+	uint32_t ulValOffset;	// where the value starts in an entry
+	uint64_t ulEntrySize;
+	uint64_t ulBytes;		// size of the segment
+	uint64_t ulMaxEntries;
+	uint64_t ulCurEntries;
+	uint64_t ulBucketsOff;	// where the bucket array starts
+	uint64_t ulEntriesOff;	// and the entries
+	uint64_t ulFree;		// first entry on the free list, 0 if none
+	uint64_t ulFresh;		// first entry never used
+	uint64_t ulSeq;			// odd while a writer changes something a reader may be looking at
+	pthread_mutex_t xLock;	// held by writers
+} htShmHdr_t;
+
+typedef struct {
+	uint64_t ulNext;		// next in the chain, or on the free list; 0 at the end
+	uint32_t ulHash;		// of the key, so most mismatches aren't compared
+	uint32_t ulKey;			// integer tables
+	// then ulKeyBytes of string key, and the value at ulValOffset
+} htShmEnt_t;
+
+struct _htShm {
+	htShmHdr_t *pxHdr;		// the mapping, which starts with the header
+	char *pcBase;			// the same, for adding offsets to
+	size_t ulBytes;
+	unsigned long ulRetries;
+};
+
+#define htSHMROUND(n)		(((n) + htSHM_ALIGN - 1) & ~(size_t)(htSHM_ALIGN - 1))
+#define htSHMENT(shm,off)	((htShmEnt_t *)((shm)->pcBase + (off)))
+#define htSHMBUCKETS(shm)	((uint64_t *)((shm)->pcBase + (shm)->pxHdr->ulBucketsOff))
+#define htSHMKEY(e)			((char *)(e) + sizeof (htShmEnt_t))
+#define htSHMVAL(shm,e)		((char *)(e) + (shm)->pxHdr->ulValOffset)
+
+// Names like "/name" are shared-memory objects, anything else a file
+static int prvIsShmName (const char *name)
+{
+	return (name[0] == '/' && !strchr(name + 1, '/'));
+}
+static int prvOpen (const char *name, int flags)
+{
+	return (prvIsShmName(name) ? shm_open(name, flags, 0600) : open(name, flags, 0600));
+}
+int iHtShmUnlink (const char *name)
+{
+	return (prvIsShmName(name) ? shm_unlink(name) : unlink(name));
+}
+
+static htShm_t *prvMap (int fd, size_t bytes)
+{
+	htShm_t *shm = malloc(sizeof (htShm_t));
+	void *p;
+
+	if (!shm)
+		return (NULL);
+	if ((p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		free(shm);
+		return (NULL);
+	}
+	shm->pxHdr = p;
+	shm->pcBase = p;
+	shm->ulBytes = bytes;
+	shm->ulRetries = 0;
+	return (shm);
+}
+void vHtShmDetach (htShm_t *shm)
+{
+	munmap(shm->pcBase, shm->ulBytes);
+	free(shm);
+}
+
+htShm_t *pxHtShmCreate (const char *name, size_t maxentries, unsigned numbuckets,
+						unsigned keybytes, unsigned valsize)
+{
+	size_t valoffset, entrysize, bucketsoff, entriesoff, bytes;
+	pthread_mutexattr_t attr;
+	htShmHdr_t *h;
+	htShm_t *shm;
+	int fd;
+
+	if (!valsize)
+		valsize = 8;
+	numbuckets |= 1;	// avoid degenerate case of even bucket count
+	valoffset = (sizeof (htShmEnt_t) + keybytes + 7) & ~(size_t)7;
+	entrysize = (valoffset + valsize + 7) & ~(size_t)7;
+	bucketsoff = htSHMROUND(sizeof (htShmHdr_t));
+	entriesoff = htSHMROUND(bucketsoff + (size_t)numbuckets * sizeof (uint64_t));
+	bytes = entriesoff + maxentries * entrysize;
+	if (!maxentries || (bytes - entriesoff) / entrysize != maxentries) {
+		DEBUGPRINTF(TAG,"bad size for shared hashtable \"%s\"", name);
+		return (NULL);
+	}
+	if ((fd = prvOpen(name, O_RDWR | O_CREAT | O_EXCL)) < 0) {
+		DEBUGPRINTF(TAG,"can't create shared hashtable \"%s\": %s", name, strerror(errno));
+		return (NULL);
+	}
+	if (ftruncate(fd, bytes) != 0 || !(shm = prvMap(fd, bytes))) {		// zeroed, so buckets are empty
+		DEBUGPRINTF(TAG,"can't size or map shared hashtable \"%s\": %s", name, strerror(errno));
+		close(fd);
+		iHtShmUnlink(name);
+		return (NULL);
+	}
+	close(fd);
+	h = shm->pxHdr;
+	h->ulBuckets = numbuckets;
+	h->ulKeyBytes = keybytes;
+	h->ulValSize = valsize;
+	h->ulValOffset = valoffset;
+	h->ulEntrySize = entrysize;
+	h->ulBytes = bytes;
+	h->ulMaxEntries = maxentries;
+	h->ulCurEntries = 0;
+	h->ulBucketsOff = bucketsoff;
+	h->ulEntriesOff = h->ulFresh = entriesoff;
+	h->ulFree = 0;
+	h->ulSeq = 0;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&h->xLock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(h->acMagic, htSHM_MAGIC, sizeof h->acMagic);
+	return (shm);
+}
+
+htShm_t *pxHtShmAttach (const char *name)
+{
+	struct stat st;
+	htShmHdr_t *h;
+	htShm_t *shm;
+	int fd;
+
+	if ((fd = prvOpen(name, O_RDWR)) < 0)
+		return (NULL);
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof (htShmHdr_t) || !(shm = prvMap(fd, st.st_size))) {
+		close(fd);
+		return (NULL);
+	}
+	close(fd);
+	h = shm->pxHdr;
+	if (memcmp(h->acMagic, htSHM_MAGIC, sizeof h->acMagic) != 0 || h->ulBytes != (uint64_t)st.st_size
+		|| h->ulBucketsOff + (uint64_t)h->ulBuckets * sizeof (uint64_t) > h->ulEntriesOff
+		|| h->ulValOffset < sizeof (htShmEnt_t) + h->ulKeyBytes || h->ulValOffset + h->ulValSize > h->ulEntrySize
+		|| h->ulEntriesOff + h->ulMaxEntries * h->ulEntrySize != h->ulBytes) {
+		DEBUGPRINTF(TAG,"\"%s\" isn't a shared hashtable", name);
+		vHtShmDetach(shm);
+		return (NULL);
+	}
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return (shm);
+}
+
+// **************************************************
+// Readers don't lock.  A writer makes the sequence count odd while it
+// changes a value or takes an entry out of a chain, and even again after, so
+// a reader that saw the same even count before and after its lookup knows no
+// such change overlapped it.  Adds don't need to: the new entry is filled in
+// before the single store that links it into its chain, and an entry taken
+// from the free list was unlinked by a delete, which a reader still on it
+// will have seen.
+// ***************************************************
+
+static inline void prvWriteBegin (htShmHdr_t *h)
+{
+	__atomic_store_n(&h->ulSeq, h->ulSeq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+static inline void prvWriteEnd (htShmHdr_t *h)
+{
+	__atomic_store_n(&h->ulSeq, h->ulSeq + 1, __ATOMIC_RELEASE);
+}
+
+// A writer died holding the lock.  Chains are changed by single stores, so
+// they're whole; at worst an entry it was adding or deleting is lost, and the
+// count is off, and the sequence count odd.
+static void prvRecover (htShm_t *shm)
+{
+	htShmHdr_t *h = shm->pxHdr;
+	uint64_t n = 0;
+
+	for (unsigned b = 0; b < h->ulBuckets; b++) {
+		for (uint64_t off = htSHMBUCKETS(shm)[b]; off; off = htSHMENT(shm, off)->ulNext)
+			n++;
+	}
+	h->ulCurEntries = n;
+	if (h->ulSeq & 1)
+		prvWriteEnd(h);
+	pthread_mutex_consistent(&h->xLock);
+	DEBUGPRINTF(TAG,"recovered shared hashtable after a writer died, %lu entries", (unsigned long)n);
+}
+static int prvLock (htShm_t *shm)
+{
+	int r = pthread_mutex_lock(&shm->pxHdr->xLock);
+
+	if (r == EOWNERDEAD) {
+		prvRecover(shm);
+		r = 0;
+	}
+	return (r == 0);
+}
+static void prvUnlock (htShm_t *shm)
+{
+	pthread_mutex_unlock(&shm->pxHdr->xLock);
+}
+
+// A reader found a writer in the middle of a change: wait, and if that goes
+// on too long, make sure the writer hasn't died
+static void prvWait (htShm_t *shm, unsigned spins)
+{
+	if (spins % htSHM_STUCK == 0) {
+		int r = pthread_mutex_trylock(&shm->pxHdr->xLock);
+
+		if (r == EOWNERDEAD)
+			prvRecover(shm);
+		if (r == EOWNERDEAD || r == 0)
+			prvUnlock(shm);		// else busy: the writer is only slow
+	} else if (spins % htSHM_SPINS == 0) {
+		sched_yield();
+	}
+}
+
+// Keys a table can't hold: the wrong kind, or strings too long for the entry
+static inline int prvKeyOk (htShm_t *shm, const char *name)
+{
+	unsigned room = shm->pxHdr->ulKeyBytes;
+
+	return (name ? room && strnlen(name, room) < room : !room);
+}
+static inline unsigned prvHash (unsigned key, const char *name)
+{
+	return (name ? ulHtHashString(name) : ulHtHashUnsigned(key));
+}
+
+// Look for a key in its chain.  Readers may be racing a writer, so every
+// offset is checked before it's followed and the walk is bounded; what they
+// find only counts if the sequence count hasn't changed meanwhile.  linkp,
+// for writers, is set to where the entry is linked from.
+static htShmEnt_t *prvFind (htShm_t *shm, unsigned key, const char *name, unsigned hash, uint64_t **linkp)
+{
+	htShmHdr_t *h = shm->pxHdr;
+	uint64_t *link = &htSHMBUCKETS(shm)[hash % h->ulBuckets], off;
+
+	for (uint64_t steps = 0; (off = __atomic_load_n(link, __ATOMIC_ACQUIRE)); steps++) {
+		htShmEnt_t *e;
+
+		if (off < h->ulEntriesOff || off >= shm->ulBytes
+			|| (off - h->ulEntriesOff) % h->ulEntrySize || steps > h->ulMaxEntries)
+			return (NULL);	// torn by a writer
+		e = htSHMENT(shm, off);
+		if (e->ulHash == hash && (name ? strncmp(name, htSHMKEY(e), h->ulKeyBytes) == 0 : e->ulKey == key)) {
+			if (linkp)
+				*linkp = link;
+			return (e);
+		}
+		link = &e->ulNext;
+	}
+	return (NULL);
+}
+
+// Find a key without locking, copying its value out if value isn't NULL
+static htShmEnt_t *prvRead (htShm_t *shm, unsigned key, const char *name, void *value)
+{
+	htShmHdr_t *h = shm->pxHdr;
+	unsigned hash, spins = 0;
+
+	if (!prvKeyOk(shm, name))
+		return (NULL);
+	hash = prvHash(key, name);
+	for (;;) {
+		uint64_t seq = __atomic_load_n(&h->ulSeq, __ATOMIC_ACQUIRE);
+		htShmEnt_t *e;
+
+		if (seq & 1) {
+			prvWait(shm, ++spins);
+			continue;
+		}
+		e = prvFind(shm, key, name, hash, NULL);
+		if (e && value)
+			memcpy(value, htSHMVAL(shm, e), h->ulValSize);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&h->ulSeq, __ATOMIC_RELAXED) == seq)
+			return (e);
+		shm->ulRetries++;
+	}
+}
+
+int iHtShmIGetVal (htShm_t *shm, unsigned key, void *value)
+{
+	return (prvRead(shm, key, NULL, value) != NULL);
+}
+int iHtShmSGetVal (htShm_t *shm, const char *name, void *value)
+{
+	return (prvRead(shm, 0, name, value) != NULL);
+}
+const void *pvHtShmIFindVal (htShm_t *shm, unsigned key)
+{
+	htShmEnt_t *e = prvRead(shm, key, NULL, NULL);
+
+	return (e ? htSHMVAL(shm, e) : NULL);
+}
+const void *pvHtShmSFindVal (htShm_t *shm, const char *name)
+{
+	htShmEnt_t *e = prvRead(shm, 0, name, NULL);
+
+	return (e ? htSHMVAL(shm, e) : NULL);
+}
+
+static void prvStoreVal (htShm_t *shm, htShmEnt_t *e, const void *value)
+{
+	if (value)
+		memcpy(htSHMVAL(shm, e), value, shm->pxHdr->ulValSize);
+	else
+		memset(htSHMVAL(shm, e), 0, shm->pxHdr->ulValSize);
+}
+
+static int prvSet (htShm_t *shm, unsigned key, const char *name, const void *value)
+{
+	htShmHdr_t *h = shm->pxHdr;
+	unsigned hash;
+	uint64_t off, *head;
+	htShmEnt_t *e;
+
+	if (!prvKeyOk(shm, name) || !prvLock(shm))
+		return (0);
+	hash = prvHash(key, name);
+	if ((e = prvFind(shm, key, name, hash, NULL))) {
+		prvWriteBegin(h);
+		prvStoreVal(shm, e, value);
+		prvWriteEnd(h);
+		prvUnlock(shm);
+		return (1);
+	}
+	if (h->ulFree) {
+		off = h->ulFree;
+		h->ulFree = htSHMENT(shm, off)->ulNext;
+	} else if (h->ulFresh < h->ulBytes) {
+		off = h->ulFresh;
+		h->ulFresh += h->ulEntrySize;
+	} else {
+		prvUnlock(shm);
+		return (0);		// full
+	}
+	e = htSHMENT(shm, off);
+	e->ulHash = hash;
+	e->ulKey = key;
+	if (name) {
+		memset(htSHMKEY(e), 0, h->ulKeyBytes);
+		strcpy(htSHMKEY(e), name);
+	}
+	prvStoreVal(shm, e, value);
+	head = &htSHMBUCKETS(shm)[hash % h->ulBuckets];
+	e->ulNext = *head;
+	__atomic_store_n(head, off, __ATOMIC_RELEASE);	// readers see all of it, or none
+	h->ulCurEntries++;
+	prvUnlock(shm);
+	return (1);
+}
+int iHtShmISetVal (htShm_t *shm, unsigned key, const void *value)
+{
+	return (prvSet(shm, key, NULL, value));
+}
+int iHtShmSSetVal (htShm_t *shm, const char *name, const void *value)
+{
+	return (prvSet(shm, 0, name, value));
+}
+
+static int prvDelete (htShm_t *shm, unsigned key, const char *name)
+{
+	htShmHdr_t *h = shm->pxHdr;
+	uint64_t *link;
+	htShmEnt_t *e;
+
+	if (!prvKeyOk(shm, name) || !prvLock(shm))
+		return (0);
+	if (!(e = prvFind(shm, key, name, prvHash(key, name), &link))) {
+		prvUnlock(shm);
+		return (0);
+	}
+	prvWriteBegin(h);
+	__atomic_store_n(link, e->ulNext, __ATOMIC_RELAXED);
+	e->ulNext = h->ulFree;		// a reader still on e would follow this
+	h->ulFree = (char *)e - shm->pcBase;
+	prvWriteEnd(h);
+	h->ulCurEntries--;
+	prvUnlock(shm);
+	return (1);
+}
+int iHtShmIDelete (htShm_t *shm, unsigned key)
+{
+	return (prvDelete(shm, key, NULL));
+}
+int iHtShmSDelete (htShm_t *shm, const char *name)
+{
+	return (prvDelete(shm, 0, name));
+}
+
+void vHtShmStats (htShm_t *shm, htShmStats_t *stats)
+{
+	stats->ulEntries = __atomic_load_n(&shm->pxHdr->ulCurEntries, __ATOMIC_RELAXED);
+	stats->ulMaxEntries = shm->pxHdr->ulMaxEntries;
+	stats->ulBytes = shm->ulBytes;
+	stats->ulRetries = shm->ulRetries;
+}
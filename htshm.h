@@ -0,0 +1,82 @@
+/*
+ *  htshm.h
+ *
+ *  Copyright 2010,2022 TRIA Network Systems. See LICENSE file for details.
+ */
+
+#ifndef _HTSHM_H_
+#define _HTSHM_H_
+
+#include <stddef.h>
+
+// Shared-memory tables, for several processes using the same lookup table
+// without each building its own copy.  The whole table -- buckets, entries,
+// keys and values -- lives in one POSIX shared-memory segment (a name like
+// "/routes") or mapped file (any other path), and refers to its own parts
+// by offset rather than pointer, so each process can map it anywhere.  One
+// process creates it, any number attach to it by name, and all of them may
+// look keys up and change it.
+//
+//		htShm_t *shm = pxHtShmCreate ("/ports", 100000, 50001, 0, sizeof (long));
+//		... in the other processes:
+//		htShm_t *shm = pxHtShmAttach ("/ports");
+//		long v;
+//		if (iHtShmIGetVal (shm, 80, &v)) ...
+//
+// Writers take a process-shared mutex (robust: if a process dies holding it
+// the next writer recovers the table).  Readers take no lock at all; a
+// sequence count in the segment tells them when a change overlapped their
+// lookup, and they look again.  A table holds integer keys, or string keys
+// of up to keybytes bytes with the terminator, kept in the entries.  Values
+// are valsize bytes copied in and out (pointers would mean nothing in
+// another process).  The size is fixed when the table is created: adds fail
+// once it holds maxentries.  POSIX only.
+
+typedef struct _htShm htShm_t;
+
+typedef struct {
+	size_t ulEntries;			// in the table now
+	size_t ulMaxEntries;
+	size_t ulBytes;				// size of the segment
+	unsigned long ulRetries;	// lookups by this process that had to look again
+} htShmStats_t;
+
+// Create a table at name, which must not already exist, for up to
+// maxentries entries.  keybytes is 0 for a table of integer keys, valsize 0
+// means 8.  NULL if it can't be created.
+htShm_t *pxHtShmCreate (const char *name, size_t maxentries, unsigned numbuckets,
+						unsigned keybytes, unsigned valsize);
+
+// Map a table another process created.  NULL if there's none at name, or
+// it's not (yet) a complete table.
+htShm_t *pxHtShmAttach (const char *name);
+
+// Unmap the table from this process; it stays until unlinked, and after
+// that until the last process detaches
+void vHtShmDetach (htShm_t *shm);
+int iHtShmUnlink (const char *name);
+
+// Add or replace the value for a key: value points at valsize bytes (NULL
+// stores zeroes).  Non-zero on success, 0 if the table is full or the key
+// is too long.
+int iHtShmISetVal (htShm_t *shm, unsigned key, const void *value);
+int iHtShmSSetVal (htShm_t *shm, const char *name, const void *value);
+
+// Copy the value for a key into value (if it's not NULL), returning non-zero
+// if the key was found
+int iHtShmIGetVal (htShm_t *shm, unsigned key, void *value);
+int iHtShmSGetVal (htShm_t *shm, const char *name, void *value);
+
+// Where the value for a key is in the segment, NULL if it isn't there.  No
+// copying, but nothing stops a writer changing the value while it's being
+// read, so for tables that are filled and then only read.
+const void *pvHtShmIFindVal (htShm_t *shm, unsigned key);
+const void *pvHtShmSFindVal (htShm_t *shm, const char *name);
+
+// Remove a key, returning the number of entries deleted, 0 or 1
+int iHtShmIDelete (htShm_t *shm, unsigned key);
+int iHtShmSDelete (htShm_t *shm, const char *name);
+
+void vHtShmStats (htShm_t *shm, htShmStats_t *stats);
+
+#endif